@@ -0,0 +1,337 @@
+/*
+ * bench.c
+ *
+ * Built-in load generator
+ *
+ * Every thread runs a closed loop on its own connection: pick a request
+ * from the mix, send it, wait for the answer, record the latency. With
+ * keep-alive the connection is reused, otherwise each request pays for
+ * connect() and close() like a regular client invocation. Keep-alive runs
+ * against a server on this host use one local channel per thread instead.
+ *
+ * Latencies go into a log-linear (HDR-style) histogram per thread: exact
+ * below 128 ns, then 64 sub-buckets per power of two, so every recorded
+ * value is within 1.6% of its bucket. Histograms are merged at the end.
+ */
+
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include "local.h"
+
+#if !defined(_WIN32) && !defined(WIN32)
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HIST_SUB_BITS 6
+#define HIST_SUB_COUNT (1u << HIST_SUB_BITS)
+#define HIST_LINEAR_LIMIT (2u * HIST_SUB_COUNT)
+#define HIST_MAX_SHIFT 40
+#define HIST_BUCKETS (HIST_LINEAR_LIMIT + HIST_MAX_SHIFT * HIST_SUB_COUNT)
+
+typedef struct {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+} histogram_t;
+
+typedef struct {
+	const bench_options_t *options;
+	const weather_request_t *mix;
+	size_t mix_count;
+	uint64_t deadline_ns;           // 0 when running for a request count
+	atomic_ulong *issued;           // Requests claimed so far (count mode)
+	uint32_t rng_state;
+	unsigned long status_counts[3]; // Responses by STATUS_* code
+	unsigned long errors;           // Connect/send/receive failures and unknown statuses
+	histogram_t histogram;
+	pthread_t thread;
+} bench_worker_t;
+
+static const char *DEFAULT_MIX_CITIES[] = {
+	"Bari", "Roma", "Milano", "Napoli", "Torino",
+	"Palermo", "Genova", "Bologna", "Firenze", "Venezia"
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static unsigned int histogram_index(uint64_t value) {
+	if (value < HIST_LINEAR_LIMIT) {
+		return (unsigned int) value;
+	}
+
+	const unsigned int msb = 63u - (unsigned int) __builtin_clzll(value);
+	unsigned int shift = msb - HIST_SUB_BITS;
+	if (shift > HIST_MAX_SHIFT) {
+		shift = HIST_MAX_SHIFT;
+		value = ((uint64_t) HIST_LINEAR_LIMIT << HIST_MAX_SHIFT) - 1;
+	}
+	// value >> shift lies in [HIST_SUB_COUNT, 2 * HIST_SUB_COUNT).
+	return HIST_LINEAR_LIMIT + (shift - 1) * HIST_SUB_COUNT + (unsigned int) (value >> shift) - HIST_SUB_COUNT;
+}
+
+// Highest value that maps to bucket index.
+static uint64_t histogram_value(unsigned int index) {
+	if (index < HIST_LINEAR_LIMIT) {
+		return index;
+	}
+
+	const unsigned int shift = (index - HIST_LINEAR_LIMIT) / HIST_SUB_COUNT + 1;
+	const uint64_t sub = (index - HIST_LINEAR_LIMIT) % HIST_SUB_COUNT + HIST_SUB_COUNT;
+	return ((sub + 1) << shift) - 1;
+}
+
+static void histogram_record(histogram_t *histogram, uint64_t value) {
+	++histogram->counts[histogram_index(value)];
+	++histogram->total;
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+static void histogram_merge(histogram_t *into, const histogram_t *from) {
+	for (unsigned int i = 0; i < HIST_BUCKETS; ++i) {
+		into->counts[i] += from->counts[i];
+	}
+	into->total += from->total;
+	if (from->max > into->max) {
+		into->max = from->max;
+	}
+}
+
+static uint64_t histogram_percentile(const histogram_t *histogram, double percentile) {
+	if (histogram->total == 0) {
+		return 0;
+	}
+
+	uint64_t rank = (uint64_t) ((percentile / 100.0) * (double) histogram->total + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < HIST_BUCKETS; ++i) {
+		seen += histogram->counts[i];
+		if (seen >= rank) {
+			const uint64_t value = histogram_value(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+static uint32_t worker_random(bench_worker_t *worker) {
+	uint32_t x = worker->rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	worker->rng_state = x;
+	return x;
+}
+
+// Claims the next request; returns 0 once the count or the duration is used up.
+static int worker_claim(bench_worker_t *worker) {
+	if (worker->deadline_ns != 0) {
+		return now_ns() < worker->deadline_ns;
+	}
+	return atomic_fetch_add(worker->issued, 1) < worker->options->requests;
+}
+
+static void *worker_main(void *arg) {
+	bench_worker_t *worker = arg;
+	const bench_options_t *options = worker->options;
+	int socket_fd = -1;
+	local_channel_t *local = NULL;
+
+	while (worker_claim(worker)) {
+		const weather_request_t *request = &worker->mix[worker_random(worker) % worker->mix_count];
+		weather_response_t response;
+
+		const uint64_t start = now_ns();
+		if (options->local) {
+			if (local == NULL) {
+				local = local_channel_open(options->port);
+				if (local == NULL) {
+					++worker->errors;
+					continue;
+				}
+			}
+			if (local_channel_query(local, request, &response, 1) != 0) {
+				++worker->errors;
+				local_channel_close(local);
+				local = NULL;
+				continue;
+			}
+		} else {
+			if (socket_fd < 0) {
+				socket_fd = options->udp ? open_datagram_socket(options->server_address, options->port)
+						: connect_to_server(options->server_address, options->port);
+				if (socket_fd < 0) {
+					++worker->errors;
+					continue;
+				}
+			}
+
+			if (options->udp) {
+				// One socket per thread for the whole run; a lost query is an error, not a reconnect.
+				if (query_weather_datagram(socket_fd, request, &response, options->timeout_ms) != 0) {
+					++worker->errors;
+					continue;
+				}
+			} else if (send_weather_request(socket_fd, request) != 0 || receive_weather_response(socket_fd, &response) != 0) {
+				// The server may have dropped a kept-alive connection: count it and reconnect.
+				++worker->errors;
+				close(socket_fd);
+				socket_fd = -1;
+				continue;
+			}
+
+			if (!options->keep_alive && !options->udp) {
+				close(socket_fd);
+				socket_fd = -1;
+			}
+		}
+		histogram_record(&worker->histogram, now_ns() - start);
+
+		if (response.status <= STATUS_INVALID_REQUEST) {
+			++worker->status_counts[response.status];
+		} else {
+			++worker->errors;
+		}
+	}
+
+	if (socket_fd >= 0) {
+		close(socket_fd);
+	}
+	local_channel_close(local);
+	return NULL;
+}
+
+static void print_report(const bench_options_t *options, const bench_worker_t *workers, int count, double elapsed_s) {
+	static histogram_t merged;
+	memset(&merged, 0, sizeof(merged));
+	unsigned long status_counts[3] = { 0, 0, 0 };
+	unsigned long errors = 0;
+
+	for (int i = 0; i < count; ++i) {
+		histogram_merge(&merged, &workers[i].histogram);
+		for (int status = 0; status < 3; ++status) {
+			status_counts[status] += workers[i].status_counts[status];
+		}
+		errors += workers[i].errors;
+	}
+
+	printf("Benchmark: %llu risposte in %.3f s, %d %s\n",
+			(unsigned long long) merged.total, elapsed_s, options->concurrency,
+			options->udp ? "socket UDP" : options->local ? "canali locali in memoria condivisa"
+			: options->keep_alive ? "connessioni persistenti" : "connessioni (una per richiesta)");
+	printf("Throughput: %.0f req/s\n", elapsed_s > 0.0 ? (double) merged.total / elapsed_s : 0.0);
+	printf("Latenza (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+			histogram_percentile(&merged, 50.0) / 1000.0,
+			histogram_percentile(&merged, 90.0) / 1000.0,
+			histogram_percentile(&merged, 99.0) / 1000.0,
+			histogram_percentile(&merged, 99.9) / 1000.0,
+			merged.max / 1000.0);
+	printf("Esiti: %lu successo, %lu città non disponibile, %lu richiesta non valida, %lu errori\n",
+			status_counts[STATUS_SUCCESS], status_counts[STATUS_CITY_NOT_AVAILABLE],
+			status_counts[STATUS_INVALID_REQUEST], errors);
+}
+
+int bench_available(void) {
+	return 1;
+}
+
+int bench_run(const bench_options_t *requested, const weather_request_t *mix, size_t mix_count) {
+	bench_options_t effective = *requested;
+	const bench_options_t *options = &effective;
+	if (effective.local) {
+		// A server without --local is benchmarked over TCP.
+		local_channel_t *probe = local_channel_open(effective.port);
+		effective.local = probe != NULL;
+		local_channel_close(probe);
+	}
+
+	weather_request_t default_mix[WEATHER_TYPE_COUNT * (sizeof(DEFAULT_MIX_CITIES) / sizeof(DEFAULT_MIX_CITIES[0]))];
+	if (mix_count == 0) {
+		// Every type for every city the server knows out of the box.
+		memset(default_mix, 0, sizeof(default_mix));
+		for (size_t i = 0; i < sizeof(default_mix) / sizeof(default_mix[0]); ++i) {
+			default_mix[i].type = WEATHER_TYPES[i % WEATHER_TYPE_COUNT].type;
+			strncpy(default_mix[i].city, DEFAULT_MIX_CITIES[i / WEATHER_TYPE_COUNT], MAX_CITY_LEN - 1);
+		}
+		mix = default_mix;
+		mix_count = sizeof(default_mix) / sizeof(default_mix[0]);
+	}
+
+	const int count = options->concurrency;
+	bench_worker_t *workers = calloc((size_t) count, sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Memoria insufficiente per %d connessioni\n", count);
+		return -1;
+	}
+
+	atomic_ulong issued;
+	atomic_init(&issued, 0);
+	const uint64_t start = now_ns();
+	const uint64_t deadline = options->requests == 0 ? start + (uint64_t) (options->duration_s * 1e9) : 0;
+
+	int started = 0;
+	for (int i = 0; i < count; ++i) {
+		workers[i].options = options;
+		workers[i].mix = mix;
+		workers[i].mix_count = mix_count;
+		workers[i].deadline_ns = deadline;
+		workers[i].issued = &issued;
+		workers[i].rng_state = (uint32_t) (start ^ (start >> 32)) ^ (0x9e3779b9u * (uint32_t) (i + 1));
+		if (workers[i].rng_state == 0) {
+			workers[i].rng_state = 1;
+		}
+
+		int result = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+		if (result != 0) {
+			fprintf(stderr, "pthread_create() fallita: %s\n", strerror(result));
+			break;
+		}
+		++started;
+	}
+
+	for (int i = 0; i < started; ++i) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	const double elapsed_s = (double) (now_ns() - start) / 1e9;
+
+	print_report(options, workers, started, elapsed_s);
+
+	int failed = started < count;
+	for (int i = 0; i < started; ++i) {
+		failed |= workers[i].errors != 0;
+	}
+	free(workers);
+	return failed ? -1 : 0;
+}
+
+#else
+
+int bench_available(void) {
+	return 0;
+}
+
+int bench_run(const bench_options_t *options, const weather_request_t *mix, size_t mix_count) {
+	(void) options;
+	(void) mix;
+	(void) mix_count;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * bench.h
+ *
+ * Built-in load generator
+ * Drives the server from several concurrent connections with a mix of
+ * requests and reports throughput and latency percentiles.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define BENCH_MAX_CONCURRENCY 1024
+
+typedef struct {
+	const char *server_address;
+	unsigned short port;
+	int concurrency;          // Parallel connections, one thread each
+	unsigned long requests;   // Total requests to send, 0 when running for a duration
+	double duration_s;        // Run time in seconds when requests is 0
+	int keep_alive;           // Reuse one connection per thread (server started with -k)
+	int udp;                  // Query over UDP datagrams (server started with -u)
+	int local;                // Use local channels with keep-alive when the server offers them (--local)
+	unsigned int timeout_ms;  // UDP reply timeout before a resend
+} bench_options_t;
+
+// Returns 1 when the benchmark mode is supported on this platform.
+int bench_available(void);
+
+// Runs the benchmark cycling through mix[0..mix_count) (a default mix when
+// mix_count is 0) and prints the report; returns 0 when every request succeeded.
+int bench_run(const bench_options_t *options, const weather_request_t *mix, size_t mix_count);
+
+#endif /* BENCH_H_ */
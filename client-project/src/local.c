@@ -0,0 +1,232 @@
+/*
+ * local.c
+ *
+ * Local transport
+ *
+ * The client creates the channel, so the server never maps memory another
+ * client could know about, and passes the memfd on the server's Unix
+ * socket; the server answers with its doorbell eventfd. Requests are
+ * published in one go per submit, ringing the doorbell only when the
+ * server marked the ring before going to sleep. Waiting for an answer
+ * spins for shm_spin_ns(), then sleeps on the response ring's futex and
+ * looks at the socket after every SHM_WAIT_MS to notice a server that
+ * exited. The socket lives in world-writable /tmp, so the channel is only
+ * handed to a server running as this user or as root.
+ */
+
+#define _GNU_SOURCE
+
+#include "local.h"
+#include "shmring.h"
+
+#include <stdlib.h>
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define SPIN_CLOCK_ROUNDS 64 // Spin rounds between two clock reads
+
+struct local_channel {
+	int socket;
+	int doorbell;
+	shm_channel_t *shared;
+	uint32_t request_tail;
+	uint32_t response_head;
+	uint64_t spin_ns;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+local_channel_t *local_channel_open(unsigned short port) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (local_socket_path(port, address.sun_path, sizeof(address.sun_path)) < 0) {
+		return NULL;
+	}
+
+	local_channel_t *channel = calloc(1, sizeof(*channel));
+	if (channel == NULL) {
+		return NULL;
+	}
+	channel->doorbell = -1;
+	channel->spin_ns = shm_spin_ns();
+	channel->socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (channel->socket < 0 || connect(channel->socket, (struct sockaddr *) &address, sizeof(address)) < 0) {
+		// No server with --local on this port, or the socket file of one that is gone.
+		local_channel_close(channel);
+		return NULL;
+	}
+	struct ucred peer;
+	socklen_t peer_length = sizeof(peer);
+	if (getsockopt(channel->socket, SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) < 0
+			|| (peer.uid != getuid() && peer.uid != 0)) {
+		fprintf(stderr, "Il socket locale %s appartiene a un altro utente, uso TCP\n", address.sun_path);
+		local_channel_close(channel);
+		return NULL;
+	}
+
+	int memory = -1;
+	channel->shared = shm_channel_create(&memory);
+	if (channel->shared == NULL) {
+		local_channel_close(channel);
+		return NULL;
+	}
+	const int sent = shm_send_message(channel->socket, SHM_HELLO, memory);
+	close(memory);
+
+	struct timeval timeout = { LOCAL_SETUP_TIMEOUT_MS / 1000, (LOCAL_SETUP_TIMEOUT_MS % 1000) * 1000 };
+	setsockopt(channel->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char kind = 0;
+	if (sent < 0 || shm_recv_message(channel->socket, &kind, &channel->doorbell) < 0
+			|| kind != SHM_HELLO || channel->doorbell < 0) {
+		local_channel_close(channel);
+		return NULL;
+	}
+	return channel;
+}
+
+size_t local_channel_submit(local_channel_t *channel, const weather_request_t *requests, size_t count) {
+	// Unread answers count too: the server must always have room to answer.
+	const uint32_t room = SHM_RING_SLOTS - (channel->request_tail - channel->response_head);
+	const size_t queued = count < room ? count : room;
+	if (queued == 0) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < queued; ++i) {
+		channel->shared->request_slots[(channel->request_tail + i) % SHM_RING_SLOTS] = requests[i];
+	}
+	channel->request_tail += (uint32_t) queued;
+	if (shm_ring_publish(&channel->shared->requests, channel->request_tail)) {
+		const uint64_t ring = 1;
+		if (write(channel->doorbell, &ring, sizeof(ring)) < 0) {
+			perror("write() sul campanello fallita");
+		}
+	}
+	return queued;
+}
+
+int local_channel_ready(local_channel_t *channel) {
+	const uint32_t ready = shm_ring_ready(&channel->shared->responses, channel->response_head);
+	return ready > 0 && ready <= channel->request_tail - channel->response_head;
+}
+
+// Whether the server closed its end of the socket.
+static int server_gone(local_channel_t *channel) {
+	struct pollfd watch = { channel->socket, POLLIN, 0 };
+	return poll(&watch, 1, 0) != 0;
+}
+
+int local_channel_receive(local_channel_t *channel, weather_response_t *response) {
+	shm_ring_t *responses = &channel->shared->responses;
+	const uint32_t expected = channel->request_tail - channel->response_head;
+	if (expected == 0) {
+		return -1;
+	}
+
+	uint32_t ready = shm_ring_ready(responses, channel->response_head);
+	if (ready == 0 && channel->spin_ns > 0) {
+		const uint64_t deadline = now_ns() + channel->spin_ns;
+		for (unsigned int rounds = 1; ready == 0; ++rounds) {
+			if (rounds % SPIN_CLOCK_ROUNDS == 0 && now_ns() >= deadline) {
+				break;
+			}
+			shm_cpu_relax();
+			ready = shm_ring_ready(responses, channel->response_head);
+		}
+	}
+	while (ready == 0) {
+		shm_ring_wait(responses, channel->response_head, SHM_WAIT_MS);
+		ready = shm_ring_ready(responses, channel->response_head);
+		if (ready == 0 && server_gone(channel)) {
+			return -1;
+		}
+	}
+	if (ready > expected) {
+		return -1;
+	}
+
+	*response = channel->shared->response_slots[channel->response_head % SHM_RING_SLOTS];
+	++channel->response_head;
+	shm_ring_consume(responses, channel->response_head);
+	return 0;
+}
+
+void local_channel_close(local_channel_t *channel) {
+	if (channel == NULL) {
+		return;
+	}
+	// The server unmaps its side once it sees the socket close.
+	shm_channel_unmap(channel->shared);
+	if (channel->doorbell >= 0) {
+		close(channel->doorbell);
+	}
+	if (channel->socket >= 0) {
+		close(channel->socket);
+	}
+	free(channel);
+}
+
+#else
+
+struct local_channel {
+	int unused;
+};
+
+local_channel_t *local_channel_open(unsigned short port) {
+	(void) port;
+	return NULL;
+}
+
+size_t local_channel_submit(local_channel_t *channel, const weather_request_t *requests, size_t count) {
+	(void) channel;
+	(void) requests;
+	(void) count;
+	return 0;
+}
+
+int local_channel_ready(local_channel_t *channel) {
+	(void) channel;
+	return 0;
+}
+
+int local_channel_receive(local_channel_t *channel, weather_response_t *response) {
+	(void) channel;
+	(void) response;
+	return -1;
+}
+
+void local_channel_close(local_channel_t *channel) {
+	free(channel);
+}
+
+#endif
+
+int local_channel_query(local_channel_t *channel, const weather_request_t *requests, weather_response_t *responses, size_t count) {
+	if (channel == NULL || requests == NULL || responses == NULL || count == 0) {
+		return -1;
+	}
+
+	// Keeps the ring full: every answer read makes room for one more request.
+	size_t submitted = 0;
+	for (size_t answered = 0; answered < count; ++answered) {
+		submitted += local_channel_submit(channel, requests + submitted, count - submitted);
+		if (local_channel_receive(channel, &responses[answered]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * local.h
+ *
+ * Local transport
+ * Queries a server on this host (started with --local) through a
+ * shared-memory channel instead of a TCP connection. Requests and answers
+ * are copied in and out of rings the server polls, so a lookup makes no
+ * system call while both sides are busy (Linux only).
+ */
+
+#ifndef LOCAL_H_
+#define LOCAL_H_
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define LOCAL_SETUP_TIMEOUT_MS 1000 // Longest wait for the server to accept the channel
+
+typedef struct local_channel local_channel_t;
+
+// Opens a channel to the server listening on port of this host. Returns
+// NULL when the server does not offer one, or when the socket belongs to
+// a process of another user (reported on stderr): the caller then uses TCP.
+local_channel_t *local_channel_open(unsigned short port);
+
+// Queues as many of requests[0..count) as the ring has room for (at most
+// SHM_RING_SLOTS unanswered) and returns how many were queued.
+size_t local_channel_submit(local_channel_t *channel, const weather_request_t *requests, size_t count);
+
+// Returns 1 when the answer to the oldest unanswered request has arrived.
+int local_channel_ready(local_channel_t *channel);
+
+// Waits for the answer to the oldest unanswered request. Returns -1 when
+// nothing is unanswered or the server went away.
+int local_channel_receive(local_channel_t *channel, weather_response_t *response);
+
+// Sends every request and stores the answers in order, like
+// send_weather_requests() and receive_weather_responses() on a connection.
+int local_channel_query(local_channel_t *channel, const weather_request_t *requests, weather_response_t *responses, size_t count);
+
+void local_channel_close(local_channel_t *channel);
+
+#endif /* LOCAL_H_ */
@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -21,6 +22,7 @@
 #endif
 
 #include <ctype.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +31,12 @@
 #define NO_ERROR 0
 #endif
 #include "protocol.h"
+#include "bench.h"
+#include "pool.h"
+#include "queryfile.h"
+#include "local.h"
+#include "wire.h"
+#include "netio.h"
 
 void clearwinsock() {
 #if defined(_WIN32) || defined(WIN32)
@@ -85,42 +93,41 @@ int parse_request(const char *request_arg, weather_request_t *out_request) {
 	return 0;
 }
 
-int connect_to_server(const char *server_address, unsigned short port) {
+int resolve_server_address(const char *server_address, unsigned short port, struct sockaddr_in *out_address) {
 	const char *address = server_address != NULL ? server_address : DEFAULT_SERVER_ADDRESS;
 
-	int client_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (client_socket < 0) {
-		return -1;
-	}
+	memset(out_address, 0, sizeof(*out_address));
+	out_address->sin_family = AF_INET;
+	out_address->sin_port = htons(port);
 
-	struct sockaddr_in sad;
-	memset(&sad, 0, sizeof(sad));
-	sad.sin_family = AF_INET;
-	sad.sin_port = htons(port);
-
-	int resolved = 0;
 #if defined(_WIN32) || defined(WIN32)
 	unsigned long addr_numeric = inet_addr(address);
 	if (addr_numeric != INADDR_NONE) {
-		sad.sin_addr.s_addr = addr_numeric;
-		resolved = 1;
+		out_address->sin_addr.s_addr = addr_numeric;
+		return 0;
 	}
 #else
-	if (inet_pton(AF_INET, address, &sad.sin_addr) > 0) {
-		resolved = 1;
+	if (inet_pton(AF_INET, address, &out_address->sin_addr) > 0) {
+		return 0;
 	}
 #endif
 
-	if (!resolved) {
-		struct hostent *host = gethostbyname(address);
-		if (host == NULL || host->h_addr_list == NULL || host->h_addr_list[0] == NULL) {
-			closesocket(client_socket);
-			return -1;
-		}
-		memcpy(&sad.sin_addr, host->h_addr_list[0], (size_t) host->h_length);
+	struct hostent *host = gethostbyname(address);
+	if (host == NULL || host->h_addr_list == NULL || host->h_addr_list[0] == NULL) {
+		return -1;
 	}
+	memcpy(&out_address->sin_addr, host->h_addr_list[0], (size_t) host->h_length);
+	return 0;
+}
 
-	if (connect(client_socket, (struct sockaddr*) &sad, sizeof(sad)) < 0) {
+// Connects a socket of the given type to an already resolved address.
+static int open_socket_to(const struct sockaddr_in *address, int type, int protocol) {
+	int client_socket = socket(PF_INET, type, protocol);
+	if (client_socket < 0) {
+		return -1;
+	}
+
+	if (connect(client_socket, (const struct sockaddr*) address, sizeof(*address)) < 0) {
 		closesocket(client_socket);
 		return -1;
 	}
@@ -128,41 +135,330 @@ int connect_to_server(const char *server_address, unsigned short port) {
 	return client_socket;
 }
 
+// Resolves the server address and connects a socket of the given type to it.
+static int open_connected_socket(const char *server_address, unsigned short port, int type, int protocol) {
+	struct sockaddr_in sad;
+	if (resolve_server_address(server_address, port, &sad) < 0) {
+		return -1;
+	}
+	return open_socket_to(&sad, type, protocol);
+}
+
+int connect_to_address(const struct sockaddr_in *address) {
+	return open_socket_to(address, SOCK_STREAM, IPPROTO_TCP);
+}
+
+int connect_to_server(const char *server_address, unsigned short port) {
+	return open_connected_socket(server_address, port, SOCK_STREAM, IPPROTO_TCP);
+}
+
+int open_datagram_socket(const char *server_address, unsigned short port) {
+	// A connected UDP socket only accepts datagrams from the server address.
+	return open_connected_socket(server_address, port, SOCK_DGRAM, IPPROTO_UDP);
+}
+
+int send_weather_requests(int socket_fd, const weather_request_t *requests, size_t count) {
+	if (socket_fd < 0 || requests == NULL || count == 0) {
+		return -1;
+	}
+
+	// Pipelining: all requests leave in as few segments as possible before any response is read.
+	unsigned char buffer[MAX_PIPELINED_REQUESTS * (4 + MAX_CITY_LEN)];
+	size_t used = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (sizeof(buffer) - used < 4 + MAX_CITY_LEN) {
+			if (net_send_all(socket_fd, buffer, used, NULL) != 0) {
+				return -1;
+			}
+			used = 0;
+		}
+		const size_t encoded = wire_encode_request(buffer + used, sizeof(buffer) - used, requests[i].type, requests[i].city);
+		if (encoded == 0) {
+			return -1;
+		}
+		used += encoded;
+	}
+
+	return net_send_all(socket_fd, buffer, used, NULL);
+}
+
 int send_weather_request(int socket_fd, const weather_request_t *request) {
-	if (socket_fd < 0 || request == NULL) {
+	return send_weather_requests(socket_fd, request, 1);
+}
+
+int receive_weather_responses(int socket_fd, weather_response_t *responses, size_t count) {
+	if (socket_fd < 0 || responses == NULL || count == 0) {
 		return -1;
 	}
 
-	const char *buffer = (const char*) request;
-	const size_t total_size = sizeof(weather_request_t);
-	size_t sent_bytes = 0;
+	unsigned char buffer[MAX_PIPELINED_REQUESTS * WIRE_RESPONSE_SIZE];
+	size_t done = 0;
 
-	while (sent_bytes < total_size) {
-		int result = send(socket_fd, buffer + sent_bytes, (int) (total_size - sent_bytes), 0);
-		if (result <= 0) {
+	while (done < count) {
+		const size_t chunk = count - done < MAX_PIPELINED_REQUESTS ? count - done : MAX_PIPELINED_REQUESTS;
+		if (net_recv_all(socket_fd, buffer, chunk * WIRE_RESPONSE_SIZE) != 0) {
 			return -1;
 		}
-		sent_bytes += (size_t) result;
+		for (size_t i = 0; i < chunk; ++i) {
+			weather_response_t *response = &responses[done + i];
+			memset(response, 0, sizeof(*response));
+			if (wire_decode_response(buffer + i * WIRE_RESPONSE_SIZE, &response->status, &response->type, &response->value) != 0) {
+				return -1;
+			}
+		}
+		done += chunk;
 	}
 
 	return 0;
 }
 
 int receive_weather_response(int socket_fd, weather_response_t *response) {
-	if (socket_fd < 0 || response == NULL) {
+	return receive_weather_responses(socket_fd, response, 1);
+}
+
+// Waits up to timeout_ms for the socket to become readable; returns 1 when it is.
+static int wait_readable(int socket_fd, unsigned int timeout_ms) {
+	fd_set read_set;
+	FD_ZERO(&read_set);
+	FD_SET(socket_fd, &read_set);
+	struct timeval timeout;
+	timeout.tv_sec = (long) (timeout_ms / 1000);
+	timeout.tv_usec = (long) (timeout_ms % 1000) * 1000;
+	return select(socket_fd + 1, &read_set, NULL, NULL, &timeout) > 0;
+}
+
+int query_weather_datagram(int socket_fd, const weather_request_t *request, weather_response_t *response, unsigned int timeout_ms) {
+	if (socket_fd < 0 || request == NULL || response == NULL) {
+		return -1;
+	}
+
+	unsigned char frame[4 + MAX_CITY_LEN];
+	size_t frame_size = wire_encode_request(frame, sizeof(frame), request->type, request->city);
+	if (frame_size == 0) {
+		return -1;
+	}
+	// The server drops a datagram shorter than its answer: a short city goes as a legacy struct.
+	const int legacy = frame_size < WIRE_RESPONSE_SIZE;
+	if (legacy) {
+		_Static_assert(sizeof(weather_request_t) <= sizeof(frame), "a legacy request must fit the frame buffer");
+		memcpy(frame, request, sizeof(weather_request_t));
+		frame_size = sizeof(weather_request_t);
+	}
+	const int reply_size = legacy ? (int) sizeof(weather_response_t) : WIRE_RESPONSE_SIZE;
+
+	unsigned char reply[sizeof(weather_response_t) + WIRE_RESPONSE_SIZE];
+	// Late answers to an earlier, retried query must not be taken for this one.
+	while (wait_readable(socket_fd, 0)) {
+		if (recv(socket_fd, (char*) reply, sizeof(reply), 0) < 0) {
+			break;
+		}
+	}
+
+	for (int attempt = 0; attempt < UDP_MAX_ATTEMPTS; ++attempt) {
+		if (send(socket_fd, (const char*) frame, (int) frame_size, 0) != (int) frame_size) {
+			return -1;
+		}
+
+		while (wait_readable(socket_fd, timeout_ms)) {
+			int received = recv(socket_fd, (char*) reply, sizeof(reply), 0);
+			if (received != reply_size) {
+				// Not an answer (or an ICMP error for a closed port): keep waiting out the timeout.
+				continue;
+			}
+			memset(response, 0, sizeof(*response));
+			if (legacy) {
+				memcpy(response, reply, sizeof(*response));
+				if (response->type == request->type || response->type == '\0') {
+					return 0;
+				}
+			} else if (wire_decode_response(reply, &response->status, &response->type, &response->value) == 0
+					&& (response->type == request->type || response->type == '\0')) {
+				return 0;
+			}
+		}
+	}
+
+	return -1;
+}
+
+int send_weather_batch(int socket_fd, const weather_request_t *items, size_t count) {
+	if (socket_fd < 0 || items == NULL || count == 0 || count > MAX_BATCH_ITEMS) {
+		return -1;
+	}
+
+	// The header occupies one request slot, so header and items leave in a single send.
+	weather_request_t frame[MAX_BATCH_ITEMS + 1];
+	weather_batch_request_t header;
+	memset(&header, 0, sizeof(header));
+	header.type = REQUEST_TYPE_BATCH;
+	header.count = (unsigned char) count;
+	memcpy(&frame[0], &header, sizeof(header));
+	memcpy(&frame[1], items, sizeof(weather_request_t) * count);
+
+	// Batches keep the legacy struct layout.
+	return net_send_all(socket_fd, frame, sizeof(weather_request_t) * (count + 1), NULL);
+}
+
+int receive_weather_batch(int socket_fd, weather_response_t *responses, size_t count) {
+	if (socket_fd < 0 || responses == NULL || count == 0 || count > MAX_BATCH_ITEMS) {
+		return -1;
+	}
+
+	weather_batch_response_t header;
+	if (net_recv_all(socket_fd, &header, sizeof(header)) != 0) {
+		return -1;
+	}
+	if (header.status != STATUS_SUCCESS || header.count != count) {
+		return -1;
+	}
+
+	weather_batch_entry_t entries[MAX_BATCH_ITEMS];
+	if (net_recv_all(socket_fd, entries, sizeof(weather_batch_entry_t) * count) != 0) {
+		return -1;
+	}
+
+	// Expand to weather_response_t so callers format batch and single answers alike.
+	for (size_t i = 0; i < count; ++i) {
+		memset(&responses[i], 0, sizeof(responses[i]));
+		responses[i].status = entries[i].status;
+		responses[i].type = entries[i].type;
+		responses[i].value = entries[i].value;
+	}
+
+	return 0;
+}
+
+int send_weather_subscribe(int socket_fd, unsigned int interval_ms, const weather_request_t *items, size_t count) {
+	if (socket_fd < 0 || items == NULL || count == 0 || count > MAX_SUBSCRIBE_ITEMS) {
+		return -1;
+	}
+
+	unsigned char frame[WIRE_MAX_SUBSCRIBE_SIZE];
+	const size_t frame_size = wire_encode_subscribe(frame, sizeof(frame), interval_ms, items, count);
+	if (frame_size == 0) {
+		return -1;
+	}
+	return net_send_all(socket_fd, frame, frame_size, NULL);
+}
+
+int receive_weather_subscribe_ack(int socket_fd, weather_response_t *responses, size_t count) {
+	if (receive_weather_response(socket_fd, &responses[0]) != 0) {
+		return -1;
+	}
+	// A refused subscription is a single answer typed 'S', whatever the item count.
+	if (responses[0].type == WIRE_SUBSCRIBE && responses[0].status != STATUS_SUCCESS) {
+		return -1;
+	}
+	return count > 1 ? receive_weather_responses(socket_fd, responses + 1, count - 1) : 0;
+}
+
+int receive_weather_update(int socket_fd, unsigned int *item, weather_response_t *response) {
+	unsigned char frame[WIRE_UPDATE_SIZE];
+	if (net_recv_all(socket_fd, frame, sizeof(frame)) != 0) {
+		return -1;
+	}
+
+	memset(response, 0, sizeof(*response));
+	response->status = STATUS_SUCCESS;
+	return wire_decode_update(frame, item, &response->type, &response->value);
+}
+
+int query_weather_history(int socket_fd, const weather_request_t *request, unsigned int window_s, unsigned int points,
+		weather_history_t *history) {
+	if (socket_fd < 0 || request == NULL || history == NULL) {
+		return -1;
+	}
+
+	unsigned char frame[WIRE_MAX_REQUEST_SIZE + 8];
+	const char *city = strcmp(request->city, HISTORY_ALL_CITIES) == 0 ? "" : request->city;
+	const size_t frame_size = wire_encode_history_query(frame, sizeof(frame), window_s, points, request->type, city);
+	if (frame_size == 0 || net_send_all(socket_fd, frame, frame_size, NULL) != 0) {
+		return -1;
+	}
+
+	// The answer's length is in its header: read the header, then the rest.
+	unsigned char answer[WIRE_MAX_HISTORY_ANSWER_SIZE];
+	size_t received = 4;
+	if (net_recv_all(socket_fd, answer, received) != 0) {
+		return -1;
+	}
+	long length = wire_history_length(answer, received);
+	if (length == 0) {
+		if (net_recv_all(socket_fd, answer + received, 1) != 0) {
+			return -1;
+		}
+		length = wire_history_length(answer, ++received);
+	}
+	if (length <= 0 || (size_t) length > sizeof(answer)
+			|| net_recv_all(socket_fd, answer + received, (size_t) length - received) != 0) {
+		return -1;
+	}
+	return wire_decode_history(answer, (size_t) length, history);
+}
+
+// Capitalized copy of the request city, as shown in every message.
+static void format_city_label(const weather_request_t *request, char *label, size_t label_size) {
+	label[0] = '\0';
+	if (request == NULL || request->city[0] == '\0') {
+		return;
+	}
+	snprintf(label, label_size, "%.*s", MAX_CITY_LEN - 1, request->city);
+	for (size_t i = 0; label[i] != '\0'; ++i) {
+		label[i] = (char) (i == 0 ? toupper((unsigned char) label[i]) : tolower((unsigned char) label[i]));
+	}
+}
+
+int format_history_message(const weather_history_t *history,
+		const weather_request_t *request,
+		unsigned int window_s,
+		const char *server_ip,
+		char *out_buffer,
+		size_t out_size) {
+	if (history == NULL || request == NULL || server_ip == NULL || out_buffer == NULL || out_size == 0) {
 		return -1;
 	}
 
-	char *buffer = (char*) response;
-	const size_t total_size = sizeof(weather_response_t);
-	size_t received_bytes = 0;
+	char payload[RESPONSE_MESSAGE_LEN];
+	const int type_index = weather_type_index((char) tolower((unsigned char) request->type));
+	if (history->status != STATUS_SUCCESS) {
+		snprintf(payload, sizeof(payload), "%s", weather_status_text(history->status));
+	} else if (type_index < 0) {
+		return -1;
+	} else {
+		char city_label[MAX_CITY_LEN];
+		format_city_label(request, city_label, sizeof(city_label));
+		const weather_type_info_t *info = &WEATHER_TYPES[type_index];
+		const char *city_output = strcmp(request->city, HISTORY_ALL_CITIES) == 0 ? "Tutte le città" : city_label;
+		if (history->samples == 0) {
+			snprintf(payload, sizeof(payload), "%s: %s, ultimi %u s: nessun campione", city_output, info->label, window_s);
+		} else {
+			snprintf(payload, sizeof(payload), "%s: %s, ultimi %u s: %lu campioni, min %.1f%s, max %.1f%s, media %.1f%s, ultimo %.1f%s",
+					city_output, info->label, window_s, (unsigned long) history->samples,
+					history->min, info->unit, history->max, info->unit, history->mean, info->unit, history->last, info->unit);
+		}
+	}
+
+	int written = snprintf(out_buffer, out_size, "Ricevuto risultato dal server ip %s. %s", server_ip, payload);
+	if (written < 0 || (size_t) written >= out_size) {
+		return -1;
+	}
 
-	while (received_bytes < total_size) {
-		int result = recv(socket_fd, buffer + received_bytes, (int) (total_size - received_bytes), 0);
-		if (result <= 0) {
+	// One line per bucket, oldest first.
+	for (unsigned int i = 0; history->status == STATUS_SUCCESS && i < history->points; ++i) {
+		const unsigned long from_s = (unsigned long) window_s * (history->points - i) / history->points;
+		const unsigned long to_s = (unsigned long) window_s * (history->points - i - 1) / history->points;
+		int line;
+		if (isnan(history->series[i])) {
+			line = snprintf(out_buffer + written, out_size - (size_t) written, "\n  da %lu a %lu s fa: nessun campione", from_s, to_s);
+		} else {
+			line = snprintf(out_buffer + written, out_size - (size_t) written, "\n  da %lu a %lu s fa: %.1f%s",
+					from_s, to_s, history->series[i], WEATHER_TYPES[type_index].unit);
+		}
+		if (line < 0 || (size_t) line >= out_size - (size_t) written) {
 			return -1;
 		}
-		received_bytes += (size_t) result;
+		written += line;
 	}
 
 	return 0;
@@ -178,49 +474,22 @@ int format_response_message(const weather_response_t *response,
 	}
 
 	char city_label[MAX_CITY_LEN];
-	memset(city_label, 0, sizeof(city_label));
-
-	if (request != NULL && request->city[0] != '\0') {
-		strncpy(city_label, request->city, MAX_CITY_LEN - 1);
-		size_t len = strlen(city_label);
-		for (size_t i = 0; i < len; ++i) {
-			if (i == 0) {
-				city_label[i] = (char) toupper((unsigned char) city_label[i]);
-			} else {
-				city_label[i] = (char) tolower((unsigned char) city_label[i]);
-			}
-		}
-	}
+	format_city_label(request, city_label, sizeof(city_label));
 
 	char payload[RESPONSE_MESSAGE_LEN];
 	memset(payload, 0, sizeof(payload));
 
 	if (response->status == STATUS_SUCCESS) {
-		const char type = (char) tolower((unsigned char) response->type);
+		const int type_index = weather_type_index((char) tolower((unsigned char) response->type));
 		const char *city_output = city_label[0] != '\0' ? city_label : "Città";
-
-		switch (type) {
-		case 't':
-			snprintf(payload, sizeof(payload), "%s: Temperatura = %.1f°C", city_output, response->value);
-			break;
-		case 'h':
-			snprintf(payload, sizeof(payload), "%s: Umidità = %.1f%%", city_output, response->value);
-			break;
-		case 'w':
-			snprintf(payload, sizeof(payload), "%s: Vento = %.1f km/h", city_output, response->value);
-			break;
-		case 'p':
-			snprintf(payload, sizeof(payload), "%s: Pressione = %.1f hPa", city_output, response->value);
-			break;
-		default:
+		if (type_index < 0) {
 			return -1;
 		}
-	} else if (response->status == STATUS_CITY_NOT_AVAILABLE) {
-		snprintf(payload, sizeof(payload), "Città non disponibile");
-	} else if (response->status == STATUS_INVALID_REQUEST) {
-		snprintf(payload, sizeof(payload), "Richiesta non valida");
+
+		const weather_type_info_t *info = &WEATHER_TYPES[type_index];
+		snprintf(payload, sizeof(payload), "%s: %s = %.1f%s", city_output, info->label, response->value, info->unit);
 	} else {
-		snprintf(payload, sizeof(payload), "Risposta non valida");
+		snprintf(payload, sizeof(payload), "%s", weather_status_text(response->status));
 	}
 
 	int written = snprintf(out_buffer, out_size, "Ricevuto risultato dal server ip %s. %s", server_ip, payload);
@@ -231,22 +500,57 @@ int format_response_message(const weather_response_t *response,
 	return 0;
 }
 
+// Whether server_address resolves to this host, where a server started with
+// --local can be reached over a shared-memory channel.
+static int is_local_server(const char *server_address, unsigned short port, struct sockaddr_in *resolved) {
+	return resolve_server_address(server_address, port, resolved) == 0
+			&& (ntohl(resolved->sin_addr.s_addr) >> 24) == 127;
+}
+
 int main(int argc, char *argv[]) {
 	int exit_code = EXIT_FAILURE;
 	int client_socket = -1;
-	weather_request_t request;
-	weather_response_t response;
+	local_channel_t *local = NULL;
+	int use_local = 1;
+	struct sockaddr_in local_addr;
+	weather_request_t requests[MAX_PIPELINED_REQUESTS];
+	weather_response_t responses[MAX_PIPELINED_REQUESTS];
+	size_t request_count = 0;
+	int batch_mode = 0;
+	int udp_mode = 0;
+	unsigned int udp_timeout_ms = DEFAULT_UDP_TIMEOUT_MS;
+	int bench_mode = 0;
+	unsigned int stream_interval_ms = 0;
+	unsigned int history_window_s = 0;
+	unsigned int history_points = 0;
+	char history_message[RESPONSE_MESSAGE_LEN * (MAX_HISTORY_POINTS + 1)];
+	const char *query_file = NULL;
+	FILE *query_input = NULL;
+	int feed_sockets[QUERY_FILE_MAX_CONNECTIONS];
+	size_t feed_socket_count = 0;
+	bench_options_t bench_options;
 	char response_message[RESPONSE_MESSAGE_LEN];
 	char server_ip[INET_ADDRSTRLEN] = {0};
 	char server_address[BUFFER_SIZE];
+	const char *servers[MAX_SERVERS];
+	size_t server_count = 0;
+	weather_pool_t *pool = NULL;
 	unsigned short server_port = DEFAULT_SERVER_PORT;
-	const char usage_format[] = "Uso: %s [-s server] [-p port] -r \"type city\"\n";
-
-	memset(&request, 0, sizeof(request));
-	memset(&response, 0, sizeof(response));
+	const char usage_format[] = "Uso: %s [-s server] [-p port] [-B | -u [-t ms]] [--tcp] -r \"type city\" [-r \"type city\" ...]\n"
+			"       %s -s server[:port] -s server[:port] [...] [-p port] -r \"type city\" [-r \"type city\" ...]\n"
+			"       %s -i ms [-s server] [-p port] -r \"type city\" [-r \"type city\" ...]\n"
+			"       %s -H secondi [-P punti] [-s server] [-p port] -r \"type city|*\" [-r \"type city|*\" ...]\n"
+			"       %s -f file|- [-c connessioni] [-s server] [-p port] [--tcp]\n"
+			"       %s --bench [-s server] [-p port] [-c connessioni] [-n richieste | -d secondi] [-k [--tcp] | -u [-t ms]] [-r \"type city\" ...]\n";
+
+	memset(requests, 0, sizeof(requests));
+	memset(responses, 0, sizeof(responses));
 	memset(response_message, 0, sizeof(response_message));
 	memset(server_address, 0, sizeof(server_address));
 	strncpy(server_address, DEFAULT_SERVER_ADDRESS, sizeof(server_address) - 1);
+	memset(&bench_options, 0, sizeof(bench_options));
+	bench_options.concurrency = 1;
+	bench_options.requests = 10000;
 
 #if defined(_WIN32) || defined(WIN32)
 	WSADATA wsa_data;
@@ -258,78 +562,277 @@ int main(int argc, char *argv[]) {
 #endif
 
 	// Parse CLI arguments
-	int request_present = 0;
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-s") == 0) {
 			if (i + 1 >= argc) {
 				fprintf(stderr, "Valore mancante per l'opzione -s\n");
-				fprintf(stderr, usage_format, argv[0]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			if (server_count >= MAX_SERVERS) {
+				fprintf(stderr, "Troppi server: massimo %d\n", MAX_SERVERS);
 				goto cleanup;
 			}
-			strncpy(server_address, argv[++i], sizeof(server_address) - 1);
+			servers[server_count++] = argv[++i];
+			strncpy(server_address, argv[i], sizeof(server_address) - 1);
 			server_address[sizeof(server_address) - 1] = '\0';
 		} else if (strcmp(argv[i], "-p") == 0) {
 			if (i + 1 >= argc) {
 				fprintf(stderr, "Valore mancante per l'opzione -p\n");
-				fprintf(stderr, usage_format, argv[0]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 				goto cleanup;
 			}
 			char *endptr = NULL;
 			unsigned long port_value = strtoul(argv[++i], &endptr, 10);
 			if (endptr == NULL || *endptr != '\0' || port_value == 0 || port_value > 65535) {
 				fprintf(stderr, "Valore di porta non valido: %s\n", argv[i]);
-				fprintf(stderr, usage_format, argv[0]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 				goto cleanup;
 			}
 			server_port = (unsigned short) port_value;
+		} else if (strcmp(argv[i], "-B") == 0) {
+			batch_mode = 1;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			udp_mode = 1;
+		} else if (strcmp(argv[i], "-t") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -t\n");
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			char *endptr = NULL;
+			unsigned long timeout_value = strtoul(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || timeout_value == 0 || timeout_value > MAX_UDP_TIMEOUT_MS) {
+				fprintf(stderr, "Timeout non valido: %s (1-%d ms)\n", argv[i], MAX_UDP_TIMEOUT_MS);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			udp_timeout_ms = (unsigned int) timeout_value;
+		} else if (strcmp(argv[i], "-i") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -i\n");
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			char *endptr = NULL;
+			unsigned long interval_value = strtoul(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || interval_value < MIN_SUBSCRIBE_INTERVAL_MS
+					|| interval_value > MAX_SUBSCRIBE_INTERVAL_MS) {
+				fprintf(stderr, "Intervallo non valido: %s (%d-%d ms)\n", argv[i], MIN_SUBSCRIBE_INTERVAL_MS,
+						MAX_SUBSCRIBE_INTERVAL_MS);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			stream_interval_ms = (unsigned int) interval_value;
+		} else if (strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "-P") == 0) {
+			const char option = argv[i][1];
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -%c\n", option);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			char *endptr = NULL;
+			unsigned long value = strtoul(argv[++i], &endptr, 10);
+			const unsigned long limit = option == 'H' ? MAX_HISTORY_WINDOW_S : MAX_HISTORY_POINTS;
+			if (endptr == NULL || *endptr != '\0' || (option == 'H' && value == 0) || value > limit) {
+				fprintf(stderr, "Valore non valido per l'opzione -%c: %s (massimo %lu)\n", option, argv[i], limit);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			if (option == 'H') {
+				history_window_s = (unsigned int) value;
+			} else {
+				history_points = (unsigned int) value;
+			}
+		} else if (strcmp(argv[i], "-f") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -f\n");
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			query_file = argv[++i];
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			bench_mode = 1;
+		} else if (strcmp(argv[i], "--tcp") == 0) {
+			use_local = 0;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			bench_options.keep_alive = 1;
+		} else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-n") == 0) {
+			const char option = argv[i][1];
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -%c\n", option);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			char *endptr = NULL;
+			unsigned long value = strtoul(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value == 0 || (option == 'c' && value > BENCH_MAX_CONCURRENCY)) {
+				fprintf(stderr, "Valore non valido per l'opzione -%c: %s\n", option, argv[i]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			if (option == 'c') {
+				bench_options.concurrency = (int) value;
+			} else {
+				bench_options.requests = value;
+			}
+		} else if (strcmp(argv[i], "-d") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -d\n");
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			char *endptr = NULL;
+			double seconds = strtod(argv[++i], &endptr);
+			if (endptr == NULL || *endptr != '\0' || !(seconds > 0.0)) {
+				fprintf(stderr, "Durata non valida: %s\n", argv[i]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			// A duration replaces the request count.
+			bench_options.duration_s = seconds;
+			bench_options.requests = 0;
 		} else if (strcmp(argv[i], "-r") == 0) {
 			if (i + 1 >= argc) {
 				fprintf(stderr, "Valore mancante per l'opzione -r\n");
-				fprintf(stderr, usage_format, argv[0]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+				goto cleanup;
+			}
+			if (request_count >= MAX_PIPELINED_REQUESTS) {
+				fprintf(stderr, "Troppe richieste: massimo %d per connessione\n", MAX_PIPELINED_REQUESTS);
 				goto cleanup;
 			}
-			if (parse_request(argv[++i], &request) != 0) {
+			if (parse_request(argv[++i], &requests[request_count]) != 0) {
 				fprintf(stderr, "Formato richiesta non valido. Atteso \"type city\".\n");
-				fprintf(stderr, usage_format, argv[0]);
+				fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 				goto cleanup;
 			}
-			request_present = 1;
+			++request_count;
 		} else {
 			fprintf(stderr, "Argomento sconosciuto: %s\n", argv[i]);
-			fprintf(stderr, usage_format, argv[0]);
+			fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 			goto cleanup;
 		}
 	}
 
-	if (!request_present) {
-		fprintf(stderr, "Opzione -r obbligatoria mancante\n");
-		fprintf(stderr, usage_format, argv[0]);
+	if (udp_mode && (batch_mode || bench_options.keep_alive)) {
+		fprintf(stderr, "L'opzione -u non si combina con -B o -k\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 		goto cleanup;
 	}
 
-	client_socket = connect_to_server(server_address, server_port);
-	if (client_socket < 0) {
-		fprintf(stderr, "Impossibile connettersi a %s:%u\n", server_address, server_port);
+	if (server_count > 1 && (batch_mode || udp_mode || bench_mode)) {
+		fprintf(stderr, "Più opzioni -s non si combinano con -B, -u o --bench\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		goto cleanup;
+	}
+
+	if (stream_interval_ms > 0 && (batch_mode || udp_mode || bench_mode || server_count > 1)) {
+		fprintf(stderr, "L'opzione -i non si combina con -B, -u, --bench o più opzioni -s\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		goto cleanup;
+	}
+
+	if (history_window_s > 0 && (batch_mode || udp_mode || bench_mode || stream_interval_ms > 0 || server_count > 1)) {
+		fprintf(stderr, "L'opzione -H non si combina con -B, -u, -i, --bench o più opzioni -s\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		goto cleanup;
+	}
+	if (history_points > 0 && history_window_s == 0) {
+		fprintf(stderr, "L'opzione -P richiede -H\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 		goto cleanup;
 	}
 
-	if (send_weather_request(client_socket, &request) != 0) {
-		fprintf(stderr, "Invio della richiesta meteo non riuscito\n");
+	if (query_file != NULL && (request_count > 0 || batch_mode || udp_mode || bench_mode || stream_interval_ms > 0
+			|| history_window_s > 0 || server_count > 1)) {
+		fprintf(stderr, "L'opzione -f non si combina con -r, -B, -u, -i, -H, --bench o più opzioni -s\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		goto cleanup;
+	}
+	if (query_file != NULL && bench_options.concurrency > QUERY_FILE_MAX_CONNECTIONS) {
+		fprintf(stderr, "Troppe connessioni per -f: massimo %d\n", QUERY_FILE_MAX_CONNECTIONS);
 		goto cleanup;
 	}
 
-	if (receive_weather_response(client_socket, &response) != 0) {
-		fprintf(stderr, "Ricezione della risposta meteo non riuscita\n");
+	if (bench_mode) {
+		if (!bench_available()) {
+			fprintf(stderr, "Modalità benchmark non disponibile su questa piattaforma\n");
+			goto cleanup;
+		}
+		// The -r requests, if any, form the request mix; otherwise a default mix is used.
+		bench_options.server_address = server_address;
+		bench_options.port = server_port;
+		bench_options.udp = udp_mode;
+		bench_options.timeout_ms = udp_timeout_ms;
+		// Persistent connections to this host become local channels unless --tcp is given.
+		bench_options.local = use_local && bench_options.keep_alive && is_local_server(server_address, server_port, &local_addr);
+		if (bench_run(&bench_options, requests, request_count) == 0) {
+			exit_code = EXIT_SUCCESS;
+		}
 		goto cleanup;
 	}
 
-	struct sockaddr_in peer_addr;
-	memset(&peer_addr, 0, sizeof(peer_addr));
-	socklen_t peer_len = sizeof(peer_addr);
-	if (getpeername(client_socket, (struct sockaddr*) &peer_addr, &peer_len) == 0) {
-		const char *resolved_ip = inet_ntoa(peer_addr.sin_addr);
-		if (resolved_ip != NULL) {
-			strncpy(server_ip, resolved_ip, sizeof(server_ip) - 1);
+	if (query_file != NULL) {
+		query_input = strcmp(query_file, "-") == 0 ? stdin : fopen(query_file, "r");
+		if (query_input == NULL) {
+			fprintf(stderr, "Impossibile aprire il file di richieste: %s\n", query_file);
+			goto cleanup;
+		}
+	} else if (request_count == 0) {
+		fprintf(stderr, "Opzione -r obbligatoria mancante\n");
+		fprintf(stderr, usage_format, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		goto cleanup;
+	}
+
+	if (server_count > 1) {
+		// Several -s: each request goes to the server owning its city, failing over when it is down.
+		pool = weather_pool_create(servers, server_count, server_port);
+		if (pool == NULL) {
+			goto cleanup;
+		}
+		for (size_t i = 0; i < request_count; ++i) {
+			const int server_index = weather_pool_query(pool, &requests[i], &responses[i]);
+			if (server_index < 0) {
+				fprintf(stderr, "Nessun server raggiungibile per la richiesta \"%c %s\"\n", requests[i].type, requests[i].city);
+				goto cleanup;
+			}
+			if (format_response_message(&responses[i], &requests[i], weather_pool_server_ip(pool, server_index),
+					response_message, sizeof(response_message)) != 0) {
+				fprintf(stderr, "Impossibile formattare la risposta del server\n");
+				goto cleanup;
+			}
+			printf("%s\n", response_message);
+		}
+		exit_code = EXIT_SUCCESS;
+		goto cleanup;
+	}
+
+	// Plain and -f queries to a server on this host try its shared-memory
+	// channel first and fall back to TCP when it offers none.
+	if (use_local && !udp_mode && !batch_mode && stream_interval_ms == 0 && history_window_s == 0
+			&& is_local_server(server_address, server_port, &local_addr)) {
+		local = local_channel_open(server_port);
+		if (local != NULL) {
+			strncpy(server_ip, inet_ntoa(local_addr.sin_addr), sizeof(server_ip) - 1);
+		}
+	}
+
+	if (local == NULL) {
+		client_socket = udp_mode ? open_datagram_socket(server_address, server_port) : connect_to_server(server_address, server_port);
+		if (client_socket < 0) {
+			fprintf(stderr, "Impossibile connettersi a %s:%u\n", server_address, server_port);
+			goto cleanup;
+		}
+
+		struct sockaddr_in peer_addr;
+		memset(&peer_addr, 0, sizeof(peer_addr));
+		socklen_t peer_len = sizeof(peer_addr);
+		if (getpeername(client_socket, (struct sockaddr*) &peer_addr, &peer_len) == 0) {
+			const char *resolved_ip = inet_ntoa(peer_addr.sin_addr);
+			if (resolved_ip != NULL) {
+				strncpy(server_ip, resolved_ip, sizeof(server_ip) - 1);
+			}
 		}
 	}
 	if (server_ip[0] == '\0') {
@@ -337,15 +840,138 @@ int main(int argc, char *argv[]) {
 	}
 	server_ip[sizeof(server_ip) - 1] = '\0';
 
-	if (format_response_message(&response, &request, server_ip, response_message, sizeof(response_message)) != 0) {
-		fprintf(stderr, "Impossibile formattare la risposta del server\n");
+	if (query_input != NULL && local != NULL) {
+		if (query_file_run_local(query_input, local, server_ip) == 0) {
+			exit_code = EXIT_SUCCESS;
+		}
+		goto cleanup;
+	}
+
+	if (query_input != NULL) {
+		// -f streams every line over -c pipelined connections (server started with -k).
+		feed_sockets[feed_socket_count++] = client_socket;
+		while (feed_socket_count < (size_t) bench_options.concurrency) {
+			const int feed_socket = connect_to_server(server_address, server_port);
+			if (feed_socket < 0) {
+				fprintf(stderr, "Impossibile connettersi a %s:%u\n", server_address, server_port);
+				goto cleanup;
+			}
+			feed_sockets[feed_socket_count++] = feed_socket;
+		}
+		if (query_file_run(query_input, feed_sockets, feed_socket_count, server_ip) == 0) {
+			exit_code = EXIT_SUCCESS;
+		}
+		goto cleanup;
+	}
+
+	if (history_window_s > 0) {
+		// -H asks for the recorded history of every -r, one query after the other (server started with -k).
+		for (size_t i = 0; i < request_count; ++i) {
+			weather_history_t history;
+			if (query_weather_history(client_socket, &requests[i], history_window_s, history_points, &history) != 0) {
+				fprintf(stderr, "Interrogazione dello storico non riuscita\n");
+				goto cleanup;
+			}
+			if (format_history_message(&history, &requests[i], history_window_s, server_ip,
+					history_message, sizeof(history_message)) != 0) {
+				fprintf(stderr, "Impossibile formattare la risposta del server\n");
+				goto cleanup;
+			}
+			printf("%s\n", history_message);
+		}
+		exit_code = EXIT_SUCCESS;
 		goto cleanup;
 	}
 
-	printf("%s\n", response_message);
+	if (stream_interval_ms > 0) {
+		// -i subscribes to every -r: the current values come back at once, then
+		// an update per item every interval until the server closes the stream.
+		if (request_count > MAX_SUBSCRIBE_ITEMS) {
+			fprintf(stderr, "Troppe richieste: massimo %d per sottoscrizione\n", MAX_SUBSCRIBE_ITEMS);
+			goto cleanup;
+		}
+		if (send_weather_subscribe(client_socket, stream_interval_ms, requests, request_count) != 0) {
+			fprintf(stderr, "Invio della sottoscrizione non riuscito\n");
+			goto cleanup;
+		}
+		if (receive_weather_subscribe_ack(client_socket, responses, request_count) != 0) {
+			fprintf(stderr, "Sottoscrizione rifiutata dal server\n");
+			goto cleanup;
+		}
+	} else if (udp_mode) {
+		// -u sends every -r as its own datagram, resent after each timeout.
+		for (size_t i = 0; i < request_count; ++i) {
+			if (query_weather_datagram(client_socket, &requests[i], &responses[i], udp_timeout_ms) != 0) {
+				fprintf(stderr, "Nessuna risposta UDP dal server dopo %d tentativi\n", UDP_MAX_ATTEMPTS);
+				goto cleanup;
+			}
+		}
+	} else if (batch_mode) {
+		// -B packs every -r into one batch message answered in a single round trip.
+		if (send_weather_batch(client_socket, requests, request_count) != 0) {
+			fprintf(stderr, "Invio della richiesta meteo non riuscito\n");
+			goto cleanup;
+		}
+
+		if (receive_weather_batch(client_socket, responses, request_count) != 0) {
+			fprintf(stderr, "Ricezione della risposta meteo non riuscita\n");
+			goto cleanup;
+		}
+	} else if (local != NULL) {
+		if (local_channel_query(local, requests, responses, request_count) != 0) {
+			fprintf(stderr, "Canale locale interrotto dal server\n");
+			goto cleanup;
+		}
+	} else {
+		// More than one -r pipelines every request on this connection (server started with -k).
+		if (send_weather_requests(client_socket, requests, request_count) != 0) {
+			fprintf(stderr, "Invio della richiesta meteo non riuscito\n");
+			goto cleanup;
+		}
+
+		if (receive_weather_responses(client_socket, responses, request_count) != 0) {
+			fprintf(stderr, "Ricezione della risposta meteo non riuscita\n");
+			goto cleanup;
+		}
+	}
+
+	for (size_t i = 0; i < request_count; ++i) {
+		if (format_response_message(&responses[i], &requests[i], server_ip, response_message, sizeof(response_message)) != 0) {
+			fprintf(stderr, "Impossibile formattare la risposta del server\n");
+			goto cleanup;
+		}
+
+		printf("%s\n", response_message);
+	}
+
+	if (stream_interval_ms > 0) {
+		fflush(stdout);
+		unsigned int item = 0;
+		weather_response_t update;
+		while (receive_weather_update(client_socket, &item, &update) == 0) {
+			if (item >= request_count
+					|| format_response_message(&update, &requests[item], server_ip, response_message, sizeof(response_message)) != 0) {
+				fprintf(stderr, "Aggiornamento non valido dal server\n");
+				goto cleanup;
+			}
+			printf("%s\n", response_message);
+			fflush(stdout);
+		}
+		fprintf(stderr, "Flusso di aggiornamenti interrotto dal server\n");
+		goto cleanup;
+	}
 	exit_code = EXIT_SUCCESS;
 
 cleanup:
+	weather_pool_destroy(pool);
+	local_channel_close(local);
+	// feed_sockets[0] is client_socket, closed below.
+	for (size_t i = 1; i < feed_socket_count; ++i) {
+		closesocket(feed_sockets[i]);
+	}
+	if (query_input != NULL && query_input != stdin) {
+		fclose(query_input);
+	}
 	if (client_socket >= 0) {
 		closesocket(client_socket);
 	}
@@ -0,0 +1,329 @@
+/*
+ * pool.c
+ *
+ * Server pool
+ *
+ * The ring holds POOL_VIRTUAL_NODES points per server. A query hashes its
+ * case-folded city (the server matches cities case-insensitively) and
+ * walks the ring clockwise from that point: the first reachable server
+ * answers. An idle connection that fails is most likely one the server
+ * closed while it sat in the pool, so the server's other idle connections
+ * are dropped and the query is retried once on a fresh connection before
+ * the server is marked unreachable.
+ */
+
+#define _GNU_SOURCE
+
+#include "pool.h"
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef CRITICAL_SECTION pool_lock_t;
+#define pool_lock_init(lock) InitializeCriticalSection(lock)
+#define pool_lock_destroy(lock) DeleteCriticalSection(lock)
+#define pool_lock(lock) EnterCriticalSection(lock)
+#define pool_unlock(lock) LeaveCriticalSection(lock)
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#define closesocket close
+typedef pthread_mutex_t pool_lock_t;
+#define pool_lock_init(lock) pthread_mutex_init(lock, NULL)
+#define pool_lock_destroy(lock) pthread_mutex_destroy(lock)
+#define pool_lock(lock) pthread_mutex_lock(lock)
+#define pool_unlock(lock) pthread_mutex_unlock(lock)
+#endif
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	struct sockaddr_in address;   // Resolved once by weather_pool_create()
+	char ip[INET_ADDRSTRLEN];
+	int idle[POOL_MAX_IDLE];      // Warm connections, most recently used last
+	int idle_count;
+	uint64_t retry_at_ms;         // Skipped until then after a failure, 0 when reachable
+} pool_server_t;
+
+typedef struct {
+	uint32_t point;
+	int server;
+} ring_node_t;
+
+struct weather_pool {
+	pool_server_t servers[MAX_SERVERS];
+	int server_count;
+	ring_node_t ring[MAX_SERVERS * POOL_VIRTUAL_NODES];
+	size_t ring_size;
+	pool_lock_t lock;             // Guards idle lists and retry_at_ms
+};
+
+static uint64_t now_ms(void) {
+#if defined(_WIN32) || defined(WIN32)
+	return (uint64_t) GetTickCount64();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000u + (uint64_t) ts.tv_nsec / 1000000u;
+#endif
+}
+
+// FNV-1a, optionally over case-folded bytes, with the MurmurHash3 finalizer:
+// plain FNV leaves similar keys ("host#1", "host#2") close together on the ring.
+static uint32_t hash_key(const char *key, int fold_case) {
+	uint32_t hash = 2166136261u;
+	for (const unsigned char *c = (const unsigned char *) key; *c != '\0'; ++c) {
+		hash ^= fold_case ? (uint32_t) tolower(*c) : *c;
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+	const ring_node_t *left = a;
+	const ring_node_t *right = b;
+	if (left->point != right->point) {
+		return left->point < right->point ? -1 : 1;
+	}
+	return left->server - right->server;
+}
+
+// Splits "host[:port]" and resolves it; returns -1 on a bad port or an unknown host.
+static int resolve_entry(const char *entry, unsigned short default_port, struct sockaddr_in *address) {
+	char host[BUFFER_SIZE];
+	unsigned short port = default_port;
+
+	strncpy(host, entry, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	char *colon = strrchr(host, ':');
+	if (colon != NULL) {
+		char *endptr = NULL;
+		unsigned long port_value = strtoul(colon + 1, &endptr, 10);
+		if (colon[1] == '\0' || *endptr != '\0' || port_value == 0 || port_value > 65535) {
+			return -1;
+		}
+		port = (unsigned short) port_value;
+		*colon = '\0';
+	}
+
+	return resolve_server_address(host, port, address);
+}
+
+weather_pool_t *weather_pool_create(const char *const *servers, size_t count, unsigned short default_port) {
+	if (servers == NULL || count == 0 || count > MAX_SERVERS) {
+		return NULL;
+	}
+
+	weather_pool_t *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		pool_server_t *server = &pool->servers[i];
+		if (resolve_entry(servers[i], default_port, &server->address) < 0) {
+			fprintf(stderr, "Server non valido o non risolvibile: %s\n", servers[i]);
+			free(pool);
+			return NULL;
+		}
+		const char *ip = inet_ntoa(server->address.sin_addr);
+		strncpy(server->ip, ip != NULL ? ip : servers[i], sizeof(server->ip) - 1);
+
+		// Points come from the resolved address, so every client builds the same ring.
+		for (int node = 0; node < POOL_VIRTUAL_NODES; ++node) {
+			char key[INET_ADDRSTRLEN + 16];
+			snprintf(key, sizeof(key), "%s:%u#%d", server->ip, (unsigned) ntohs(server->address.sin_port), node);
+			pool->ring[pool->ring_size].point = hash_key(key, 0);
+			pool->ring[pool->ring_size].server = (int) i;
+			++pool->ring_size;
+		}
+	}
+	pool->server_count = (int) count;
+	qsort(pool->ring, pool->ring_size, sizeof(pool->ring[0]), compare_nodes);
+	pool_lock_init(&pool->lock);
+	return pool;
+}
+
+void weather_pool_destroy(weather_pool_t *pool) {
+	if (pool == NULL) {
+		return;
+	}
+	for (int i = 0; i < pool->server_count; ++i) {
+		for (int j = 0; j < pool->servers[i].idle_count; ++j) {
+			closesocket(pool->servers[i].idle[j]);
+		}
+	}
+	pool_lock_destroy(&pool->lock);
+	free(pool);
+}
+
+const char *weather_pool_server_ip(const weather_pool_t *pool, int index) {
+	if (pool == NULL || index < 0 || index >= pool->server_count) {
+		return NULL;
+	}
+	return pool->servers[index].ip;
+}
+
+// A server that stops answering must not stall the caller forever.
+static void set_io_timeout(int socket_fd) {
+#if defined(_WIN32) || defined(WIN32)
+	DWORD timeout = POOL_IO_TIMEOUT_MS;
+#else
+	struct timeval timeout;
+	timeout.tv_sec = POOL_IO_TIMEOUT_MS / 1000;
+	timeout.tv_usec = (POOL_IO_TIMEOUT_MS % 1000) * 1000;
+#endif
+	setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+	setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, (const char *) &timeout, sizeof(timeout));
+}
+
+// Takes an idle connection to the server or opens a new one; *reused tells which.
+static int acquire_connection(weather_pool_t *pool, int index, int *reused) {
+	pool_server_t *server = &pool->servers[index];
+	int socket_fd = -1;
+
+	pool_lock(&pool->lock);
+	if (server->idle_count > 0) {
+		socket_fd = server->idle[--server->idle_count];
+	}
+	pool_unlock(&pool->lock);
+
+	*reused = socket_fd >= 0;
+	if (socket_fd < 0) {
+		socket_fd = connect_to_address(&server->address);
+		if (socket_fd >= 0) {
+			set_io_timeout(socket_fd);
+		}
+	}
+	return socket_fd;
+}
+
+static void release_connection(weather_pool_t *pool, int index, int socket_fd) {
+	pool_server_t *server = &pool->servers[index];
+
+	pool_lock(&pool->lock);
+	if (server->idle_count < POOL_MAX_IDLE) {
+		server->idle[server->idle_count++] = socket_fd;
+		socket_fd = -1;
+	}
+	pool_unlock(&pool->lock);
+
+	if (socket_fd >= 0) {
+		closesocket(socket_fd);
+	}
+}
+
+// Closes every idle connection to the server.
+static void drain_connections(weather_pool_t *pool, int index) {
+	pool_server_t *server = &pool->servers[index];
+	int idle[POOL_MAX_IDLE];
+	int idle_count = 0;
+
+	pool_lock(&pool->lock);
+	idle_count = server->idle_count;
+	memcpy(idle, server->idle, (size_t) idle_count * sizeof(idle[0]));
+	server->idle_count = 0;
+	pool_unlock(&pool->lock);
+
+	for (int i = 0; i < idle_count; ++i) {
+		closesocket(idle[i]);
+	}
+}
+
+static int query_server(weather_pool_t *pool, int index, const weather_request_t *request, weather_response_t *response) {
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		int reused = 0;
+		int socket_fd = acquire_connection(pool, index, &reused);
+		if (socket_fd < 0) {
+			return -1;
+		}
+
+		if (send_weather_request(socket_fd, request) == 0 && receive_weather_response(socket_fd, response) == 0) {
+			release_connection(pool, index, socket_fd);
+			return 0;
+		}
+
+		closesocket(socket_fd);
+		if (!reused) {
+			return -1;
+		}
+		// Stale keep-alive connection: the rest of the idle list is as old, retry on a fresh one.
+		drain_connections(pool, index);
+	}
+	return -1;
+}
+
+static int server_skipped(weather_pool_t *pool, int index, uint64_t now) {
+	pool_lock(&pool->lock);
+	const int skipped = pool->servers[index].retry_at_ms > now;
+	pool_unlock(&pool->lock);
+	return skipped;
+}
+
+static void mark_server(weather_pool_t *pool, int index, uint64_t retry_at_ms) {
+	pool_lock(&pool->lock);
+	pool->servers[index].retry_at_ms = retry_at_ms;
+	pool_unlock(&pool->lock);
+}
+
+// First ring node at or after point, wrapping around to the start.
+static size_t ring_lookup(const weather_pool_t *pool, uint32_t point) {
+	size_t low = 0;
+	size_t high = pool->ring_size;
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		if (pool->ring[middle].point < point) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low == pool->ring_size ? 0 : low;
+}
+
+int weather_pool_query(weather_pool_t *pool, const weather_request_t *request, weather_response_t *response) {
+	if (pool == NULL || request == NULL || response == NULL) {
+		return -1;
+	}
+
+	const size_t start = ring_lookup(pool, hash_key(request->city, 1));
+	int tried[MAX_SERVERS] = {0};
+
+	// The first pass respects the retry back-off; if every server is backing
+	// off, the second pass tries them anyway rather than fail outright.
+	for (int pass = 0; pass < 2; ++pass) {
+		const uint64_t now = now_ms();
+		for (size_t step = 0; step < pool->ring_size; ++step) {
+			const int index = pool->ring[(start + step) % pool->ring_size].server;
+			if (tried[index] || (pass == 0 && server_skipped(pool, index, now))) {
+				continue;
+			}
+			tried[index] = 1;
+
+			if (query_server(pool, index, request, response) == 0) {
+				if (pass > 0) {
+					mark_server(pool, index, 0);
+				}
+				return index;
+			}
+			mark_server(pool, index, now_ms() + POOL_RETRY_MS);
+		}
+	}
+	return -1;
+}
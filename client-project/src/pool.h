@@ -0,0 +1,44 @@
+/*
+ * pool.h
+ *
+ * Server pool
+ * Keeps warm keep-alive connections to a list of servers (started with -k)
+ * and routes every query by consistent hashing on its city, so a city is
+ * always answered by the same server, and served from that server's cache,
+ * for as long as the server is up. Server addresses are resolved once,
+ * when the pool is created.
+ *
+ * A server that cannot be reached is skipped for POOL_RETRY_MS and its
+ * cities fall to the next server on the ring; only those cities move.
+ * The pool may be shared by several threads.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define POOL_VIRTUAL_NODES 64   // Ring points per server, to even out the shards
+#define POOL_MAX_IDLE 8         // Idle connections kept per server
+#define POOL_RETRY_MS 1000      // How long an unreachable server is skipped
+#define POOL_IO_TIMEOUT_MS 2000 // Longest wait on a pooled connection before failing over
+
+typedef struct weather_pool weather_pool_t;
+
+// Resolves every "host[:port]" entry (default_port when the port is omitted)
+// and builds the ring. Returns NULL if an entry does not resolve.
+weather_pool_t *weather_pool_create(const char *const *servers, size_t count, unsigned short default_port);
+
+// Closes every pooled connection and frees the pool.
+void weather_pool_destroy(weather_pool_t *pool);
+
+// Answers one request; returns the index of the server that answered, or -1
+// when no server could.
+int weather_pool_query(weather_pool_t *pool, const weather_request_t *request, weather_response_t *response);
+
+// Numeric address of the server at index, as shown in response messages.
+const char *weather_pool_server_ip(const weather_pool_t *pool, int index);
+
+#endif /* POOL_H_ */
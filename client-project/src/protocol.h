@@ -10,28 +10,15 @@
 
 #include <stddef.h>
 
-// Shared application parameters
-#define DEFAULT_SERVER_PORT 56700
-#define DEFAULT_SERVER_ADDRESS "127.0.0.1"
-#define BUFFER_SIZE 512
-#define MAX_CITY_LEN 64
-#define RESPONSE_MESSAGE_LEN 256
-
-// Response status codes
-#define STATUS_SUCCESS 0
-#define STATUS_CITY_NOT_AVAILABLE 1
-#define STATUS_INVALID_REQUEST 2
-
-typedef struct {
-    char type;                // 't', 'h', 'w', 'p'
-    char city[MAX_CITY_LEN];  // Null-terminated city name
-} weather_request_t;
-
-typedef struct {
-    unsigned int status;
-    char type;
-    float value;
-} weather_response_t;
+#include "weatherproto.h"
+
+// Client parameters
+#define MAX_PIPELINED_REQUESTS 64
+#define DEFAULT_UDP_TIMEOUT_MS 500
+#define MAX_UDP_TIMEOUT_MS 60000
+#define UDP_MAX_ATTEMPTS 3        // Sends of one UDP query before giving up
+#define MAX_SERVERS 16            // -s options accepted (server pool)
+#define HISTORY_ALL_CITIES "*"    // -r city that asks -H for every city
 
 // Weather data generator prototypes (implemented on server side)
 float get_temperature(void);
@@ -39,15 +26,36 @@ float get_humidity(void);
 float get_wind(void);
 float get_pressure(void);
 
+struct sockaddr_in;
+
 // Client helper prototypes
 int parse_request(const char *request_arg, weather_request_t *out_request);
+int resolve_server_address(const char *server_address, unsigned short port, struct sockaddr_in *out_address);
+int connect_to_address(const struct sockaddr_in *address);
 int connect_to_server(const char *server_address, unsigned short port);
+int open_datagram_socket(const char *server_address, unsigned short port);
+int query_weather_datagram(int socket_fd, const weather_request_t *request, weather_response_t *response, unsigned int timeout_ms);
 int send_weather_request(int socket_fd, const weather_request_t *request);
+int send_weather_requests(int socket_fd, const weather_request_t *requests, size_t count);
 int receive_weather_response(int socket_fd, weather_response_t *response);
+int receive_weather_responses(int socket_fd, weather_response_t *responses, size_t count);
+int send_weather_batch(int socket_fd, const weather_request_t *items, size_t count);
+int receive_weather_batch(int socket_fd, weather_response_t *responses, size_t count);
+int send_weather_subscribe(int socket_fd, unsigned int interval_ms, const weather_request_t *items, size_t count);
+int receive_weather_subscribe_ack(int socket_fd, weather_response_t *responses, size_t count);
+int receive_weather_update(int socket_fd, unsigned int *item, weather_response_t *response);
+int query_weather_history(int socket_fd, const weather_request_t *request, unsigned int window_s, unsigned int points,
+                          weather_history_t *history);
 int format_response_message(const weather_response_t *response,
                             const weather_request_t *request,
                             const char *server_ip,
                             char *out_buffer,
                             size_t out_size);
+int format_history_message(const weather_history_t *history,
+                           const weather_request_t *request,
+                           unsigned int window_s,
+                           const char *server_ip,
+                           char *out_buffer,
+                           size_t out_size);
 
 #endif /* PROTOCOL_H_ */
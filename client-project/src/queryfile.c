@@ -0,0 +1,262 @@
+/*
+ * queryfile.c
+ *
+ * Query file mode (-f)
+ *
+ * Query k of the file travels on connection k % socket_count, and every
+ * connection answers in order, so the answer to the oldest unanswered
+ * query is always the next one on its connection: answers are printed as
+ * soon as they arrive, without reordering. Requests are encoded into a
+ * per-connection buffer and sent together once the window is full or the
+ * input has nothing more; answers are received in as few recv() calls as
+ * the kernel allows.
+ *
+ * Over a local channel the window is the ring itself: parsed requests are
+ * copied into it as they are read and their answers taken as they come.
+ */
+
+#include "queryfile.h"
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "wire.h"
+#include "netio.h"
+#include "local.h"
+
+typedef struct {
+	int socket_fd;
+	unsigned char tx[QUERY_FILE_WINDOW * (4 + MAX_CITY_LEN)];
+	size_t tx_len;
+	unsigned char rx[QUERY_FILE_WINDOW * WIRE_RESPONSE_SIZE];
+	size_t rx_len;
+	size_t rx_used;
+} feed_connection_t;
+
+typedef struct {
+	feed_connection_t connections[QUERY_FILE_MAX_CONNECTIONS];
+	size_t connection_count;
+	local_channel_t *local;                       // Replaces the connections when not NULL
+	weather_request_t pending[QUERY_FILE_WINDOW]; // Query k at k % QUERY_FILE_WINDOW
+	unsigned long sent;                           // Queries sent so far
+	unsigned long submitted;                      // Queries queued on the local channel
+	unsigned long answered;                       // Queries answered so far
+} feed_t;
+
+// Reads the next non-blank, non-comment line into line; returns 0 at end of input.
+static int next_line(FILE *input, char *line, size_t size, unsigned long *line_number) {
+	while (fgets(line, (int) size, input) != NULL) {
+		++*line_number;
+		size_t length = strlen(line);
+		if (length > 0 && line[length - 1] != '\n' && !feof(input)) {
+			// Longer than any valid query: the rest of the line is dropped.
+			int c;
+			while ((c = fgetc(input)) != EOF && c != '\n') {
+			}
+		}
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+			line[--length] = '\0';
+		}
+
+		const char *start = line + strspn(line, " \t");
+		if (*start != '\0' && *start != '#') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int flush_requests(feed_connection_t *connection) {
+	if (connection->tx_len == 0) {
+		return 0;
+	}
+	const int result = net_send_all(connection->socket_fd, connection->tx, connection->tx_len, NULL);
+	connection->tx_len = 0;
+	return result;
+}
+
+// Makes at least one whole answer available on the connection.
+static int fill_answers(feed_connection_t *connection) {
+	if (connection->rx_used > 0) {
+		memmove(connection->rx, connection->rx + connection->rx_used, connection->rx_len - connection->rx_used);
+		connection->rx_len -= connection->rx_used;
+		connection->rx_used = 0;
+	}
+	while (connection->rx_len < WIRE_RESPONSE_SIZE) {
+		const int received = recv(connection->socket_fd, (char *) connection->rx + connection->rx_len,
+				(int) (sizeof(connection->rx) - connection->rx_len), 0);
+		if (received <= 0) {
+			return -1;
+		}
+		connection->rx_len += (size_t) received;
+	}
+	return 0;
+}
+
+// Queues the parsed queries not yet on the local channel.
+static void submit_local(feed_t *feed) {
+	while (feed->submitted < feed->sent) {
+		// The pending queries wrap around the end of the window.
+		const size_t first = (size_t) (feed->submitted % QUERY_FILE_WINDOW);
+		size_t count = (size_t) (feed->sent - feed->submitted);
+		if (count > QUERY_FILE_WINDOW - first) {
+			count = QUERY_FILE_WINDOW - first;
+		}
+		const size_t queued = local_channel_submit(feed->local, &feed->pending[first], count);
+		feed->submitted += queued;
+		if (queued < count) {
+			return;
+		}
+	}
+}
+
+// Prints the answer to the oldest unanswered query.
+static int print_answer(feed_t *feed, const char *server_ip) {
+	weather_response_t response;
+	memset(&response, 0, sizeof(response));
+	const weather_request_t *request = &feed->pending[feed->answered % QUERY_FILE_WINDOW];
+	feed_connection_t *connection = NULL;
+
+	if (feed->local != NULL) {
+		if (local_channel_receive(feed->local, &response) != 0) {
+			fprintf(stderr, "Canale locale interrotto dopo %lu risposte\n", feed->answered);
+			return -1;
+		}
+	} else {
+		connection = &feed->connections[feed->answered % feed->connection_count];
+		if (connection->rx_len - connection->rx_used < WIRE_RESPONSE_SIZE && fill_answers(connection) != 0) {
+			fprintf(stderr, "Connessione interrotta dopo %lu risposte\n", feed->answered);
+			return -1;
+		}
+		if (wire_decode_response(connection->rx + connection->rx_used, &response.status, &response.type, &response.value) != 0) {
+			fprintf(stderr, "Risposta non valida dal server per \"%c %s\"\n", request->type, request->city);
+			return -1;
+		}
+		connection->rx_used += WIRE_RESPONSE_SIZE;
+	}
+
+	char message[RESPONSE_MESSAGE_LEN];
+	if (format_response_message(&response, request, server_ip, message, sizeof(message)) != 0) {
+		fprintf(stderr, "Risposta non valida dal server per \"%c %s\"\n", request->type, request->city);
+		return -1;
+	}
+	++feed->answered;
+	puts(message);
+	return 0;
+}
+
+// Whether the answer to the oldest unanswered query is already buffered.
+static int answer_buffered(const feed_t *feed) {
+	if (feed->answered >= feed->sent) {
+		return 0;
+	}
+	if (feed->local != NULL) {
+		return local_channel_ready(feed->local);
+	}
+	const feed_connection_t *connection = &feed->connections[feed->answered % feed->connection_count];
+	return connection->rx_len - connection->rx_used >= WIRE_RESPONSE_SIZE;
+}
+
+// Answers every line of input on the connections or the local channel set up in feed.
+static int feed_run(feed_t *feed, FILE *input, const char *server_ip) {
+	char line[BUFFER_SIZE];
+	unsigned long line_number = 0;
+	int result = 0;
+	int end_of_input = 0;
+	while (!end_of_input || feed->answered < feed->sent) {
+		// Top the window up with new queries.
+		while (!end_of_input && feed->sent - feed->answered < QUERY_FILE_WINDOW) {
+			if (!next_line(input, line, sizeof(line), &line_number)) {
+				end_of_input = 1;
+				break;
+			}
+
+			weather_request_t *request = &feed->pending[feed->sent % QUERY_FILE_WINDOW];
+			memset(request, 0, sizeof(*request));
+			if (parse_request(line, request) != 0) {
+				fprintf(stderr, "Riga %lu non valida, attesa \"type city\": %s\n", line_number, line);
+				result = -1;
+				continue;
+			}
+
+			if (feed->local == NULL) {
+				feed_connection_t *connection = &feed->connections[feed->sent % feed->connection_count];
+				const size_t encoded = wire_encode_request(connection->tx + connection->tx_len,
+						sizeof(connection->tx) - connection->tx_len, request->type, request->city);
+				if (encoded == 0) {
+					fprintf(stderr, "Riga %lu non valida, attesa \"type city\": %s\n", line_number, line);
+					result = -1;
+					continue;
+				}
+				connection->tx_len += encoded;
+			}
+			++feed->sent;
+		}
+
+		if (feed->local != NULL) {
+			submit_local(feed);
+		}
+		for (size_t i = 0; i < feed->connection_count; ++i) {
+			if (flush_requests(&feed->connections[i]) != 0) {
+				fprintf(stderr, "Invio delle richieste non riuscito\n");
+				return -1;
+			}
+		}
+
+		// Wait for the oldest answer only, then print whatever else already arrived.
+		if (feed->answered < feed->sent) {
+			do {
+				if (print_answer(feed, server_ip) != 0) {
+					return -1;
+				}
+			} while (answer_buffered(feed));
+		}
+	}
+
+	return fflush(stdout) == 0 ? result : -1;
+}
+
+int query_file_run(FILE *input, const int *sockets, size_t socket_count, const char *server_ip) {
+	if (input == NULL || sockets == NULL || socket_count == 0 || socket_count > QUERY_FILE_MAX_CONNECTIONS || server_ip == NULL) {
+		return -1;
+	}
+
+	feed_t *feed = calloc(1, sizeof(*feed));
+	if (feed == NULL) {
+		fprintf(stderr, "Memoria insufficiente per la modalità -f\n");
+		return -1;
+	}
+	feed->connection_count = socket_count;
+	for (size_t i = 0; i < socket_count; ++i) {
+		feed->connections[i].socket_fd = sockets[i];
+	}
+
+	const int result = feed_run(feed, input, server_ip);
+	free(feed);
+	return result;
+}
+
+int query_file_run_local(FILE *input, local_channel_t *channel, const char *server_ip) {
+	if (input == NULL || channel == NULL || server_ip == NULL) {
+		return -1;
+	}
+
+	feed_t *feed = calloc(1, sizeof(*feed));
+	if (feed == NULL) {
+		fprintf(stderr, "Memoria insufficiente per la modalità -f\n");
+		return -1;
+	}
+	feed->local = channel;
+
+	const int result = feed_run(feed, input, server_ip);
+	free(feed);
+	return result;
+}
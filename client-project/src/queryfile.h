@@ -0,0 +1,32 @@
+/*
+ * queryfile.h
+ *
+ * Query file mode (-f)
+ * Streams "type city" lines from a file or stdin over one or a few
+ * persistent connections (server started with -k). Lines are parsed as
+ * they are read and their requests pipelined with at most
+ * QUERY_FILE_WINDOW unanswered at a time, dealt round-robin across the
+ * connections; answers are printed in input order. Blank lines and lines
+ * starting with '#' are skipped.
+ */
+
+#ifndef QUERYFILE_H_
+#define QUERYFILE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "local.h"
+
+#define QUERY_FILE_WINDOW 256          // Requests in flight across all connections
+#define QUERY_FILE_MAX_CONNECTIONS 16
+
+// Answers every line of input over the connected sockets and prints one
+// response message per query to stdout. Returns 0 when every line was
+// valid and answered, -1 after an invalid line or a connection failure.
+int query_file_run(FILE *input, const int *sockets, size_t socket_count, const char *server_ip);
+
+// Same as query_file_run() over a local channel to a server on this host.
+int query_file_run_local(FILE *input, local_channel_t *channel, const char *server_ip);
+
+#endif /* QUERYFILE_H_ */
@@ -0,0 +1,112 @@
+/*
+ * netio.c
+ *
+ * Fully-buffered socket I/O
+ */
+
+#include "netio.h"
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#if !defined MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+int net_send_all(int socket_fd, const void *data, size_t length, net_io_observer_t observe) {
+	const char *bytes = (const char *)data;
+	size_t sent_total = 0;
+
+	while (sent_total < length) {
+		// A peer that went away is an error return, not a SIGPIPE.
+		int sent = send(socket_fd, bytes + sent_total, (int)(length - sent_total), MSG_NOSIGNAL);
+		if (sent <= 0) {
+			return -1;
+		}
+		if (observe != NULL) {
+			observe((size_t)sent, length - sent_total);
+		}
+		sent_total += (size_t)sent;
+	}
+
+	return 0;
+}
+
+#if defined(_WIN32) || defined(WIN32)
+
+int net_send_chunks(int socket_fd, const net_chunk_t *chunks, size_t count, net_io_observer_t observe) {
+	// No sendmsg(): one send loop per chunk.
+	for (size_t i = 0; i < count; ++i) {
+		if (net_send_all(socket_fd, chunks[i].data, chunks[i].length, observe) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#else
+
+int net_send_chunks(int socket_fd, const net_chunk_t *chunks, size_t count, net_io_observer_t observe) {
+	struct iovec iov[NET_MAX_CHUNKS];
+	size_t remaining = 0;
+	if (count > NET_MAX_CHUNKS) {
+		return -1;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		iov[i].iov_base = (void *)chunks[i].data;
+		iov[i].iov_len = chunks[i].length;
+		remaining += chunks[i].length;
+	}
+
+	size_t first = 0;
+	while (remaining > 0) {
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = iov + first;
+		message.msg_iovlen = count - first;
+		ssize_t sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			return -1;
+		}
+		if (observe != NULL) {
+			observe((size_t)sent, remaining);
+		}
+		remaining -= (size_t)sent;
+
+		// Drop the chunks that went out whole and trim the one cut short.
+		size_t skip = (size_t)sent;
+		while (first < count && skip >= iov[first].iov_len) {
+			skip -= iov[first].iov_len;
+			++first;
+		}
+		if (skip > 0) {
+			iov[first].iov_base = (char *)iov[first].iov_base + skip;
+			iov[first].iov_len -= skip;
+		}
+	}
+
+	return 0;
+}
+
+#endif
+
+int net_recv_all(int socket_fd, void *buffer, size_t length) {
+	char *bytes = (char *)buffer;
+	size_t received_total = 0;
+
+	while (received_total < length) {
+		int received = recv(socket_fd, bytes + received_total, (int)(length - received_total), 0);
+		if (received <= 0) {
+			return -1;
+		}
+		received_total += (size_t)received;
+	}
+
+	return 0;
+}
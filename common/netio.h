@@ -0,0 +1,37 @@
+/*
+ * netio.h
+ *
+ * Fully-buffered socket I/O
+ * Blocking send/receive loops that move a whole buffer across however
+ * many partial send()/recv() calls the kernel makes of it.
+ */
+
+#ifndef NETIO_H_
+#define NETIO_H_
+
+#include <stddef.h>
+
+// Called after every send() that wrote data, with the bytes written and the bytes asked for.
+typedef void (*net_io_observer_t)(size_t done, size_t requested);
+
+// Sends length bytes; returns 0, or -1 on error (errno / WSAGetLastError() tell why).
+// observe may be NULL.
+int net_send_all(int socket_fd, const void *data, size_t length, net_io_observer_t observe);
+
+// One buffer of a gathered send
+typedef struct {
+	const void *data;
+	size_t length;
+} net_chunk_t;
+
+#define NET_MAX_CHUNKS 64 // Chunks accepted by one net_send_chunks() call
+
+// Sends count (<= NET_MAX_CHUNKS) chunks back to back as one stream, with a
+// single sendmsg() per attempt where the platform has it. Same return
+// value and observer calls as net_send_all().
+int net_send_chunks(int socket_fd, const net_chunk_t *chunks, size_t count, net_io_observer_t observe);
+
+// Receives exactly length bytes; returns 0, or -1 on error or if the peer closed first.
+int net_recv_all(int socket_fd, void *buffer, size_t length);
+
+#endif /* NETIO_H_ */
@@ -0,0 +1,256 @@
+/*
+ * shmring.c
+ *
+ * Shared-memory request channel
+ *
+ * Publishing is a release store of the producer's index; reading the
+ * peer's index is an acquire load, so slot contents written before an
+ * index moved are visible once the move is. A consumer about to sleep sets
+ * waiting and re-reads the tail, and a producer re-reads waiting after
+ * publishing; the sequentially consistent fences between the two steps
+ * guarantee that at least one of them sees the other, so no wakeup is lost
+ * and a producer whose consumer is awake makes no system call at all.
+ */
+
+#define _GNU_SOURCE
+
+#include "shmring.h"
+
+#include <stdio.h>
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define REQUIRED_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+int shm_available(void) {
+	return 1;
+}
+
+uint64_t shm_spin_ns(void) {
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_NS : 0;
+}
+
+shm_channel_t *shm_channel_create(int *fd) {
+	const int memory = memfd_create("weather-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memory < 0) {
+		return NULL;
+	}
+	if (ftruncate(memory, sizeof(shm_channel_t)) < 0 || fcntl(memory, F_ADD_SEALS, REQUIRED_SEALS) < 0) {
+		close(memory);
+		return NULL;
+	}
+
+	shm_channel_t *channel = mmap(NULL, sizeof(shm_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+	if (channel == MAP_FAILED) {
+		close(memory);
+		return NULL;
+	}
+	// A fresh memfd is zero-filled: both rings start empty at index 0.
+	channel->magic = SHM_CHANNEL_MAGIC;
+	channel->slots = SHM_RING_SLOTS;
+	*fd = memory;
+	return channel;
+}
+
+shm_channel_t *shm_channel_map(int fd) {
+	struct stat info;
+	const int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & REQUIRED_SEALS) != REQUIRED_SEALS || fstat(fd, &info) < 0
+			|| (size_t)info.st_size != sizeof(shm_channel_t)) {
+		return NULL;
+	}
+
+	shm_channel_t *channel = mmap(NULL, sizeof(shm_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (channel == MAP_FAILED) {
+		return NULL;
+	}
+	if (channel->magic != SHM_CHANNEL_MAGIC || channel->slots != SHM_RING_SLOTS) {
+		munmap(channel, sizeof(shm_channel_t));
+		return NULL;
+	}
+	return channel;
+}
+
+void shm_channel_unmap(shm_channel_t *channel) {
+	if (channel != NULL) {
+		munmap(channel, sizeof(shm_channel_t));
+	}
+}
+
+int shm_send_message(int socket_fd, char kind, int fd) {
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct iovec iov = { &kind, 1 };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	if (fd >= 0) {
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &fd, sizeof(int));
+	}
+	return sendmsg(socket_fd, &message, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+int shm_recv_message(int socket_fd, char *kind, int *fd) {
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { kind, 1 };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	*fd = -1;
+	const ssize_t length = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+	if (length != 1) {
+		return -1;
+	}
+	for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)) {
+		if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS
+				&& header->cmsg_len == CMSG_LEN(sizeof(int))) {
+			memcpy(fd, CMSG_DATA(header), sizeof(int));
+		}
+	}
+	// A truncated message may have dropped descriptors: refuse the whole of it.
+	if (message.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) {
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+void shm_ring_wait(shm_ring_t *ring, uint32_t head, unsigned int timeout_ms) {
+	if (!shm_ring_prepare_wait(ring, head)) {
+		return;
+	}
+	// Not FUTEX_PRIVATE_FLAG: the futex word is shared with another process.
+	struct timespec timeout = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+	syscall(SYS_futex, &ring->tail, FUTEX_WAIT, head, &timeout, NULL, 0);
+	shm_ring_finish_wait(ring);
+}
+
+void shm_ring_wake(shm_ring_t *ring) {
+	syscall(SYS_futex, &ring->tail, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#else
+
+int shm_available(void) {
+	return 0;
+}
+
+uint64_t shm_spin_ns(void) {
+	return 0;
+}
+
+shm_channel_t *shm_channel_create(int *fd) {
+	*fd = -1;
+	return NULL;
+}
+
+shm_channel_t *shm_channel_map(int fd) {
+	(void)fd;
+	return NULL;
+}
+
+void shm_channel_unmap(shm_channel_t *channel) {
+	(void)channel;
+}
+
+int shm_send_message(int socket_fd, char kind, int fd) {
+	(void)socket_fd;
+	(void)kind;
+	(void)fd;
+	return -1;
+}
+
+int shm_recv_message(int socket_fd, char *kind, int *fd) {
+	(void)socket_fd;
+	(void)kind;
+	*fd = -1;
+	return -1;
+}
+
+void shm_ring_wait(shm_ring_t *ring, uint32_t head, unsigned int timeout_ms) {
+	(void)ring;
+	(void)head;
+	(void)timeout_ms;
+}
+
+void shm_ring_wake(shm_ring_t *ring) {
+	(void)ring;
+}
+
+#endif
+
+int local_socket_path(unsigned short port, char *path, size_t size) {
+	const int written = snprintf(path, size, LOCAL_SOCKET_FORMAT, (unsigned int)port);
+	return written < 0 || (size_t)written >= size ? -1 : 0;
+}
+
+uint32_t shm_ring_ready(shm_ring_t *ring, uint32_t head) {
+	return atomic_load_explicit(&ring->tail, memory_order_acquire) - head;
+}
+
+uint32_t shm_ring_space(shm_ring_t *ring, uint32_t tail) {
+	return SHM_RING_SLOTS - (tail - atomic_load_explicit(&ring->head, memory_order_acquire));
+}
+
+void shm_ring_consume(shm_ring_t *ring, uint32_t head) {
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+}
+
+int shm_ring_publish(shm_ring_t *ring, uint32_t tail) {
+	atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	return atomic_load_explicit(&ring->waiting, memory_order_relaxed) != 0;
+}
+
+int shm_ring_prepare_wait(shm_ring_t *ring, uint32_t head) {
+	atomic_store_explicit(&ring->waiting, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&ring->tail, memory_order_relaxed) != head) {
+		atomic_store_explicit(&ring->waiting, 0, memory_order_relaxed);
+		return 0;
+	}
+	return 1;
+}
+
+void shm_ring_finish_wait(shm_ring_t *ring) {
+	atomic_store_explicit(&ring->waiting, 0, memory_order_relaxed);
+}
+
+void shm_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
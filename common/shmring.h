@@ -0,0 +1,106 @@
+/*
+ * shmring.h
+ *
+ * Shared-memory request channel
+ * A client on the server's host and the server map the same memfd, which
+ * holds two single-producer single-consumer rings: requests go one way in
+ * weather_request_t slots and answers come back in weather_response_t
+ * slots, in request order. The memfd is handed over on a Unix socket whose
+ * path derives from the server port; the socket stays open for the life
+ * of the channel so each side notices when the other goes away. Linux only.
+ */
+
+#ifndef SHMRING_H_
+#define SHMRING_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "weatherproto.h"
+
+#define SHM_RING_SLOTS 256                   // Per ring, a power of two
+#define SHM_CHANNEL_MAGIC 0x57524731u        // "WRG1", bumped with the layout
+#define SHM_SPIN_NS 50000                    // Busy polling before a side goes to sleep
+#define SHM_WAIT_MS 100                      // Longest sleep between checks that the peer is alive
+#define LOCAL_SOCKET_FORMAT "/tmp/weather-%u.sock"
+
+// Setup messages on the Unix socket: the client sends SHM_HELLO with the
+// memfd attached, the server answers SHM_HELLO with its doorbell eventfd or
+// SHM_REFUSED and closes.
+#define SHM_HELLO 'M'
+#define SHM_REFUSED 'X'
+
+// Indices run freely and wrap at 2^32; slot i is at i % SHM_RING_SLOTS.
+// Producer and consumer indices sit on separate cache lines.
+typedef struct {
+	_Alignas(64) _Atomic uint32_t tail; // Next slot the producer fills
+	_Atomic uint32_t waiting;           // Set while the consumer may be asleep
+	_Alignas(64) _Atomic uint32_t head; // Next slot the consumer reads
+} shm_ring_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t slots;
+	shm_ring_t requests;  // Client to server
+	shm_ring_t responses; // Server to client
+	weather_request_t request_slots[SHM_RING_SLOTS];
+	weather_response_t response_slots[SHM_RING_SLOTS];
+} shm_channel_t;
+
+// Returns 1 when the channel can be used on this platform.
+int shm_available(void);
+
+// Writes the Unix socket path of the server on port; -1 if size is too small.
+int local_socket_path(unsigned short port, char *path, size_t size);
+
+// Nanoseconds a side busy-polls its ring before sleeping: 0 on a single
+// CPU, where spinning only delays the peer it is waiting for.
+uint64_t shm_spin_ns(void);
+
+// Client side: creates a sealed memfd holding an empty channel and maps it.
+// Returns NULL on failure; *fd is the descriptor to pass to the server.
+shm_channel_t *shm_channel_create(int *fd);
+
+// Server side: maps the channel in fd after checking its size, seals and
+// magic, so a client cannot shrink it under the server. NULL when invalid.
+shm_channel_t *shm_channel_map(int fd);
+
+void shm_channel_unmap(shm_channel_t *channel);
+
+// Setup messages are one byte with at most one descriptor attached (fd -1
+// for none). Receiving returns -1 on error or end of stream and leaves *fd
+// at -1 when nothing was attached.
+int shm_send_message(int socket_fd, char kind, int fd);
+int shm_recv_message(int socket_fd, char *kind, int *fd);
+
+// Ring operations. Each side keeps its own index (head for the consumer,
+// tail for the producer) and only publishes it. The other side's index
+// comes from the peer process, so callers check the results against
+// SHM_RING_SLOTS before trusting them.
+
+// Entries the consumer at head can read.
+uint32_t shm_ring_ready(shm_ring_t *ring, uint32_t head);
+// Slots the producer at tail can fill.
+uint32_t shm_ring_space(shm_ring_t *ring, uint32_t tail);
+// Hands the slots before head back to the producer.
+void shm_ring_consume(shm_ring_t *ring, uint32_t head);
+// Publishes the entries before tail; returns 1 when the consumer may be
+// asleep and must be woken.
+int shm_ring_publish(shm_ring_t *ring, uint32_t tail);
+
+// Consumer side, before sleeping: marks the ring and returns 1 if it is
+// still empty at head, 0 (unmarked) if something arrived meanwhile.
+int shm_ring_prepare_wait(shm_ring_t *ring, uint32_t head);
+void shm_ring_finish_wait(shm_ring_t *ring);
+
+// Sleeps on the ring's futex until the producer publishes past head or
+// timeout_ms passes. Wraps the two calls above.
+void shm_ring_wait(shm_ring_t *ring, uint32_t head, unsigned int timeout_ms);
+// Wakes a consumer sleeping in shm_ring_wait().
+void shm_ring_wake(shm_ring_t *ring);
+
+// Busy-wait hint for spin loops.
+void shm_cpu_relax(void);
+
+#endif /* SHMRING_H_ */
@@ -0,0 +1,26 @@
+/*
+ * weatherproto.c
+ *
+ * Weather query protocol
+ */
+
+#include "weatherproto.h"
+
+#define WEATHER_TYPE_INFO(name, type, label, unit, min, max) { type, label, unit, min, max },
+const weather_type_info_t WEATHER_TYPES[WEATHER_TYPE_COUNT] = {
+	WEATHER_METRICS(WEATHER_TYPE_INFO)
+};
+
+#define WEATHER_TYPE_SLOT(name, type, label, unit, min, max) [(unsigned char)(type)] = WEATHER_TYPE_##name + 1,
+const unsigned char WEATHER_TYPE_SLOTS[256] = {
+	WEATHER_METRICS(WEATHER_TYPE_SLOT)
+};
+
+const char *weather_status_text(unsigned int status) {
+	switch (status) {
+		case STATUS_SUCCESS: return "Successo";
+		case STATUS_CITY_NOT_AVAILABLE: return "Città non disponibile";
+		case STATUS_INVALID_REQUEST: return "Richiesta non valida";
+		default: return "Risposta non valida";
+	}
+}
@@ -0,0 +1,134 @@
+/*
+ * weatherproto.h
+ *
+ * Weather query protocol
+ * Constants, message layouts and lookup tables shared by the client and
+ * the server, built once into libweatherproto together with the compact
+ * codec (wire.h) and the socket helpers (netio.h).
+ */
+
+#ifndef WEATHERPROTO_H_
+#define WEATHERPROTO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared application parameters
+#define DEFAULT_SERVER_PORT 56700
+#define DEFAULT_SERVER_ADDRESS "127.0.0.1"
+#define BUFFER_SIZE 512
+#define MAX_CITY_LEN 64
+#define RESPONSE_MESSAGE_LEN 256
+
+// Application status codes
+#define STATUS_SUCCESS 0
+#define STATUS_CITY_NOT_AVAILABLE 1
+#define STATUS_INVALID_REQUEST 2
+#define STATUS_COUNT 3
+
+typedef struct {
+	char type;                // Weather data type: 't', 'h', 'w', 'p'
+	char city[MAX_CITY_LEN];  // Null-terminated city name
+} weather_request_t;
+
+typedef struct {
+	unsigned int status; // Response status code
+	char type;           // Echo of the requested type
+	float value;         // Weather data value
+} weather_response_t;
+
+// Batch requests: one message carrying several (type, city) queries
+#define REQUEST_TYPE_BATCH 'B' // First byte of a batch request header
+#define MAX_BATCH_ITEMS 64
+
+// Batch request header, same size as weather_request_t so the first read of
+// any request frame is always sizeof(weather_request_t) bytes. It is followed
+// by `count` weather_request_t items.
+typedef struct {
+	char type;                        // REQUEST_TYPE_BATCH
+	unsigned char count;              // Items that follow, 1..MAX_BATCH_ITEMS
+	char reserved[MAX_CITY_LEN - 1];  // Zero
+} weather_batch_request_t;
+
+_Static_assert(sizeof(weather_batch_request_t) == sizeof(weather_request_t), "batch header must match the request size");
+
+// Batch response header, followed by `count` weather_batch_entry_t in request order
+typedef struct {
+	unsigned int status; // STATUS_SUCCESS, or STATUS_INVALID_REQUEST for a malformed batch
+	unsigned int count;  // Entries that follow
+} weather_batch_response_t;
+
+typedef struct {
+	unsigned char status; // Per-item status code
+	char type;            // Echo of the item type
+	char reserved[2];     // Zero
+	float value;          // Weather data value
+} weather_batch_entry_t;
+
+// Streaming subscriptions: one compact subscribe frame registers up to
+// MAX_SUBSCRIBE_ITEMS (type, city) pairs, pushed every interval (see wire.h)
+#define MAX_SUBSCRIBE_ITEMS 16
+#define MIN_SUBSCRIBE_INTERVAL_MS 100
+#define MAX_SUBSCRIBE_INTERVAL_MS 3600000
+
+// History queries: aggregates of the samples the server generated over the
+// last window seconds, optionally split into up to MAX_HISTORY_POINTS
+// equal-width buckets (see wire.h)
+#define MAX_HISTORY_POINTS 64
+#define MAX_HISTORY_WINDOW_S 604800 // One week
+
+typedef struct {
+	unsigned int status;   // Response status code
+	uint32_t samples;      // Samples in the window, 0 leaves the aggregates at zero
+	float min;
+	float max;
+	float mean;
+	float last;            // Most recent sample
+	unsigned int points;   // Buckets in series, 0 for aggregates only
+	float series[MAX_HISTORY_POINTS]; // Bucket means, oldest first; NaN for an empty bucket
+} weather_history_t;
+
+// Largest request/response frames a connection has to buffer
+#define MAX_REQUEST_FRAME_SIZE (sizeof(weather_batch_request_t) + MAX_BATCH_ITEMS * sizeof(weather_request_t))
+#define MAX_RESPONSE_FRAME_SIZE (sizeof(weather_batch_response_t) + MAX_BATCH_ITEMS * sizeof(weather_batch_entry_t))
+
+// Weather data types, the single definition both projects are generated
+// from: X(name, request character, label, unit, min, max), where
+// [min, max) is the range the server generates. A row's position is its
+// index in WEATHER_TYPES and part of the cache and history keys; new
+// metrics go at the end.
+#define WEATHER_METRICS(X) \
+	X(TEMPERATURE, 't', "Temperatura", "°C", -10.0f, 40.0f) \
+	X(HUMIDITY, 'h', "Umidità", "%", 20.0f, 100.0f) \
+	X(WIND, 'w', "Vento", " km/h", 0.0f, 100.0f) \
+	X(PRESSURE, 'p', "Pressione", " hPa", 950.0f, 1050.0f)
+
+#define WEATHER_TYPE_ENUM(name, type, label, unit, min, max) WEATHER_TYPE_##name,
+enum {
+	WEATHER_METRICS(WEATHER_TYPE_ENUM)
+	WEATHER_TYPE_COUNT
+};
+#undef WEATHER_TYPE_ENUM
+
+typedef struct {
+	char type;         // Request character
+	const char *label; // Name shown to users
+	const char *unit;  // Printed right after the value
+	float min;         // Generated values lie in [min, max)
+	float max;
+} weather_type_info_t;
+
+extern const weather_type_info_t WEATHER_TYPES[WEATHER_TYPE_COUNT];
+
+// WEATHER_TYPES position + 1 of every request character, 0 for anything else.
+extern const unsigned char WEATHER_TYPE_SLOTS[256];
+
+// Position of type in WEATHER_TYPES, or -1 for anything else.
+static inline int weather_type_index(char type) {
+	return (int)WEATHER_TYPE_SLOTS[(unsigned char)type] - 1;
+}
+
+// User-facing text of a status code, for any value received from the wire.
+const char *weather_status_text(unsigned int status);
+
+#endif /* WEATHERPROTO_H_ */
@@ -0,0 +1,371 @@
+/*
+ * wire.c
+ *
+ * Compact wire format
+ */
+
+#include "wire.h"
+
+#include <stdint.h>
+#include <string.h>
+
+_Static_assert(sizeof(float) == sizeof(uint32_t), "the wire format carries binary32 floats");
+
+#define VARINT_MAX_BYTES 2 // Enough for WIRE_MAX_CITY_BYTES
+
+int wire_is_compact(const unsigned char *data, size_t available) {
+	return available > 0 && data[0] == WIRE_MAGIC;
+}
+
+int wire_is_subscribe(const unsigned char *data, size_t available) {
+	return available > 1 && data[0] == WIRE_MAGIC && data[1] == WIRE_SUBSCRIBE;
+}
+
+int wire_is_history(const unsigned char *data, size_t available) {
+	return available > 1 && data[0] == WIRE_MAGIC && data[1] == WIRE_HISTORY;
+}
+
+static size_t varint_encode(unsigned char *out, size_t value) {
+	size_t written = 0;
+	while (value >= 0x80) {
+		out[written++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	out[written++] = (unsigned char)value;
+	return written;
+}
+
+// Returns the bytes consumed, 0 if more input is needed, -1 if the varint is too long.
+static long varint_decode(const unsigned char *data, size_t available, size_t *value) {
+	size_t result = 0;
+	for (size_t i = 0; i < VARINT_MAX_BYTES; ++i) {
+		if (i >= available) {
+			return 0;
+		}
+		result |= (size_t)(data[i] & 0x7f) << (7 * i);
+		if ((data[i] & 0x80) == 0) {
+			*value = result;
+			return (long)(i + 1);
+		}
+	}
+	return -1;
+}
+
+size_t wire_encode_request(unsigned char *out, size_t out_size, char type, const char *city) {
+	const size_t city_len = strlen(city);
+	if (city_len > WIRE_MAX_CITY_BYTES || out_size < 2 + VARINT_MAX_BYTES + city_len) {
+		return 0;
+	}
+
+	size_t written = 0;
+	out[written++] = WIRE_MAGIC;
+	out[written++] = (unsigned char)type;
+	written += varint_encode(out + written, city_len);
+	memcpy(out + written, city, city_len);
+	return written + city_len;
+}
+
+long wire_request_length(const unsigned char *data, size_t available) {
+	if (available < 3) {
+		return 0;
+	}
+
+	size_t city_len = 0;
+	const long varint_len = varint_decode(data + 2, available - 2, &city_len);
+	if (varint_len <= 0) {
+		return varint_len;
+	}
+	size_t max_payload = WIRE_MAX_CITY_BYTES;
+	if (data[1] == WIRE_SUBSCRIBE) {
+		max_payload = WIRE_MAX_SUBSCRIBE_PAYLOAD;
+	} else if (data[1] == WIRE_HISTORY) {
+		max_payload = WIRE_MAX_HISTORY_PAYLOAD;
+	}
+	if (city_len > max_payload) {
+		return -1;
+	}
+
+	const size_t length = 2 + (size_t)varint_len + city_len;
+	return length <= available ? (long)length : 0;
+}
+
+int wire_decode_request(const unsigned char *data, size_t length, char *type, char *city, size_t city_size) {
+	size_t city_len = 0;
+	const long varint_len = length >= 3 ? varint_decode(data + 2, length - 2, &city_len) : 0;
+	if (varint_len <= 0 || 2 + (size_t)varint_len + city_len > length || city_size == 0) {
+		return -1;
+	}
+
+	const size_t copied = city_len < city_size - 1 ? city_len : city_size - 1;
+	*type = (char)data[1];
+	memcpy(city, data + 2 + varint_len, copied);
+	city[copied] = '\0';
+	return 0;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+	out[0] = (unsigned char)(value >> 24);
+	out[1] = (unsigned char)(value >> 16);
+	out[2] = (unsigned char)(value >> 8);
+	out[3] = (unsigned char)value;
+}
+
+static uint32_t get_u32(const unsigned char *data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+size_t wire_encode_response(unsigned char *out, unsigned int status, char type, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	out[0] = WIRE_MAGIC;
+	out[1] = (unsigned char)status;
+	out[2] = (unsigned char)type;
+	put_u32(out + 3, bits);
+	return WIRE_RESPONSE_SIZE;
+}
+
+static const unsigned char ERROR_RESPONSES[STATUS_COUNT][WIRE_RESPONSE_SIZE] = {
+	{ WIRE_MAGIC, STATUS_SUCCESS, 0, 0, 0, 0, 0 },
+	{ WIRE_MAGIC, STATUS_CITY_NOT_AVAILABLE, 0, 0, 0, 0, 0 },
+	{ WIRE_MAGIC, STATUS_INVALID_REQUEST, 0, 0, 0, 0, 0 }
+};
+
+const unsigned char *wire_error_response(unsigned int status) {
+	return ERROR_RESPONSES[status < STATUS_COUNT ? status : STATUS_INVALID_REQUEST];
+}
+
+int wire_decode_response(const unsigned char *data, unsigned int *status, char *type, float *value) {
+	if (data[0] != WIRE_MAGIC) {
+		return -1;
+	}
+
+	const uint32_t bits = get_u32(data + 3);
+	*status = data[1];
+	*type = (char)data[2];
+	memcpy(value, &bits, sizeof(*value));
+	return 0;
+}
+
+// Length of a city field that may fill its array without a terminator.
+static size_t city_length(const char *city, size_t size) {
+	const char *nul = memchr(city, '\0', size);
+	return nul != NULL ? (size_t)(nul - city) : size;
+}
+
+size_t wire_encode_subscribe(unsigned char *out, size_t out_size, unsigned int interval_ms,
+		const weather_request_t *items, size_t count) {
+	if (count == 0 || count > MAX_SUBSCRIBE_ITEMS) {
+		return 0;
+	}
+
+	size_t payload = 4 + 1;
+	for (size_t i = 0; i < count; ++i) {
+		const size_t city_len = city_length(items[i].city, sizeof(items[i].city));
+		payload += 2 + city_len;
+	}
+	if (payload > WIRE_MAX_SUBSCRIBE_PAYLOAD || out_size < 2 + VARINT_MAX_BYTES + payload) {
+		return 0;
+	}
+
+	size_t written = 0;
+	out[written++] = WIRE_MAGIC;
+	out[written++] = WIRE_SUBSCRIBE;
+	written += varint_encode(out + written, payload);
+	put_u32(out + written, interval_ms);
+	written += 4;
+	out[written++] = (unsigned char)count;
+	for (size_t i = 0; i < count; ++i) {
+		const size_t city_len = city_length(items[i].city, sizeof(items[i].city));
+		out[written++] = (unsigned char)items[i].type;
+		out[written++] = (unsigned char)city_len;
+		memcpy(out + written, items[i].city, city_len);
+		written += city_len;
+	}
+	return written;
+}
+
+int wire_decode_subscribe(const unsigned char *data, size_t length, unsigned int *interval_ms,
+		weather_request_t *items, size_t *count) {
+	size_t payload = 0;
+	const long varint_len = length >= 3 ? varint_decode(data + 2, length - 2, &payload) : 0;
+	if (varint_len <= 0 || 2 + (size_t)varint_len + payload != length || payload < 5) {
+		return -1;
+	}
+
+	const unsigned char *cursor = data + 2 + varint_len;
+	const unsigned char *end = data + length;
+	*interval_ms = get_u32(cursor);
+	cursor += 4;
+	*count = *cursor++;
+	if (*count == 0 || *count > MAX_SUBSCRIBE_ITEMS) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < *count; ++i) {
+		if (end - cursor < 2 || (size_t)(end - cursor - 2) < cursor[1]) {
+			return -1;
+		}
+		const size_t city_len = cursor[1];
+		const size_t copied = city_len < sizeof(items[i].city) - 1 ? city_len : sizeof(items[i].city) - 1;
+		items[i].type = (char)cursor[0];
+		memcpy(items[i].city, cursor + 2, copied);
+		items[i].city[copied] = '\0';
+		cursor += 2 + city_len;
+	}
+	return cursor == end ? 0 : -1;
+}
+
+size_t wire_encode_update(unsigned char *out, unsigned int item, char type, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	out[0] = WIRE_MAGIC;
+	out[1] = (unsigned char)item;
+	out[2] = (unsigned char)type;
+	put_u32(out + 3, bits);
+	return WIRE_UPDATE_SIZE;
+}
+
+int wire_decode_update(const unsigned char *data, unsigned int *item, char *type, float *value) {
+	if (data[0] != WIRE_MAGIC) {
+		return -1;
+	}
+
+	const uint32_t bits = get_u32(data + 3);
+	*item = data[1];
+	*type = (char)data[2];
+	memcpy(value, &bits, sizeof(*value));
+	return 0;
+}
+
+size_t wire_encode_history_query(unsigned char *out, size_t out_size, unsigned int window_s, unsigned int points,
+		char type, const char *city) {
+	const size_t city_len = strlen(city);
+	const size_t payload = 4 + 1 + 1 + 1 + city_len;
+	if (city_len > WIRE_MAX_CITY_BYTES || points > MAX_HISTORY_POINTS || out_size < 2 + VARINT_MAX_BYTES + payload) {
+		return 0;
+	}
+
+	size_t written = 0;
+	out[written++] = WIRE_MAGIC;
+	out[written++] = WIRE_HISTORY;
+	written += varint_encode(out + written, payload);
+	put_u32(out + written, window_s);
+	written += 4;
+	out[written++] = (unsigned char)points;
+	out[written++] = (unsigned char)type;
+	out[written++] = (unsigned char)city_len;
+	memcpy(out + written, city, city_len);
+	return written + city_len;
+}
+
+int wire_decode_history_query(const unsigned char *data, size_t length, unsigned int *window_s, unsigned int *points,
+		char *type, char *city, size_t city_size) {
+	size_t payload = 0;
+	const long varint_len = length >= 3 ? varint_decode(data + 2, length - 2, &payload) : 0;
+	if (varint_len <= 0 || 2 + (size_t)varint_len + payload != length || payload < 7 || city_size == 0) {
+		return -1;
+	}
+
+	const unsigned char *cursor = data + 2 + varint_len;
+	const size_t city_len = cursor[6];
+	if (payload != 7 + city_len || cursor[4] > MAX_HISTORY_POINTS) {
+		return -1;
+	}
+
+	const size_t copied = city_len < city_size - 1 ? city_len : city_size - 1;
+	*window_s = get_u32(cursor);
+	*points = cursor[4];
+	*type = (char)cursor[5];
+	memcpy(city, cursor + 7, copied);
+	city[copied] = '\0';
+	return 0;
+}
+
+static void put_float(unsigned char *out, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put_u32(out, bits);
+}
+
+static float get_float(const unsigned char *data) {
+	const uint32_t bits = get_u32(data);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+size_t wire_encode_history(unsigned char *out, const weather_history_t *history) {
+	const unsigned int points = history->points < MAX_HISTORY_POINTS ? history->points : MAX_HISTORY_POINTS;
+	const size_t payload = history->status == STATUS_SUCCESS ? 4 + 4 * 4 + 1 + (size_t)points * 4 : 0;
+
+	size_t written = 0;
+	out[written++] = WIRE_MAGIC;
+	out[written++] = WIRE_HISTORY;
+	out[written++] = (unsigned char)history->status;
+	written += varint_encode(out + written, payload);
+	if (payload == 0) {
+		return written;
+	}
+
+	put_u32(out + written, history->samples);
+	put_float(out + written + 4, history->min);
+	put_float(out + written + 8, history->max);
+	put_float(out + written + 12, history->mean);
+	put_float(out + written + 16, history->last);
+	written += 20;
+	out[written++] = (unsigned char)points;
+	for (unsigned int i = 0; i < points; ++i) {
+		put_float(out + written, history->series[i]);
+		written += 4;
+	}
+	return written;
+}
+
+long wire_history_length(const unsigned char *data, size_t available) {
+	if (available < 4) {
+		return 0;
+	}
+
+	size_t payload = 0;
+	const long varint_len = varint_decode(data + 3, available - 3, &payload);
+	if (varint_len <= 0) {
+		return varint_len;
+	}
+	if (payload > WIRE_MAX_HISTORY_ANSWER_PAYLOAD) {
+		return -1;
+	}
+	return (long)(3 + (size_t)varint_len + payload);
+}
+
+int wire_decode_history(const unsigned char *data, size_t length, weather_history_t *history) {
+	const long frame_len = wire_history_length(data, length);
+	if (data[0] != WIRE_MAGIC || data[1] != WIRE_HISTORY || frame_len <= 0 || (size_t)frame_len != length) {
+		return -1;
+	}
+
+	size_t payload = 0;
+	const long varint_len = varint_decode(data + 3, length - 3, &payload);
+	const unsigned char *cursor = data + 3 + varint_len;
+
+	memset(history, 0, sizeof(*history));
+	history->status = data[2];
+	if (payload == 0) {
+		return history->status != STATUS_SUCCESS ? 0 : -1;
+	}
+	if (payload < 21 || payload != 21 + (size_t)cursor[20] * 4 || cursor[20] > MAX_HISTORY_POINTS) {
+		return -1;
+	}
+
+	history->samples = get_u32(cursor);
+	history->min = get_float(cursor + 4);
+	history->max = get_float(cursor + 8);
+	history->mean = get_float(cursor + 12);
+	history->last = get_float(cursor + 16);
+	history->points = cursor[20];
+	for (unsigned int i = 0; i < history->points; ++i) {
+		history->series[i] = get_float(cursor + 21 + i * 4);
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * wire.h
+ *
+ * Compact wire format
+ * Versioned, explicitly byte-ordered encoding of a single weather query
+ * and its answer, shared by the client and the server. Every field is
+ * written byte by byte, so the encoding does not depend on the compiler's
+ * struct padding or on the host byte order.
+ *
+ * Request:   magic | type | city length (LEB128 varint) | city bytes
+ * Response:  magic | status | type | value (IEEE-754 binary32, big-endian)
+ * Subscribe: magic | 'S' | payload length (varint) | interval ms (uint32,
+ *            big-endian) | item count | count x (type | city length | city bytes)
+ * Update:    magic | item number | type | value
+ * History:   magic | 'H' | payload length (varint) | window s (uint32) |
+ *            points | type | city length | city bytes (none for every city)
+ * Answer:    magic | 'H' | status | payload length (varint) | samples
+ *            (uint32) | min | max | mean | last | points | points x mean
+ *
+ * A subscribe frame is answered with one response per item, in order, and
+ * carrying the current value; from then on the stream only carries update
+ * frames, each naming the item by its position in the subscribe frame.
+ * A history answer with a status other than STATUS_SUCCESS has no payload.
+ *
+ * The magic byte carries the version. It is not a type character, so the
+ * server tells compact frames from legacy weather_request_t structs by
+ * their first byte and keeps serving both.
+ */
+
+#ifndef WIRE_H_
+#define WIRE_H_
+
+#include <stddef.h>
+
+#include "weatherproto.h"
+
+#define WIRE_VERSION 1
+#define WIRE_MAGIC (0xA0 | WIRE_VERSION) // First byte of every compact frame
+#define WIRE_MAX_CITY_BYTES 255          // Longest city a frame may carry
+#define WIRE_RESPONSE_SIZE 7
+#define WIRE_MAX_REQUEST_SIZE (2 + 2 + WIRE_MAX_CITY_BYTES)
+#define WIRE_SUBSCRIBE 'S'               // Type byte of a subscribe frame
+#define WIRE_MAX_SUBSCRIBE_PAYLOAD 1024
+#define WIRE_MAX_SUBSCRIBE_SIZE (2 + 2 + WIRE_MAX_SUBSCRIBE_PAYLOAD)
+#define WIRE_UPDATE_SIZE 7
+#define WIRE_HISTORY 'H'                 // Type byte of a history query and its answer
+#define WIRE_MAX_HISTORY_PAYLOAD (4 + 1 + 1 + 1 + WIRE_MAX_CITY_BYTES)
+#define WIRE_MAX_HISTORY_ANSWER_PAYLOAD (4 + 4 * 4 + 1 + MAX_HISTORY_POINTS * 4)
+#define WIRE_MAX_HISTORY_ANSWER_SIZE (3 + 2 + WIRE_MAX_HISTORY_ANSWER_PAYLOAD)
+
+_Static_assert(WIRE_MAX_HISTORY_ANSWER_SIZE <= MAX_RESPONSE_FRAME_SIZE, "a history answer must fit a response buffer");
+
+// Returns 1 when data starts a compact frame.
+int wire_is_compact(const unsigned char *data, size_t available);
+
+// Returns 1 when data starts a compact subscribe frame.
+int wire_is_subscribe(const unsigned char *data, size_t available);
+
+// Returns 1 when data starts a compact history query (or answer).
+int wire_is_history(const unsigned char *data, size_t available);
+
+// Encodes a request into out; returns its size, or 0 if it does not fit or the city is too long.
+size_t wire_encode_request(unsigned char *out, size_t out_size, char type, const char *city);
+
+// Length of the compact request at data: > 0 when complete, 0 when more
+// bytes are needed, -1 when the header is malformed (framing is lost).
+long wire_request_length(const unsigned char *data, size_t available);
+
+// Decodes a complete request; city receives a NUL-terminated copy,
+// truncated to city_size - 1 bytes like a legacy request. Returns -1 if malformed.
+int wire_decode_request(const unsigned char *data, size_t length, char *type, char *city, size_t city_size);
+
+// Encodes a response into out, which must hold WIRE_RESPONSE_SIZE bytes.
+size_t wire_encode_response(unsigned char *out, unsigned int status, char type, float value);
+
+// Pre-encoded WIRE_RESPONSE_SIZE-byte response for a status other than
+// STATUS_SUCCESS (no type, zero value), shared and never written to.
+const unsigned char *wire_error_response(unsigned int status);
+
+// Decodes a WIRE_RESPONSE_SIZE-byte response; returns -1 on a bad magic byte.
+int wire_decode_response(const unsigned char *data, unsigned int *status, char *type, float *value);
+
+// Encodes a subscribe frame for items[0..count); returns its size, or 0 if
+// count exceeds MAX_SUBSCRIBE_ITEMS or it does not fit.
+size_t wire_encode_subscribe(unsigned char *out, size_t out_size, unsigned int interval_ms,
+		const weather_request_t *items, size_t count);
+
+// Decodes a complete subscribe frame into items (MAX_SUBSCRIBE_ITEMS entries,
+// cities truncated like wire_decode_request()). Returns -1 if malformed.
+int wire_decode_subscribe(const unsigned char *data, size_t length, unsigned int *interval_ms,
+		weather_request_t *items, size_t *count);
+
+// Encodes an update for subscribe item number item into out (WIRE_UPDATE_SIZE bytes).
+size_t wire_encode_update(unsigned char *out, unsigned int item, char type, float value);
+
+// Decodes a WIRE_UPDATE_SIZE-byte update; returns -1 on a bad magic byte.
+int wire_decode_update(const unsigned char *data, unsigned int *item, char *type, float *value);
+
+// Encodes a history query; an empty city asks for every city. Returns its
+// size, or 0 if it does not fit or points exceeds MAX_HISTORY_POINTS.
+size_t wire_encode_history_query(unsigned char *out, size_t out_size, unsigned int window_s, unsigned int points,
+		char type, const char *city);
+
+// Decodes a complete history query (city truncated like wire_decode_request()).
+// Returns -1 if malformed.
+int wire_decode_history_query(const unsigned char *data, size_t length, unsigned int *window_s, unsigned int *points,
+		char *type, char *city, size_t city_size);
+
+// Encodes a history answer into out (WIRE_MAX_HISTORY_ANSWER_SIZE bytes
+// always suffice); returns its size.
+size_t wire_encode_history(unsigned char *out, const weather_history_t *history);
+
+// Length of the history answer at data, like wire_request_length().
+long wire_history_length(const unsigned char *data, size_t available);
+
+// Decodes a complete history answer; returns -1 if malformed.
+int wire_decode_history(const unsigned char *data, size_t length, weather_history_t *history);
+
+#endif /* WIRE_H_ */
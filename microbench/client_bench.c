@@ -0,0 +1,105 @@
+/*
+ * client_bench.c
+ *
+ * Client hot-path microbenchmarks
+ * Command-line request parsing, response formatting and the compact
+ * wire codec the client runs for every query.
+ *
+ * Usage: microbench-client [-t ms] [filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "microbench.h"
+#include "protocol.h"
+#include "wire.h"
+
+typedef struct {
+	const char *argument;
+} parse_bench_t;
+
+static void bench_parse_request(void *context, uint64_t iterations) {
+	const parse_bench_t *bench = context;
+	weather_request_t request;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		microbench_consume((uint64_t)parse_request(bench->argument, &request));
+		microbench_consume((uint64_t)request.city[0]);
+	}
+}
+
+typedef struct {
+	weather_request_t request;
+	weather_response_t response;
+} format_bench_t;
+
+static void bench_format_response(void *context, uint64_t iterations) {
+	const format_bench_t *bench = context;
+	char message[RESPONSE_MESSAGE_LEN];
+	for (uint64_t i = 0; i < iterations; ++i) {
+		microbench_consume((uint64_t)format_response_message(&bench->response, &bench->request,
+				DEFAULT_SERVER_ADDRESS, message, sizeof(message)));
+	}
+}
+
+static void bench_wire_encode(void *context, uint64_t iterations) {
+	const weather_request_t *request = context;
+	unsigned char frame[WIRE_MAX_REQUEST_SIZE];
+	for (uint64_t i = 0; i < iterations; ++i) {
+		microbench_consume(wire_encode_request(frame, sizeof(frame), request->type, request->city));
+	}
+}
+
+static void bench_wire_decode(void *context, uint64_t iterations) {
+	const unsigned char *frame = context;
+	unsigned int status = 0;
+	char type = '\0';
+	float value = 0.0f;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		microbench_consume((uint64_t)wire_decode_response(frame, &status, &type, &value));
+		microbench_consume(status);
+	}
+}
+
+static void format_case(format_bench_t *bench, const char *argument, unsigned int status, float value) {
+	parse_request(argument, &bench->request);
+	bench->response.status = status;
+	bench->response.type = status == STATUS_SUCCESS ? bench->request.type : '\0';
+	bench->response.value = value;
+}
+
+int main(int argc, char *argv[]) {
+	if (microbench_begin("client", argc, argv) < 0) {
+		fprintf(stderr, "Uso: %s [-t ms] [filtro]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	parse_bench_t parses[] = {
+		{ "t Bari" },
+		{ "  p   Reggio Calabria  \t" },
+		{ "w Una citta con un nome decisamente troppo lungo per stare nel campo city della richiesta" },
+		{ "   " }
+	};
+	microbench_run("parse_request/short", bench_parse_request, &parses[0]);
+	microbench_run("parse_request/padded", bench_parse_request, &parses[1]);
+	microbench_run("parse_request/truncated", bench_parse_request, &parses[2]);
+	microbench_run("parse_request/invalid", bench_parse_request, &parses[3]);
+
+	format_bench_t formats[3];
+	memset(formats, 0, sizeof(formats));
+	format_case(&formats[0], "t bari", STATUS_SUCCESS, 21.5f);
+	format_case(&formats[1], "p reggio calabria", STATUS_SUCCESS, 1013.2f);
+	format_case(&formats[2], "h Atlantide", STATUS_CITY_NOT_AVAILABLE, 0.0f);
+	microbench_run("format_response/success", bench_format_response, &formats[0]);
+	microbench_run("format_response/success_multiword", bench_format_response, &formats[1]);
+	microbench_run("format_response/error", bench_format_response, &formats[2]);
+
+	unsigned char response_frame[WIRE_RESPONSE_SIZE];
+	wire_encode_response(response_frame, STATUS_SUCCESS, 't', 21.5f);
+	microbench_run("wire/encode_request", bench_wire_encode, &formats[0].request);
+	microbench_run("wire/decode_response", bench_wire_decode, response_frame);
+
+	microbench_end();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+/*
+ * microbench.c
+ *
+ * Microbenchmark harness
+ * Every benchmark is warmed up once, then run with growing iteration
+ * counts until one round is long enough to extrapolate, and finally
+ * measured over a run sized to the target time (-t, 200 ms by default).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "microbench.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICROBENCH_HAVE_CYCLES 1
+#else
+#define MICROBENCH_HAVE_CYCLES 0
+#endif
+
+#define DEFAULT_TARGET_MS 200
+#define MAX_TARGET_MS 60000
+#define CALIBRATION_DIVISOR 10 // A calibration round of target/10 is long enough to extrapolate
+#define MAX_ITERATIONS 1000000000ULL
+
+volatile uint64_t microbench_sink;
+
+static atomic_ullong allocations;
+static uint64_t target_ns = DEFAULT_TARGET_MS * 1000000ULL;
+static const char *name_filter;
+static int results;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __real_realloc(pointer, size);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// TSC reference cycles: they tick at a constant rate whatever the core clock does.
+static uint64_t now_cycles(void) {
+#if MICROBENCH_HAVE_CYCLES
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+typedef struct {
+	uint64_t ns;
+	uint64_t cycles;
+	uint64_t allocations;
+} microbench_sample_t;
+
+static microbench_sample_t measure(microbench_fn_t fn, void *context, uint64_t iterations) {
+	microbench_sample_t sample;
+	const uint64_t allocations_before = atomic_load(&allocations);
+	const uint64_t started_ns = now_ns();
+	const uint64_t started_cycles = now_cycles();
+	fn(context, iterations);
+	sample.cycles = now_cycles() - started_cycles;
+	sample.ns = now_ns() - started_ns;
+	sample.allocations = atomic_load(&allocations) - allocations_before;
+	return sample;
+}
+
+int microbench_begin(const char *suite, int argc, char *argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			char *end = NULL;
+			unsigned long value = strtoul(argv[++i], &end, 10);
+			if (*argv[i] == '\0' || *end != '\0' || value == 0 || value > MAX_TARGET_MS) {
+				return -1;
+			}
+			target_ns = (uint64_t)value * 1000000ULL;
+		} else if (argv[i][0] != '-' && name_filter == NULL) {
+			name_filter = argv[i];
+		} else {
+			return -1;
+		}
+	}
+
+	printf("{\n  \"suite\": \"%s\",\n  \"target_ms\": %llu,\n  \"benchmarks\": [", suite,
+			(unsigned long long)(target_ns / 1000000ULL));
+	fflush(stdout);
+	return 0;
+}
+
+void microbench_run(const char *name, microbench_fn_t fn, void *context) {
+	if (name_filter != NULL && strstr(name, name_filter) == NULL) {
+		return;
+	}
+
+	// Warm-up: first-touch page faults, cold caches and lazy initialization.
+	fn(context, 1);
+
+	uint64_t iterations = 1;
+	microbench_sample_t sample = measure(fn, context, iterations);
+	while (sample.ns < target_ns / CALIBRATION_DIVISOR && iterations < MAX_ITERATIONS) {
+		iterations *= 10;
+		sample = measure(fn, context, iterations);
+	}
+
+	const uint64_t per_round_ns = sample.ns > 0 ? sample.ns : 1;
+	const double scaled = (double)iterations * (double)target_ns / (double)per_round_ns;
+	iterations = scaled < 1.0 ? 1 : scaled > (double)MAX_ITERATIONS ? MAX_ITERATIONS : (uint64_t)scaled;
+	sample = measure(fn, context, iterations);
+
+	printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, ", results > 0 ? "," : "",
+			name, (unsigned long long)iterations, (double)sample.ns / (double)iterations);
+	if (MICROBENCH_HAVE_CYCLES) {
+		printf("\"cycles_per_op\": %.2f, ", (double)sample.cycles / (double)iterations);
+	} else {
+		printf("\"cycles_per_op\": null, ");
+	}
+	printf("\"allocs_per_op\": %.4f}", (double)sample.allocations / (double)iterations);
+	fflush(stdout);
+	++results;
+}
+
+void microbench_end(void) {
+	printf("\n  ]\n}\n");
+	fflush(stdout);
+}
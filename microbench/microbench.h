@@ -0,0 +1,39 @@
+/*
+ * microbench.h
+ *
+ * Microbenchmark harness
+ * Runs a benchmark body for a calibrated number of iterations and prints
+ * one JSON document per suite on stdout: time, cycles and heap
+ * allocations per operation, so runs from different commits can be
+ * diffed by a script.
+ *
+ * Allocations are counted by wrapping malloc/calloc/realloc at link time
+ * (-Wl,--wrap=...), which sees every call made by the linked objects but
+ * not the ones libc makes internally.
+ */
+
+#ifndef MICROBENCH_H_
+#define MICROBENCH_H_
+
+#include <stdint.h>
+
+// Runs the measured operation `iterations` times.
+typedef void (*microbench_fn_t)(void *context, uint64_t iterations);
+
+// Parses [-t ms] [filter] and opens the JSON document; returns -1 on a bad command line.
+int microbench_begin(const char *suite, int argc, char *argv[]);
+
+// Measures fn unless its name does not contain the filter.
+void microbench_run(const char *name, microbench_fn_t fn, void *context);
+
+// Closes the JSON document.
+void microbench_end(void);
+
+// Keeps a computed value alive so the optimizer cannot drop the work behind it.
+extern volatile uint64_t microbench_sink;
+
+static inline void microbench_consume(uint64_t value) {
+	microbench_sink += value;
+}
+
+#endif /* MICROBENCH_H_ */
@@ -0,0 +1,344 @@
+/*
+ * server_bench.c
+ *
+ * Server hot-path microbenchmarks
+ * City lookup on a small and a large catalog, the weather generators,
+ * request framing and dispatch (the work handle_client() does per frame),
+ * history recording and range queries, and a full request/response round
+ * trip through handle_client() over a socketpair and over loopback TCP.
+ *
+ * Usage: microbench-server [-t ms] [filter]
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "microbench.h"
+#include "protocol.h"
+#include "catalog.h"
+#include "cache.h"
+#include "history.h"
+#include "admission.h"
+#include "request_log.h"
+#include "rng.h"
+#include "wire.h"
+#include "netio.h"
+
+#define LARGE_CATALOG_SIZE 100000
+#define BATCH_BENCH_ITEMS 16
+#define PIPELINE_BENCH_DEPTH 16
+#define HISTORY_BENCH_WINDOW_S 86400
+
+static const char *const SMALL_CATALOG[] = {
+	"Bari", "Roma", "Milano", "Napoli", "Torino",
+	"Palermo", "Genova", "Bologna", "Firenze", "Venezia"
+};
+
+static server_config_t config;
+
+static void bench_city_lookup(void *context, uint64_t iterations) {
+	const char *city = context;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		microbench_consume((uint64_t)is_supported_city(city));
+	}
+}
+
+typedef struct {
+	int index; // In WEATHER_TYPES
+} generator_bench_t;
+
+static void bench_generator(void *context, uint64_t iterations) {
+	const generator_bench_t *bench = context;
+	float total = 0.0f;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		total += weather_generate(bench->index);
+	}
+	microbench_consume((uint64_t)total);
+}
+
+static void bench_history_record(void *context, uint64_t iterations) {
+	(void)context;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		history_record((long)(i % 10), 't', (float)i);
+	}
+}
+
+typedef struct {
+	long city_index; // -1 for every city
+	unsigned int points;
+} history_bench_t;
+
+static void bench_history_query(void *context, uint64_t iterations) {
+	const history_bench_t *bench = context;
+	weather_history_t history;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		history_query(bench->city_index, 't', HISTORY_BENCH_WINDOW_S, bench->points, &history);
+		microbench_consume(history.samples);
+	}
+}
+
+typedef struct {
+	char frame[MAX_REQUEST_FRAME_SIZE];
+	size_t length;
+} frame_bench_t;
+
+static void frame_compact(frame_bench_t *bench, char type, const char *city) {
+	bench->length = wire_encode_request((unsigned char *)bench->frame, sizeof(bench->frame), type, city);
+}
+
+static void frame_legacy(frame_bench_t *bench, char type, const char *city) {
+	weather_request_t request;
+	memset(&request, 0, sizeof(request));
+	request.type = type;
+	strncpy(request.city, city, sizeof(request.city) - 1);
+	memcpy(bench->frame, &request, sizeof(request));
+	bench->length = sizeof(request);
+}
+
+static void frame_batch(frame_bench_t *bench, unsigned int count) {
+	weather_batch_request_t header;
+	memset(&header, 0, sizeof(header));
+	header.type = REQUEST_TYPE_BATCH;
+	header.count = (unsigned char)count;
+	memcpy(bench->frame, &header, sizeof(header));
+	bench->length = sizeof(header);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		weather_request_t item;
+		memset(&item, 0, sizeof(item));
+		item.type = WEATHER_TYPES[i % WEATHER_TYPE_COUNT].type;
+		strcpy(item.city, SMALL_CATALOG[i % (sizeof(SMALL_CATALOG) / sizeof(SMALL_CATALOG[0]))]);
+		memcpy(bench->frame + bench->length, &item, sizeof(item));
+		bench->length += sizeof(item);
+	}
+}
+
+// Framing plus dispatch: what handle_client() does for every buffered frame.
+static void bench_dispatch(void *context, uint64_t iterations) {
+	const frame_bench_t *bench = context;
+	char reply[MAX_RESPONSE_FRAME_SIZE];
+	for (uint64_t i = 0; i < iterations; ++i) {
+		const size_t length = request_frame_length(bench->frame, bench->length);
+		const char *answer = NULL;
+		size_t reply_length = 0;
+		process_request_frame(bench->frame, length, htonl(INADDR_LOOPBACK), reply, &answer, &reply_length);
+		microbench_consume(reply_length);
+	}
+}
+
+typedef struct {
+	int client_socket;
+	int server_socket;
+	pthread_t server;
+	unsigned char frames[PIPELINE_BENCH_DEPTH * WIRE_MAX_REQUEST_SIZE];
+	size_t length;
+	size_t depth; // Requests written back to back before reading the answers
+} roundtrip_bench_t;
+
+static void *roundtrip_server(void *arg) {
+	roundtrip_bench_t *bench = arg;
+	rng_thread_init(1);
+	handle_client(bench->server_socket, htonl(INADDR_LOOPBACK), &config);
+	close(bench->server_socket);
+	return NULL;
+}
+
+static void bench_roundtrip(void *context, uint64_t iterations) {
+	roundtrip_bench_t *bench = context;
+	unsigned char replies[PIPELINE_BENCH_DEPTH * WIRE_RESPONSE_SIZE];
+	for (uint64_t i = 0; i < iterations; ++i) {
+		if (net_send_all(bench->client_socket, bench->frames, bench->length, NULL) < 0
+				|| net_recv_all(bench->client_socket, replies, bench->depth * WIRE_RESPONSE_SIZE) < 0) {
+			perror("round trip fallito");
+			exit(EXIT_FAILURE);
+		}
+		microbench_consume(replies[1]);
+	}
+}
+
+// Starts handle_client() on one end of a connected pair, with keep-alive so one connection serves every iteration.
+// Pipelined runs alternate known and unknown cities, so half the answers are error templates.
+static int roundtrip_start(roundtrip_bench_t *bench, int client_socket, int server_socket, size_t depth) {
+	bench->client_socket = client_socket;
+	bench->server_socket = server_socket;
+	bench->depth = depth;
+	bench->length = 0;
+	for (size_t i = 0; i < depth; ++i) {
+		bench->length += wire_encode_request(bench->frames + bench->length, sizeof(bench->frames) - bench->length,
+				't', i % 2 == 0 ? "Bari" : "Atlantide");
+	}
+	int result = pthread_create(&bench->server, NULL, roundtrip_server, bench);
+	if (result != 0) {
+		fprintf(stderr, "pthread_create() fallita: %s\n", strerror(result));
+		return -1;
+	}
+	return 0;
+}
+
+static void roundtrip_stop(roundtrip_bench_t *bench) {
+	// EOF ends the keep-alive loop in handle_client().
+	close(bench->client_socket);
+	pthread_join(bench->server, NULL);
+}
+
+static int loopback_pair(int pair[2]) {
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t address_length = sizeof(address);
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0
+			|| listen(listener, 1) < 0
+			|| getsockname(listener, (struct sockaddr *)&address, &address_length) < 0) {
+		perror("listener di loopback non creato");
+		if (listener >= 0) {
+			close(listener);
+		}
+		return -1;
+	}
+
+	pair[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (pair[0] < 0 || connect(pair[0], (struct sockaddr *)&address, sizeof(address)) < 0) {
+		perror("connessione di loopback fallita");
+		close(listener);
+		return -1;
+	}
+	pair[1] = accept(listener, NULL, NULL);
+	close(listener);
+	if (pair[1] < 0) {
+		perror("accept() fallita");
+		close(pair[0]);
+		return -1;
+	}
+
+	const int enable = 1;
+	setsockopt(pair[0], IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+	setsockopt(pair[1], IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+	return 0;
+}
+
+static void run_roundtrip(const char *name, int pair[2], size_t depth) {
+	roundtrip_bench_t bench;
+	if (roundtrip_start(&bench, pair[0], pair[1], depth) < 0) {
+		close(pair[0]);
+		close(pair[1]);
+		return;
+	}
+	microbench_run(name, bench_roundtrip, &bench);
+	roundtrip_stop(&bench);
+}
+
+// Builds LARGE_CATALOG_SIZE synthetic names ("Localita 000000", ...); never freed.
+static const char **large_catalog_names(void) {
+	const char **names = malloc(LARGE_CATALOG_SIZE * sizeof(*names));
+	char *storage = malloc(LARGE_CATALOG_SIZE * 16);
+	if (names == NULL || storage == NULL) {
+		return NULL;
+	}
+	for (unsigned int i = 0; i < LARGE_CATALOG_SIZE; ++i) {
+		snprintf(storage + i * 16, 16, "Localita %06u", i);
+		names[i] = storage + i * 16;
+	}
+	return names;
+}
+
+int main(int argc, char *argv[]) {
+	if (microbench_begin("server", argc, argv) < 0) {
+		fprintf(stderr, "Uso: %s [-t ms] [filtro]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Defaults of a plain `server` run, with logging off so no benchmark measures stderr.
+	memset(&config, 0, sizeof(config));
+	config.keep_alive = 1;
+	config.history_samples = DEFAULT_HISTORY_SAMPLES;
+	const size_t small_count = sizeof(SMALL_CATALOG) / sizeof(SMALL_CATALOG[0]);
+	const char **large_names = large_catalog_names();
+	if (large_names == NULL || catalog_load(NULL, SMALL_CATALOG, small_count) < 0
+			|| weather_cache_init(config.cache_ttl_ms) < 0
+			|| history_init(config.history_samples, catalog_city_count()) < 0) {
+		fprintf(stderr, "Inizializzazione del benchmark fallita\n");
+		return EXIT_FAILURE;
+	}
+	rng_seed(1);
+	rng_thread_init(0);
+	admission_init(&config);
+	request_log_start(LOG_LEVEL_OFF, 1);
+
+	microbench_run("city/10/hit", bench_city_lookup, "Bari");
+	microbench_run("city/10/hit_mixed_case", bench_city_lookup, "bOLOGNA");
+	microbench_run("city/10/miss", bench_city_lookup, "Atlantide");
+	microbench_run("city/10/miss_long", bench_city_lookup, "Una citta con un nome decisamente troppo lungo per esistere");
+
+	if (catalog_load(NULL, large_names, LARGE_CATALOG_SIZE) < 0) {
+		fprintf(stderr, "Impossibile costruire il catalogo grande\n");
+		return EXIT_FAILURE;
+	}
+	microbench_run("city/100000/hit", bench_city_lookup, "Localita 050000");
+	microbench_run("city/100000/hit_mixed_case", bench_city_lookup, "LOCALITA 099999");
+	microbench_run("city/100000/miss", bench_city_lookup, "Atlantide");
+	catalog_load(NULL, SMALL_CATALOG, small_count);
+
+	generator_bench_t generators[] = { { WEATHER_TYPE_TEMPERATURE }, { WEATHER_TYPE_HUMIDITY }, { WEATHER_TYPE_WIND }, { WEATHER_TYPE_PRESSURE } };
+	microbench_run("generate/temperature", bench_generator, &generators[0]);
+	microbench_run("generate/humidity", bench_generator, &generators[1]);
+	microbench_run("generate/wind", bench_generator, &generators[2]);
+	microbench_run("generate/pressure", bench_generator, &generators[3]);
+
+	// Every series of the small catalog full: DEFAULT_HISTORY_SAMPLES samples, all inside a 24h window.
+	for (unsigned int sample = 0; sample < DEFAULT_HISTORY_SAMPLES; ++sample) {
+		for (long city = 0; city < (long)small_count; ++city) {
+			for (int type = 0; type < WEATHER_TYPE_COUNT; ++type) {
+				history_record(city, WEATHER_TYPES[type].type, weather_generate(type));
+			}
+		}
+	}
+	history_bench_t history_queries[] = { { 0, 0 }, { -1, 0 }, { -1, 24 } };
+	microbench_run("history/query/city_24h", bench_history_query, &history_queries[0]);
+	microbench_run("history/query/all_24h", bench_history_query, &history_queries[1]);
+	microbench_run("history/query/all_24h_points24", bench_history_query, &history_queries[2]);
+	microbench_run("history/record", bench_history_record, NULL);
+
+	static frame_bench_t frames[6];
+	frame_compact(&frames[0], 't', "Bari");
+	frame_compact(&frames[1], 't', "Atlantide");
+	frame_compact(&frames[2], 'x', "Bari");
+	frame_legacy(&frames[3], 'p', "Reggio");
+	frame_legacy(&frames[4], 'h', "venezia");
+	frame_batch(&frames[5], BATCH_BENCH_ITEMS);
+	microbench_run("dispatch/compact/success", bench_dispatch, &frames[0]);
+	microbench_run("dispatch/compact/city_not_available", bench_dispatch, &frames[1]);
+	microbench_run("dispatch/compact/invalid_type", bench_dispatch, &frames[2]);
+	microbench_run("dispatch/legacy/city_not_available", bench_dispatch, &frames[3]);
+	microbench_run("dispatch/legacy/success", bench_dispatch, &frames[4]);
+	microbench_run("dispatch/batch16", bench_dispatch, &frames[5]);
+
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+		run_roundtrip("roundtrip/socketpair", pair, 1);
+	} else {
+		perror("socketpair() fallita");
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+		run_roundtrip("roundtrip/socketpair_pipelined16", pair, PIPELINE_BENCH_DEPTH);
+	} else {
+		perror("socketpair() fallita");
+	}
+	if (loopback_pair(pair) == 0) {
+		run_roundtrip("roundtrip/loopback_tcp", pair, 1);
+	}
+
+	microbench_end();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/*
+ * admission.c
+ *
+ * Connection admission control
+ *
+ * The concurrent-connection count is one shared atomic, touched only when
+ * --max-conn is set. The per-address limit is a generic cell rate
+ * algorithm, the single-timestamp form of a token bucket: each address
+ * keeps the theoretical arrival time (TAT) of its next connection, and a
+ * connection is admitted while TAT - now stays within the burst tolerance.
+ *
+ * Address and TAT (microseconds, 32-bit wrapping) share one 64-bit slot of
+ * a fixed table, updated with a single compare-and-swap, so workers need
+ * no lock. Each address probes a few neighbouring slots; when all are
+ * taken the stalest entry is evicted, which can only let a client through
+ * early, never lock one out.
+ */
+
+#include "admission.h"
+#include "metrics.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define RATE_TABLE_SIZE 4096 // Slots, power of two (32 KiB)
+#define RATE_PROBE 4         // Neighbouring slots an address may occupy
+#define RATE_CAS_RETRIES 8   // Lost races before a query is let through
+
+static unsigned int max_connections;
+static uint32_t emission_us;  // 1 s / rate: TAT advance per admitted connection
+static uint32_t tolerance_us; // (burst - 1) * emission_us
+static _Atomic uint64_t rate_table[RATE_TABLE_SIZE];
+
+static atomic_uint active_connections;
+static atomic_ullong rejected_busy;
+static atomic_ullong rejected_rate;
+static atomic_ullong datagrams_rate_limited;
+static atomic_ullong timed_out[2];
+
+void admission_init(const server_config_t *config) {
+	max_connections = config->max_connections;
+	if (config->ip_rate > 0) {
+		emission_us = 1000000u / config->ip_rate;
+		if (emission_us == 0) {
+			emission_us = 1;
+		}
+		tolerance_us = (config->ip_burst - 1) * emission_us;
+	}
+}
+
+static uint32_t rate_hash(uint32_t client_addr) {
+	// Fibonacci hashing: neighbouring addresses land far apart.
+	return (uint32_t)((client_addr * 2654435769u) >> 20) & (RATE_TABLE_SIZE - 1);
+}
+
+// Takes a token for client_addr; returns 1 if it had one.
+static int rate_allow(uint32_t client_addr) {
+	if (emission_us == 0) {
+		return 1;
+	}
+
+	const uint32_t now = (uint32_t)(metrics_now_ns() / 1000);
+	const uint32_t base = rate_hash(client_addr);
+
+	for (int attempt = 0; attempt < RATE_CAS_RETRIES; ++attempt) {
+		// Find the address, or the slot to evict: empty first, else the one idle longest.
+		_Atomic uint64_t *slot = NULL;
+		uint64_t old = 0;
+		int32_t victim_age = INT32_MIN;
+		for (uint32_t i = 0; i < RATE_PROBE; ++i) {
+			_Atomic uint64_t *candidate = &rate_table[(base + i) & (RATE_TABLE_SIZE - 1)];
+			const uint64_t value = atomic_load_explicit(candidate, memory_order_relaxed);
+			if (value != 0 && (uint32_t)(value >> 32) == client_addr) {
+				slot = candidate;
+				old = value;
+				break;
+			}
+			const int32_t age = value == 0 ? INT32_MAX : (int32_t)(now - (uint32_t)value);
+			if (age > victim_age) {
+				victim_age = age;
+				slot = candidate;
+				old = value;
+			}
+		}
+
+		uint32_t tat = now;
+		if (old != 0 && (uint32_t)(old >> 32) == client_addr) {
+			const int32_t ahead = (int32_t)((uint32_t)old - now);
+			// A TAT further ahead than any admission can leave it is a wrapped, stale entry.
+			if (ahead > 0 && (uint32_t)ahead <= tolerance_us + emission_us) {
+				tat = (uint32_t)old;
+			}
+		}
+		if ((int32_t)(tat - now) > (int32_t)tolerance_us) {
+			return 0;
+		}
+
+		const uint64_t updated = ((uint64_t)client_addr << 32) | (uint32_t)(tat + emission_us);
+		if (atomic_compare_exchange_weak_explicit(slot, &old, updated, memory_order_relaxed, memory_order_relaxed)) {
+			return 1;
+		}
+	}
+
+	// Heavy contention on one slot: fail open rather than spin on the accept path.
+	return 1;
+}
+
+admission_result_t admission_open(uint32_t client_addr) {
+	if (max_connections > 0) {
+		const unsigned int active = atomic_fetch_add_explicit(&active_connections, 1, memory_order_relaxed);
+		if (active >= max_connections) {
+			atomic_fetch_sub_explicit(&active_connections, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&rejected_busy, 1, memory_order_relaxed);
+			return ADMISSION_BUSY;
+		}
+	}
+
+	if (!rate_allow(client_addr)) {
+		admission_close();
+		atomic_fetch_add_explicit(&rejected_rate, 1, memory_order_relaxed);
+		return ADMISSION_RATE_LIMITED;
+	}
+
+	return ADMISSION_ACCEPTED;
+}
+
+void admission_close(void) {
+	if (max_connections > 0) {
+		atomic_fetch_sub_explicit(&active_connections, 1, memory_order_relaxed);
+	}
+}
+
+int admission_allow_datagram(uint32_t client_addr) {
+	if (rate_allow(client_addr)) {
+		return 1;
+	}
+	atomic_fetch_add_explicit(&datagrams_rate_limited, 1, memory_order_relaxed);
+	return 0;
+}
+
+void admission_count_timeout(deadline_kind_t kind) {
+	atomic_fetch_add_explicit(&timed_out[kind == DEADLINE_WRITE], 1, memory_order_relaxed);
+}
+
+void admission_stats(admission_stats_t *stats) {
+	stats->active = atomic_load_explicit(&active_connections, memory_order_relaxed);
+	stats->rejected_busy = atomic_load_explicit(&rejected_busy, memory_order_relaxed);
+	stats->rejected_rate = atomic_load_explicit(&rejected_rate, memory_order_relaxed);
+	stats->datagrams_rate_limited = atomic_load_explicit(&datagrams_rate_limited, memory_order_relaxed);
+	stats->timed_out_read = atomic_load_explicit(&timed_out[0], memory_order_relaxed);
+	stats->timed_out_write = atomic_load_explicit(&timed_out[1], memory_order_relaxed);
+}
@@ -0,0 +1,55 @@
+/*
+ * admission.h
+ *
+ * Connection admission control
+ * Decides at accept time whether a connection is served: a global cap on
+ * concurrent connections (--max-conn) and a per-source-IP token bucket
+ * (--ip-rate) reject excess load immediately instead of letting it queue.
+ * Also counts the connections closed by the read/write deadlines.
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Outcome of admission_open()
+typedef enum {
+	ADMISSION_ACCEPTED,
+	ADMISSION_BUSY,        // --max-conn connections already open
+	ADMISSION_RATE_LIMITED // The source address exhausted its token bucket
+} admission_result_t;
+
+// Deadline that closed a connection
+typedef enum {
+	DEADLINE_READ,
+	DEADLINE_WRITE
+} deadline_kind_t;
+
+// Counters shown on the metrics page; a snapshot, not a synchronized read.
+typedef struct {
+	uint64_t active;
+	uint64_t rejected_busy;
+	uint64_t rejected_rate;
+	uint64_t datagrams_rate_limited;
+	uint64_t timed_out_read;
+	uint64_t timed_out_write;
+} admission_stats_t;
+
+// Reads the limits from config; call once before any listener starts.
+void admission_init(const server_config_t *config);
+
+// Called for every accepted connection. Only an ADMISSION_ACCEPTED
+// connection is served, and it must be paired with admission_close().
+admission_result_t admission_open(uint32_t client_addr);
+void admission_close(void);
+
+// Per-address rate check for a UDP query; returns 1 to answer it.
+int admission_allow_datagram(uint32_t client_addr);
+
+void admission_count_timeout(deadline_kind_t kind);
+void admission_stats(admission_stats_t *stats);
+
+#endif /* ADMISSION_H_ */
@@ -0,0 +1,209 @@
+/*
+ * cache.c
+ *
+ * Time-windowed weather value cache
+ *
+ * A direct-mapped table of 16-byte slots, four per cache line. Every slot
+ * is a tiny seqlock: readers never write the slot and treat a concurrent
+ * update as a miss instead of retrying; a writer claims a slot with one
+ * CAS and simply skips the update if another writer holds it.
+ *
+ * Slots store the time the value was generated, so a catalog reload (which
+ * renumbers cities) invalidates everything by moving valid_from forward.
+ */
+
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "catalog.h"
+#include "weatherproto.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CACHE_SLOTS 16384
+#define CACHE_LINE_SIZE 64
+#define COUNTER_SLOTS 64
+
+typedef struct {
+	atomic_uint seq;       // Odd while a writer updates the slot
+	atomic_uint key;       // city_index * WEATHER_TYPE_COUNT + type slot + 1, 0 when empty
+	atomic_uint stored_ms; // Generation time on the monotonic clock
+	atomic_uint value;     // Bit pattern of the float value
+} cache_slot_t;
+
+// Counters are spread over padded slots so threads rarely share a line.
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_ullong hits;
+	atomic_ullong misses;
+} cache_counter_t;
+
+static cache_slot_t *slots;
+static unsigned int ttl;
+static atomic_uint valid_from_ms;
+static atomic_uint seen_generation;
+static cache_counter_t counters[COUNTER_SLOTS];
+static atomic_uint next_counter;
+static _Thread_local int counter_index = -1;
+static atomic_int report_pending;
+
+static uint32_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+static uint32_t make_key(long city_index, char type) {
+	const int slot = weather_type_index(type);
+	if (city_index < 0 || city_index >= (long)(UINT32_MAX / WEATHER_TYPE_COUNT) - 1 || slot < 0) {
+		return 0;
+	}
+	return (uint32_t)city_index * WEATHER_TYPE_COUNT + (uint32_t)slot + 1u;
+}
+
+static cache_slot_t *slot_for(uint32_t key) {
+	// Fibonacci hashing spreads consecutive city indexes across the table.
+	return &slots[(key * 2654435769u) >> 18];
+}
+
+static cache_counter_t *thread_counter(void) {
+	if (counter_index < 0) {
+		counter_index = (int)(atomic_fetch_add(&next_counter, 1) % COUNTER_SLOTS);
+	}
+	return &counters[counter_index];
+}
+
+int weather_cache_init(unsigned int ttl_ms) {
+	ttl = ttl_ms;
+	if (ttl == 0) {
+		return 0;
+	}
+
+	slots = aligned_alloc(CACHE_LINE_SIZE, CACHE_SLOTS * sizeof(cache_slot_t));
+	if (slots == NULL) {
+		return -1;
+	}
+	memset(slots, 0, CACHE_SLOTS * sizeof(cache_slot_t));
+	atomic_store(&valid_from_ms, now_ms());
+	atomic_store(&seen_generation, catalog_generation());
+	return 0;
+}
+
+int weather_cache_get(long city_index, char type, float *value) {
+	if (ttl == 0) {
+		return 0;
+	}
+
+	const uint32_t key = make_key(city_index, type);
+	if (key == 0) {
+		return 0;
+	}
+
+	const uint32_t now = now_ms();
+	const unsigned int generation = catalog_generation();
+	if (generation != atomic_load_explicit(&seen_generation, memory_order_relaxed)) {
+		// City indexes were renumbered: everything cached so far is stale.
+		atomic_store(&seen_generation, generation);
+		atomic_store(&valid_from_ms, now);
+	}
+
+	cache_slot_t *slot = slot_for(key);
+	const unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	const uint32_t slot_key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+	const uint32_t stored = atomic_load_explicit(&slot->stored_ms, memory_order_relaxed);
+	const uint32_t bits = atomic_load_explicit(&slot->value, memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	const unsigned int seq_after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+	const uint32_t valid_from = atomic_load_explicit(&valid_from_ms, memory_order_relaxed);
+	const int hit = (seq & 1u) == 0 && seq == seq_after && slot_key == key
+			&& now - stored < ttl && (int32_t)(stored - valid_from) >= 0;
+
+	cache_counter_t *counter = thread_counter();
+	if (!hit) {
+		atomic_fetch_add_explicit(&counter->misses, 1, memory_order_relaxed);
+		return 0;
+	}
+
+	atomic_fetch_add_explicit(&counter->hits, 1, memory_order_relaxed);
+	memcpy(value, &bits, sizeof(*value));
+	return 1;
+}
+
+void weather_cache_put(long city_index, char type, float value) {
+	if (ttl == 0) {
+		return;
+	}
+
+	const uint32_t key = make_key(city_index, type);
+	if (key == 0) {
+		return;
+	}
+
+	cache_slot_t *slot = slot_for(key);
+	unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	if ((seq & 1u) != 0 || !atomic_compare_exchange_strong_explicit(&slot->seq, &seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {
+		// Another writer owns the slot; its value is just as fresh.
+		return;
+	}
+
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	atomic_store_explicit(&slot->key, key, memory_order_relaxed);
+	atomic_store_explicit(&slot->stored_ms, now_ms(), memory_order_relaxed);
+	atomic_store_explicit(&slot->value, bits, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+void weather_cache_stats(uint64_t *hits, uint64_t *misses) {
+	uint64_t total_hits = 0;
+	uint64_t total_misses = 0;
+	for (int i = 0; i < COUNTER_SLOTS; ++i) {
+		total_hits += atomic_load_explicit(&counters[i].hits, memory_order_relaxed);
+		total_misses += atomic_load_explicit(&counters[i].misses, memory_order_relaxed);
+	}
+	*hits = total_hits;
+	*misses = total_misses;
+}
+
+#if !defined WIN32
+static void on_report_signal(int signal_number) {
+	(void)signal_number;
+	atomic_store(&report_pending, 1);
+}
+#endif
+
+void weather_cache_install_report_handler(void) {
+#if !defined WIN32
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_report_signal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &action, NULL);
+#endif
+}
+
+void weather_cache_poll_report(void) {
+	if (atomic_load_explicit(&report_pending, memory_order_relaxed) == 0
+			|| atomic_exchange(&report_pending, 0) == 0) {
+		return;
+	}
+
+	if (ttl == 0) {
+		fprintf(stderr, "Cache disattivata (--cache-ttl 0)\n");
+		return;
+	}
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	weather_cache_stats(&hits, &misses);
+	const uint64_t total = hits + misses;
+	fprintf(stderr, "Cache: %llu hit, %llu miss (%.1f%% hit)\n",
+			(unsigned long long)hits, (unsigned long long)misses,
+			total > 0 ? 100.0 * (double)hits / (double)total : 0.0);
+}
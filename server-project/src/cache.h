@@ -0,0 +1,29 @@
+/*
+ * cache.h
+ *
+ * Time-windowed weather value cache
+ * Remembers the value generated for a (city, type) pair for a configurable
+ * TTL (--cache-ttl), so repeated queries within the window agree and any
+ * expensive generator behind get_* runs once per window.
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+
+// Sizes the table and sets the TTL in milliseconds; 0 disables the cache.
+int weather_cache_init(unsigned int ttl_ms);
+
+// Returns 1 and stores the cached value on a fresh hit, 0 otherwise.
+int weather_cache_get(long city_index, char type, float *value);
+void weather_cache_put(long city_index, char type, float value);
+
+// Totals across all threads; a snapshot, not a synchronized read.
+void weather_cache_stats(uint64_t *hits, uint64_t *misses);
+
+// SIGUSR1 only flags a report; event loops call weather_cache_poll_report() to print the counters.
+void weather_cache_install_report_handler(void);
+void weather_cache_poll_report(void);
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,194 @@
+/*
+ * catalog.c
+ *
+ * Active city catalog
+ *
+ * Lookups read the current index through an atomic pointer, so a reload
+ * never blocks or tears a concurrent lookup. Every lookup counts itself in
+ * its thread's reader slot around the read. A replaced index is retired,
+ * and catalog_poll_reload() frees it once each slot has been seen idle
+ * since the swap: a lookup that loaded the old pointer was counted before
+ * the swap, so an idle slot proves it finished. Until then a further
+ * reload waits, so at most one index is retired at a time.
+ */
+
+#define _GNU_SOURCE
+
+#include "catalog.h"
+#include "city_index.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+#define READER_SLOTS 256 // Threads beyond this share slots round-robin
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_uint active; // Lookups in progress
+} reader_slot_t;
+
+static _Atomic(city_index_t *) active_index;
+static reader_slot_t readers[READER_SLOTS];
+static atomic_uint next_reader;
+static _Thread_local int reader_index = -1;
+static city_index_t *retired_index;            // Replaced index some lookup may still read
+static unsigned char reader_idle[READER_SLOTS]; // Slot seen idle since retired_index was replaced
+static atomic_int retired_pending;
+static atomic_uint generation;
+static atomic_int reload_pending;
+static atomic_flag reload_lock = ATOMIC_FLAG_INIT;
+static const char *catalog_path;
+
+static city_index_t *catalog_open(const char *path, const char *const *builtin_names, size_t builtin_count) {
+	city_index_t *index = calloc(1, sizeof(*index));
+	if (index == NULL) {
+		return NULL;
+	}
+
+	const int result = path != NULL
+			? city_index_map(index, path)
+			: city_index_build(index, builtin_names, builtin_count);
+	if (result < 0) {
+		free(index);
+		return NULL;
+	}
+	return index;
+}
+
+static reader_slot_t *thread_reader(void) {
+	if (reader_index < 0) {
+		reader_index = (int)(atomic_fetch_add(&next_reader, 1) % READER_SLOTS);
+	}
+	return &readers[reader_index];
+}
+
+// Frees the retired index once every reader slot was seen idle after the
+// swap; called with reload_lock held.
+static void catalog_collect(void) {
+	int busy = 0;
+	for (size_t i = 0; i < READER_SLOTS; ++i) {
+		if (!reader_idle[i]) {
+			// Sequentially consistent, like the swap and the lookups' count and load.
+			reader_idle[i] = atomic_load(&readers[i].active) == 0;
+			busy |= !reader_idle[i];
+		}
+	}
+	if (busy) {
+		return;
+	}
+
+	city_index_free(retired_index);
+	free(retired_index);
+	retired_index = NULL;
+	atomic_store(&retired_pending, 0);
+}
+
+// Only called with no index retired: at startup, or by a reload holding reload_lock.
+static void catalog_swap(city_index_t *index) {
+	city_index_t *previous = atomic_exchange(&active_index, index);
+	atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+
+	if (previous != NULL) {
+		retired_index = previous;
+		memset(reader_idle, 0, sizeof(reader_idle));
+		atomic_store(&retired_pending, 1);
+		catalog_collect();
+	}
+}
+
+int catalog_load(const char *path, const char *const *builtin_names, size_t builtin_count) {
+	city_index_t *index = catalog_open(path, builtin_names, builtin_count);
+	if (index == NULL) {
+		return -1;
+	}
+
+	catalog_path = path;
+	catalog_swap(index);
+	return 0;
+}
+
+long catalog_find_city(const char *city) {
+	reader_slot_t *reader = thread_reader();
+	// Counted before the pointer is read, so a reload swapping it in between waits for this lookup.
+	atomic_fetch_add(&reader->active, 1);
+	const city_index_t *index = atomic_load(&active_index);
+	const long found = city_index_find(index, city);
+	atomic_fetch_sub_explicit(&reader->active, 1, memory_order_release);
+	return found;
+}
+
+size_t catalog_city_count(void) {
+	reader_slot_t *reader = thread_reader();
+	atomic_fetch_add(&reader->active, 1);
+	const size_t count = atomic_load(&active_index)->count;
+	atomic_fetch_sub_explicit(&reader->active, 1, memory_order_release);
+	return count;
+}
+
+unsigned int catalog_generation(void) {
+	return atomic_load_explicit(&generation, memory_order_acquire);
+}
+
+#if !defined WIN32
+static void on_reload_signal(int signal_number) {
+	(void)signal_number;
+	atomic_store(&reload_pending, 1);
+}
+#endif
+
+void catalog_install_reload_handler(void) {
+#if !defined WIN32
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_reload_signal;
+	sigemptyset(&action.sa_mask);
+	// Restart blocking socket calls so a reload never fails an in-flight request.
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGHUP, &action, NULL);
+#endif
+}
+
+void catalog_poll_reload(void) {
+	if (atomic_load_explicit(&retired_pending, memory_order_relaxed) != 0 && !atomic_flag_test_and_set(&reload_lock)) {
+		if (retired_index != NULL) {
+			catalog_collect();
+		}
+		atomic_flag_clear(&reload_lock);
+	}
+
+	// Cheap check on every loop iteration; only one thread wins the exchange and reloads.
+	if (atomic_load_explicit(&reload_pending, memory_order_relaxed) == 0
+			|| atomic_exchange(&reload_pending, 0) == 0) {
+		return;
+	}
+
+	if (catalog_path == NULL) {
+		fprintf(stderr, "SIGHUP ricevuto ma nessun catalogo (-c) da ricaricare\n");
+		return;
+	}
+
+	if (atomic_flag_test_and_set(&reload_lock)) {
+		// Another thread is mid-reload: leave the request for the next poll.
+		atomic_store(&reload_pending, 1);
+		return;
+	}
+	if (retired_index != NULL) {
+		// Lookups may still read the previous catalog: reload once it is freed.
+		atomic_store(&reload_pending, 1);
+		atomic_flag_clear(&reload_lock);
+		return;
+	}
+
+	city_index_t *index = catalog_open(catalog_path, NULL, 0);
+	if (index == NULL) {
+		fprintf(stderr, "Ricaricamento del catalogo %s non riuscito, mantengo il precedente\n", catalog_path);
+	} else {
+		catalog_swap(index);
+		fprintf(stderr, "Catalogo %s ricaricato: %u città\n", catalog_path, index->count);
+	}
+
+	atomic_flag_clear(&reload_lock);
+}
@@ -0,0 +1,31 @@
+/*
+ * catalog.h
+ *
+ * Active city catalog
+ * Holds the city index every request is validated against: either the
+ * built-in list or a memory-mapped catalog file (-c), which SIGHUP reloads
+ * and swaps in atomically while connections keep being served.
+ */
+
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <stddef.h>
+
+// Loads path (or the built-in names when path is NULL) as the active catalog.
+int catalog_load(const char *path, const char *const *builtin_names, size_t builtin_count);
+
+// Returns the index of city in the active catalog, or -1.
+long catalog_find_city(const char *city);
+
+// Number of cities in the active catalog.
+size_t catalog_city_count(void);
+
+// Incremented every time a new catalog is swapped in (city indexes change).
+unsigned int catalog_generation(void);
+
+// SIGHUP only flags a reload; event loops call catalog_poll_reload() to perform it.
+void catalog_install_reload_handler(void);
+void catalog_poll_reload(void);
+
+#endif /* CATALOG_H_ */
@@ -0,0 +1,312 @@
+/*
+ * city_index.c
+ *
+ * Case-insensitive city lookup
+ *
+ * Names are folded to lowercase once, when the index is built. A query is
+ * folded through a 256-byte table while it is hashed, then compared against
+ * the stored folded names only when the hash and length already match.
+ *
+ * Catalog files are the same tables behind a small header; mapping one only
+ * checks that every offset stays inside the file before it is used.
+ */
+
+#define _GNU_SOURCE
+
+#include "city_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+// ASCII case folding without per-character tolower() calls (C locale semantics).
+static const unsigned char FOLD[256] = {
+#define F4(c) (c), (c) + 1, (c) + 2, (c) + 3
+#define F16(c) F4(c), F4((c) + 4), F4((c) + 8), F4((c) + 12)
+	F16(0x00), F16(0x10), F16(0x20), F16(0x30),
+	0x40, F4(0x61), F4(0x65), F4(0x69), F4(0x6d), F4(0x71), F4(0x75), 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+	F16(0x60), F16(0x70),
+	F16(0x80), F16(0x90), F16(0xa0), F16(0xb0),
+	F16(0xc0), F16(0xd0), F16(0xe0), F16(0xf0)
+#undef F16
+#undef F4
+};
+
+uint32_t city_hash(const char *name, size_t *out_length) {
+	const unsigned char *bytes = (const unsigned char *)name;
+	uint32_t hash = FNV_OFFSET_BASIS;
+	size_t length = 0;
+	for (; bytes[length] != '\0'; ++length) {
+		hash ^= FOLD[bytes[length]];
+		hash *= FNV_PRIME;
+	}
+	if (out_length != NULL) {
+		*out_length = length;
+	}
+	return hash;
+}
+
+int city_index_build(city_index_t *index, const char *const *names, size_t count) {
+	if (index == NULL || names == NULL || count == 0 || count > UINT32_MAX / 4) {
+		return -1;
+	}
+
+	// Keep the load factor at or below one half so probe chains stay short.
+	size_t bucket_count = 1;
+	while (bucket_count < count * 2) {
+		bucket_count <<= 1;
+	}
+
+	size_t pool_size = 0;
+	for (size_t i = 0; i < count; ++i) {
+		pool_size += strlen(names[i]) + 1;
+	}
+
+	// One allocation for buckets, entries and the name pool keeps the index contiguous.
+	const size_t buckets_size = bucket_count * sizeof(uint32_t);
+	const size_t entries_size = count * sizeof(city_entry_t);
+	char *storage = calloc(1, buckets_size + entries_size + pool_size);
+	if (storage == NULL) {
+		return -1;
+	}
+
+	uint32_t *buckets = (uint32_t *)storage;
+	city_entry_t *entries = (city_entry_t *)(storage + buckets_size);
+	char *pool = storage + buckets_size + entries_size;
+
+	size_t pool_used = 0;
+	for (size_t i = 0; i < count; ++i) {
+		size_t length = 0;
+		entries[i].hash = city_hash(names[i], &length);
+		entries[i].name_offset = (uint32_t)pool_used;
+		entries[i].name_length = (uint32_t)length;
+		for (size_t c = 0; c < length; ++c) {
+			pool[pool_used + c] = (char)FOLD[(unsigned char)names[i][c]];
+		}
+		pool_used += length + 1;
+
+		size_t slot = entries[i].hash & (bucket_count - 1);
+		while (buckets[slot] != 0) {
+			slot = (slot + 1) & (bucket_count - 1);
+		}
+		buckets[slot] = (uint32_t)(i + 1);
+	}
+
+	index->count = (uint32_t)count;
+	index->bucket_mask = (uint32_t)(bucket_count - 1);
+	index->buckets = buckets;
+	index->entries = entries;
+	index->names = pool;
+	index->storage = storage;
+	return 0;
+}
+
+void city_index_free(city_index_t *index) {
+	if (index == NULL) {
+		return;
+	}
+	free(index->storage);
+#if !defined WIN32
+	if (index->mapping != NULL) {
+		munmap(index->mapping, index->mapping_length);
+	}
+#else
+	free(index->mapping);
+#endif
+	memset(index, 0, sizeof(*index));
+}
+
+int city_index_save(const city_index_t *index, const char *path) {
+	if (index == NULL || index->buckets == NULL || path == NULL) {
+		return -1;
+	}
+
+	const uint32_t bucket_count = index->bucket_mask + 1;
+	const city_entry_t *last = &index->entries[index->count - 1];
+	const uint32_t names_size = last->name_offset + last->name_length + 1;
+
+	city_catalog_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CITY_CATALOG_MAGIC, sizeof(header.magic));
+	header.version = CITY_CATALOG_VERSION;
+	header.count = index->count;
+	header.bucket_count = bucket_count;
+	header.buckets_offset = (uint32_t)sizeof(header);
+	header.entries_offset = header.buckets_offset + bucket_count * (uint32_t)sizeof(uint32_t);
+	header.names_offset = header.entries_offset + index->count * (uint32_t)sizeof(city_entry_t);
+	header.names_size = names_size;
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) {
+		return -1;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, out) == 1
+			&& fwrite(index->buckets, sizeof(uint32_t), bucket_count, out) == bucket_count
+			&& fwrite(index->entries, sizeof(city_entry_t), index->count, out) == index->count
+			&& fwrite(index->names, 1, names_size, out) == names_size;
+	if (fclose(out) != 0) {
+		ok = 0;
+	}
+	return ok ? 0 : -1;
+}
+
+// Rejects catalogs whose tables would make lookups read outside the file.
+static int catalog_is_valid(const unsigned char *data, size_t length) {
+	if (length < sizeof(city_catalog_header_t)) {
+		return 0;
+	}
+
+	city_catalog_header_t header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, CITY_CATALOG_MAGIC, sizeof(header.magic)) != 0 || header.version != CITY_CATALOG_VERSION) {
+		return 0;
+	}
+	if (header.count == 0 || header.bucket_count < header.count
+			|| (header.bucket_count & (header.bucket_count - 1)) != 0) {
+		return 0;
+	}
+
+	const uint64_t buckets_end = (uint64_t)header.buckets_offset + (uint64_t)header.bucket_count * sizeof(uint32_t);
+	const uint64_t entries_end = (uint64_t)header.entries_offset + (uint64_t)header.count * sizeof(city_entry_t);
+	const uint64_t names_end = (uint64_t)header.names_offset + header.names_size;
+	if (header.buckets_offset % sizeof(uint32_t) != 0 || header.entries_offset % sizeof(uint32_t) != 0
+			|| buckets_end > length || entries_end > length || names_end > length || header.names_size == 0) {
+		return 0;
+	}
+
+	const uint32_t *buckets = (const uint32_t *)(data + header.buckets_offset);
+	uint32_t empty = 0;
+	for (uint32_t i = 0; i < header.bucket_count; ++i) {
+		if (buckets[i] > header.count) {
+			return 0;
+		}
+		empty += buckets[i] == 0;
+	}
+	// Lookups stop at an empty bucket, so at least one must exist.
+	if (empty == 0) {
+		return 0;
+	}
+
+	const city_entry_t *entries = (const city_entry_t *)(data + header.entries_offset);
+	const char *names = (const char *)(data + header.names_offset);
+	for (uint32_t i = 0; i < header.count; ++i) {
+		const uint64_t end = (uint64_t)entries[i].name_offset + entries[i].name_length;
+		if (end >= header.names_size || names[end] != '\0') {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int city_index_map(city_index_t *index, const char *path) {
+	if (index == NULL || path == NULL) {
+		return -1;
+	}
+
+	unsigned char *data = NULL;
+	size_t length = 0;
+
+#if !defined WIN32
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat info;
+	if (fstat(fd, &info) < 0 || info.st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+	length = (size_t)info.st_size;
+	int map_flags = MAP_PRIVATE;
+#if defined MAP_POPULATE
+	// Fault the whole catalog in now rather than on the first lookups.
+	map_flags |= MAP_POPULATE;
+#endif
+	void *mapping = mmap(NULL, length, PROT_READ, map_flags, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return -1;
+	}
+	data = mapping;
+#else
+	// No mmap(): read the file once into a single heap block with the same layout.
+	FILE *in = fopen(path, "rb");
+	if (in == NULL) {
+		return -1;
+	}
+	if (fseek(in, 0, SEEK_END) != 0 || ftell(in) <= 0) {
+		fclose(in);
+		return -1;
+	}
+	length = (size_t)ftell(in);
+	rewind(in);
+	data = malloc(length);
+	if (data == NULL || fread(data, 1, length, in) != length) {
+		free(data);
+		fclose(in);
+		return -1;
+	}
+	fclose(in);
+#endif
+
+	if (!catalog_is_valid(data, length)) {
+#if !defined WIN32
+		munmap(data, length);
+#else
+		free(data);
+#endif
+		return -1;
+	}
+
+	city_catalog_header_t header;
+	memcpy(&header, data, sizeof(header));
+	memset(index, 0, sizeof(*index));
+	index->count = header.count;
+	index->bucket_mask = header.bucket_count - 1;
+	index->buckets = (const uint32_t *)(data + header.buckets_offset);
+	index->entries = (const city_entry_t *)(data + header.entries_offset);
+	index->names = (const char *)(data + header.names_offset);
+	index->mapping = data;
+	index->mapping_length = length;
+	return 0;
+}
+
+long city_index_find(const city_index_t *index, const char *city) {
+	if (index == NULL || index->buckets == NULL || city == NULL) {
+		return -1;
+	}
+
+	size_t length = 0;
+	const uint32_t hash = city_hash(city, &length);
+	uint32_t slot = hash & index->bucket_mask;
+	while (index->buckets[slot] != 0) {
+		const uint32_t entry_index = index->buckets[slot] - 1;
+		const city_entry_t *entry = &index->entries[entry_index];
+		if (entry->hash == hash && entry->name_length == length) {
+			const unsigned char *query = (const unsigned char *)city;
+			const char *stored = index->names + entry->name_offset;
+			size_t c = 0;
+			while (c < length && FOLD[query[c]] == (unsigned char)stored[c]) {
+				++c;
+			}
+			if (c == length) {
+				return (long)entry_index;
+			}
+		}
+		slot = (slot + 1) & index->bucket_mask;
+	}
+
+	return -1;
+}
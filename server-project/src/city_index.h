@@ -0,0 +1,64 @@
+/*
+ * city_index.h
+ *
+ * Case-insensitive city lookup
+ * Open-addressing hash index over case-folded city names. Lookup cost is
+ * one hash pass over the query plus (almost always) a single comparison,
+ * independent of the number of cities.
+ *
+ * The same layout is stored on disk as a city catalog, so a catalog file
+ * can be memory-mapped and queried in place without parsing.
+ */
+
+#ifndef CITY_INDEX_H_
+#define CITY_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t hash;        // Hash of the case-folded name
+	uint32_t name_offset; // Offset of the folded, NUL-terminated name in the pool
+	uint32_t name_length; // Name length in bytes, without the terminator
+} city_entry_t;
+
+#define CITY_CATALOG_MAGIC "WCAT"
+#define CITY_CATALOG_VERSION 1
+
+// On-disk catalog header; every section offset is relative to the file start.
+typedef struct {
+	char magic[4];           // CITY_CATALOG_MAGIC
+	uint32_t version;        // CITY_CATALOG_VERSION
+	uint32_t count;          // Number of entries
+	uint32_t bucket_count;   // Power of two
+	uint32_t buckets_offset; // uint32_t[bucket_count]
+	uint32_t entries_offset; // city_entry_t[count]
+	uint32_t names_offset;   // Folded name pool
+	uint32_t names_size;     // Pool size in bytes
+} city_catalog_header_t;
+
+typedef struct {
+	uint32_t count;              // Number of cities
+	uint32_t bucket_mask;        // Bucket count - 1 (bucket count is a power of two)
+	const uint32_t *buckets;     // Entry index + 1, 0 marks an empty bucket
+	const city_entry_t *entries;
+	const char *names;           // Pool of folded names
+	void *storage;               // Heap block owned by the index, NULL if borrowed
+	void *mapping;               // Mapped catalog file owned by the index, or NULL
+	size_t mapping_length;
+} city_index_t;
+
+// Case-folding hash shared by the index builder and lookups.
+uint32_t city_hash(const char *name, size_t *out_length);
+
+int city_index_build(city_index_t *index, const char *const *names, size_t count);
+void city_index_free(city_index_t *index);
+
+// Writes index as a catalog file, or maps one and validates it (no copies, no parsing).
+int city_index_save(const city_index_t *index, const char *path);
+int city_index_map(city_index_t *index, const char *path);
+
+// Returns the entry index of city, or -1 when it is not in the index.
+long city_index_find(const city_index_t *index, const char *city);
+
+#endif /* CITY_INDEX_H_ */
@@ -0,0 +1,219 @@
+/*
+ * datagram.c
+ *
+ * UDP query loop
+ *
+ * A query is one datagram and its answer is one datagram: no handshake, no
+ * teardown and no per-client state. Each thread blocks in recvmmsg() until
+ * at least one datagram arrives, takes whatever else is already queued (up
+ * to DATAGRAM_BATCH), answers every frame through process_request_frame()
+ * and hands all the replies to a single sendmmsg().
+ *
+ * A datagram must hold exactly one frame (compact, legacy or batch); a
+ * truncated, trailing-garbage or malformed datagram is dropped without an
+ * answer, as is a query over the sender's --ip-rate budget, and the client
+ * retries. History queries and subscriptions are TCP-only and dropped
+ * unanswered: a history answer is many times its query and scans the whole
+ * sample table. A compact query shorter than its WIRE_RESPONSE_SIZE answer
+ * (a city of up to three bytes) is dropped too, and every answer is checked
+ * against its query before it is queued, so no answer is larger than its
+ * query and the service cannot be used to amplify spoofed traffic.
+ */
+
+#define _GNU_SOURCE
+
+#include "datagram.h"
+#include "catalog.h"
+#include "cache.h"
+#include "admission.h"
+#include "metrics.h"
+#include "rng.h"
+#include "wire.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define DATAGRAM_BATCH 64 // Datagrams moved per recvmmsg()/sendmmsg()
+
+typedef struct {
+	int index;
+	int socket;
+	pthread_t thread;
+	struct mmsghdr rx_msgs[DATAGRAM_BATCH];
+	struct mmsghdr tx_msgs[DATAGRAM_BATCH];
+	struct iovec rx_iov[DATAGRAM_BATCH];
+	struct iovec tx_iov[DATAGRAM_BATCH];
+	struct sockaddr_in peers[DATAGRAM_BATCH];
+	char rx_buf[DATAGRAM_BATCH][MAX_REQUEST_FRAME_SIZE];
+	char tx_buf[DATAGRAM_BATCH][MAX_RESPONSE_FRAME_SIZE];
+} datagram_worker_t;
+
+static void arm_receive(datagram_worker_t *worker) {
+	for (int i = 0; i < DATAGRAM_BATCH; ++i) {
+		worker->rx_iov[i].iov_base = worker->rx_buf[i];
+		worker->rx_iov[i].iov_len = sizeof(worker->rx_buf[i]);
+		memset(&worker->rx_msgs[i], 0, sizeof(worker->rx_msgs[i]));
+		worker->rx_msgs[i].msg_hdr.msg_name = &worker->peers[i];
+		worker->rx_msgs[i].msg_hdr.msg_namelen = sizeof(worker->peers[i]);
+		worker->rx_msgs[i].msg_hdr.msg_iov = &worker->rx_iov[i];
+		worker->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+// Whether a datagram of length bytes holds exactly one well-formed frame UDP answers.
+static int datagram_acceptable(const char *data, size_t length) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	if (length < WIRE_RESPONSE_SIZE) {
+		return 0;
+	}
+	if (wire_is_compact(bytes, length)) {
+		// request_frame_length() takes a malformed header whole, to answer it on a stream.
+		return !wire_is_history(bytes, length) && !wire_is_subscribe(bytes, length)
+				&& wire_request_length(bytes, length) == (long)length;
+	}
+	if (data[0] == REQUEST_TYPE_BATCH && length >= sizeof(weather_batch_request_t)) {
+		const unsigned char count = bytes[1];
+		if (count == 0 || count > MAX_BATCH_ITEMS) {
+			return 0;
+		}
+	}
+	return request_frame_length(data, length) == length;
+}
+
+// Answers the received datagrams; returns the number of replies queued in tx_msgs.
+static unsigned int answer_batch(datagram_worker_t *worker, unsigned int received) {
+	unsigned int replies = 0;
+
+	for (unsigned int i = 0; i < received; ++i) {
+		const struct msghdr *hdr = &worker->rx_msgs[i].msg_hdr;
+		const size_t length = worker->rx_msgs[i].msg_len;
+		metrics_count_recv(length, 0);
+
+		if ((hdr->msg_flags & MSG_TRUNC) || hdr->msg_namelen != sizeof(struct sockaddr_in)
+				|| !datagram_acceptable(worker->rx_buf[i], length)
+				|| !admission_allow_datagram(worker->peers[i].sin_addr.s_addr)) {
+			continue;
+		}
+
+		const char *reply = NULL;
+		size_t reply_length = 0;
+		process_request_frame(worker->rx_buf[i], length, worker->peers[i].sin_addr.s_addr,
+				worker->tx_buf[replies], &reply, &reply_length);
+		if (reply_length > length) {
+			continue;
+		}
+
+		// Error answers go out straight from their read-only templates.
+		worker->tx_iov[replies].iov_base = (void *)reply;
+		worker->tx_iov[replies].iov_len = reply_length;
+		memset(&worker->tx_msgs[replies], 0, sizeof(worker->tx_msgs[replies]));
+		worker->tx_msgs[replies].msg_hdr.msg_name = &worker->peers[i];
+		worker->tx_msgs[replies].msg_hdr.msg_namelen = sizeof(worker->peers[i]);
+		worker->tx_msgs[replies].msg_hdr.msg_iov = &worker->tx_iov[replies];
+		worker->tx_msgs[replies].msg_hdr.msg_iovlen = 1;
+		++replies;
+	}
+
+	return replies;
+}
+
+static void send_batch(datagram_worker_t *worker, unsigned int replies) {
+	unsigned int done = 0;
+
+	while (done < replies) {
+		int sent = sendmmsg(worker->socket, &worker->tx_msgs[done], replies - done, MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Full socket buffer or unreachable peer: drop this reply, the client retries.
+			++done;
+			continue;
+		}
+		for (int i = 0; i < sent; ++i) {
+			const size_t length = worker->tx_iov[done + (unsigned int)i].iov_len;
+			metrics_count_send(length, length);
+		}
+		done += (unsigned int)sent;
+	}
+}
+
+static void *datagram_main(void *arg) {
+	datagram_worker_t *worker = arg;
+	// Streams after the TCP workers' ones, so -S runs stay reproducible.
+	rng_thread_init((unsigned int)(MAX_WORKERS + worker->index));
+
+	while (1) {
+		arm_receive(worker);
+		int received = recvmmsg(worker->socket, worker->rx_msgs, DATAGRAM_BATCH, MSG_WAITFORONE, NULL);
+		catalog_poll_reload();
+		weather_cache_poll_report();
+		if (received < 0) {
+			if (errno != EINTR) {
+				perror("recvmmsg() fallita");
+			}
+			continue;
+		}
+
+		const uint64_t started_ns = metrics_now_ns();
+		const unsigned int replies = answer_batch(worker, (unsigned int)received);
+		send_batch(worker, replies);
+
+		const uint64_t elapsed_ns = metrics_now_ns() - started_ns;
+		for (unsigned int i = 0; i < replies; ++i) {
+			metrics_observe_latency(elapsed_ns);
+		}
+	}
+
+	return NULL;
+}
+
+int datagram_available(void) {
+	return 1;
+}
+
+int datagram_start(const server_config_t *config) {
+	const int count = config->workers;
+	for (int i = 0; i < count; ++i) {
+		// Never freed: the threads serve until the process exits.
+		datagram_worker_t *worker = calloc(1, sizeof(*worker));
+		if (worker == NULL) {
+			fprintf(stderr, "Memoria insufficiente per il thread UDP %d\n", i);
+			return -1;
+		}
+		worker->index = i;
+		worker->socket = create_datagram_socket(config);
+
+		int result = pthread_create(&worker->thread, NULL, datagram_main, worker);
+		if (result != 0) {
+			fprintf(stderr, "pthread_create() fallita: %s\n", strerror(result));
+			close(worker->socket);
+			free(worker);
+			return -1;
+		}
+		pthread_detach(worker->thread);
+	}
+
+	return 0;
+}
+
+#else
+
+int datagram_available(void) {
+	return 0;
+}
+
+int datagram_start(const server_config_t *config) {
+	(void)config;
+	return -1;
+}
+
+#endif
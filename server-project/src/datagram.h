@@ -0,0 +1,21 @@
+/*
+ * datagram.h
+ *
+ * UDP query loop
+ * Answers single-datagram queries next to the TCP listener, reading and
+ * writing batches of datagrams per system call (Linux only).
+ */
+
+#ifndef DATAGRAM_H_
+#define DATAGRAM_H_
+
+#include "protocol.h"
+
+// Returns 1 when the UDP mode is compiled in for this platform.
+int datagram_available(void);
+
+// Binds config->workers UDP sockets on config->port and serves each one on
+// its own thread; returns -1 if a thread could not be started.
+int datagram_start(const server_config_t *config);
+
+#endif /* DATAGRAM_H_ */
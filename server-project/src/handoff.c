@@ -0,0 +1,390 @@
+/*
+ * handoff.c
+ *
+ * Hot restart
+ *
+ * The control socket is a Unix SOCK_SEQPACKET socket, so every message
+ * keeps its boundaries and its descriptors. The running server answers a
+ * connection with its listening sockets, HANDOFF_BATCH per message: one
+ * flag byte (more to come or last) followed by the kind of each attached
+ * descriptor. The new server replies with a single byte once it is about
+ * to serve, and only that byte makes the old server stop accepting; until
+ * then both accept from the same queues, so no connection is lost either
+ * way.
+ *
+ * The old server's event loops learn about the handoff from a pipe that
+ * gets one byte written and is never read, so it stays readable for every
+ * loop of every worker.
+ */
+
+#define _GNU_SOURCE
+
+#include "handoff.h"
+#include "protocol.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#define HANDOFF_MAX_SOCKETS (MAX_WORKERS * 2 + 1) // TCP and UDP per worker, admin
+#define HANDOFF_BATCH 64          // Descriptors per message, below the kernel's SCM_MAX_FD
+#define HANDOFF_TIMEOUT_MS 5000   // Longest wait for the running server's sockets
+#define HANDOFF_READY 'R'
+
+typedef struct {
+	int fd;
+	handoff_kind_t kind;
+	int taken;
+} handoff_socket_t;
+
+static handoff_socket_t registered[HANDOFF_MAX_SOCKETS]; // Passed on by the next handoff
+static size_t registered_count;
+static pthread_mutex_t registered_lock = PTHREAD_MUTEX_INITIALIZER; // Held while the handoff thread reads registered
+static handoff_socket_t received[HANDOFF_MAX_SOCKETS];   // Received at startup
+static size_t received_count;
+static int previous_server = -1;     // Control connection to the server being replaced
+static int control_socket = -1;
+static int wake_pipe[2] = { -1, -1 };
+static atomic_int draining;
+
+static int control_address(const char *path, struct sockaddr_un *address) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	const size_t length = strlen(path);
+	if (length == 0 || length >= sizeof(address->sun_path)) {
+		fprintf(stderr, "Percorso di --handoff troppo lungo: %s\n", path);
+		return -1;
+	}
+	memcpy(address->sun_path, path, length + 1);
+	return 0;
+}
+
+static void close_received(void) {
+	for (size_t i = 0; i < received_count; ++i) {
+		if (!received[i].taken) {
+			close(received[i].fd);
+		}
+	}
+	received_count = 0;
+}
+
+// Sends every registered socket to peer.
+static int send_sockets(int peer) {
+	size_t sent = 0;
+	do {
+		const size_t batch = registered_count - sent < HANDOFF_BATCH ? registered_count - sent : HANDOFF_BATCH;
+		unsigned char data[1 + HANDOFF_BATCH];
+		int fds[HANDOFF_BATCH];
+		data[0] = sent + batch < registered_count;
+		for (size_t i = 0; i < batch; ++i) {
+			data[1 + i] = (unsigned char)registered[sent + i].kind;
+			fds[i] = registered[sent + i].fd;
+		}
+
+		union {
+			char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+			struct cmsghdr align;
+		} control;
+		memset(&control, 0, sizeof(control));
+		struct iovec iov = { data, 1 + batch };
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		if (batch > 0) {
+			message.msg_control = control.buffer;
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * batch);
+			struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(int) * batch);
+			memcpy(CMSG_DATA(header), fds, sizeof(int) * batch);
+		}
+		if (sendmsg(peer, &message, MSG_NOSIGNAL) < 0) {
+			perror("sendmsg() fallita");
+			return -1;
+		}
+		sent += batch;
+	} while (sent < registered_count);
+	return 0;
+}
+
+static void *handoff_main(void *arg) {
+	(void)arg;
+	while (1) {
+		int peer = accept(control_socket, NULL, NULL);
+		if (peer < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				perror("accept() sul socket di handoff fallita");
+				return NULL;
+			}
+			continue;
+		}
+
+		// The listening sockets only go to a server run by the same user.
+		struct ucred credentials;
+		socklen_t credentials_length = sizeof(credentials);
+		if (getsockopt(peer, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) < 0
+				|| credentials.uid != getuid()) {
+			fprintf(stderr, "Handoff rifiutato: il nuovo server appartiene a un altro utente\n");
+			close(peer);
+			continue;
+		}
+
+		// Blocks until the new server is ready; it closing first means it failed.
+		char ready = 0;
+		pthread_mutex_lock(&registered_lock);
+		const int sent = send_sockets(peer);
+		pthread_mutex_unlock(&registered_lock);
+		if (sent == 0 && recv(peer, &ready, 1, 0) == 1 && ready == HANDOFF_READY) {
+			printf("Socket passati al nuovo server, chiusura dopo le connessioni aperte\n");
+			fflush(stdout);
+			atomic_store(&draining, 1);
+			const char wake = 1;
+			if (write(wake_pipe[1], &wake, 1) < 0) {
+				perror("write() fallita");
+			}
+			close(peer);
+			close(control_socket);
+			control_socket = -1;
+			return NULL;
+		}
+		fprintf(stderr, "Nuovo server non avviato, continuo a servire\n");
+		close(peer);
+	}
+}
+
+int handoff_available(void) {
+	return 1;
+}
+
+int handoff_receive(const char *path) {
+	struct sockaddr_un address;
+	if (control_address(path, &address) < 0) {
+		return -1;
+	}
+	int peer = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (peer < 0) {
+		perror("socket() fallita");
+		return -1;
+	}
+	if (connect(peer, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		const int error = errno;
+		close(peer);
+		if (error == ENOENT || error == ECONNREFUSED) {
+			// No server, or the socket file of one that is gone.
+			return 0;
+		}
+		errno = error;
+		perror("connect() al socket di handoff fallita");
+		return -1;
+	}
+
+	struct timeval timeout = { HANDOFF_TIMEOUT_MS / 1000, 0 };
+	setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	int more = 1;
+	while (more) {
+		unsigned char data[1 + HANDOFF_BATCH];
+		union {
+			char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+			struct cmsghdr align;
+		} control;
+		struct iovec iov = { data, sizeof(data) };
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+
+		const ssize_t length = recvmsg(peer, &message, MSG_CMSG_CLOEXEC);
+		if (length <= 0) {
+			break;
+		}
+		size_t fd_count = 0;
+		int fds[HANDOFF_BATCH];
+		for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)) {
+			if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+				fd_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				memcpy(fds, CMSG_DATA(header), fd_count * sizeof(int));
+			}
+		}
+
+		const size_t kinds = (size_t)length - 1;
+		for (size_t i = 0; i < fd_count; ++i) {
+			if (i >= kinds || received_count == HANDOFF_MAX_SOCKETS || (message.msg_flags & MSG_CTRUNC)) {
+				close(fds[i]);
+				continue;
+			}
+			received[received_count].fd = fds[i];
+			received[received_count].kind = (handoff_kind_t)data[1 + i];
+			received[received_count].taken = 0;
+			++received_count;
+		}
+		if (fd_count != kinds || (message.msg_flags & MSG_CTRUNC)) {
+			break;
+		}
+		more = data[0];
+	}
+
+	if (more) {
+		close_received();
+		close(peer);
+		return -1;
+	}
+	previous_server = peer;
+	return 1;
+}
+
+int handoff_take(handoff_kind_t kind, unsigned short port) {
+	for (size_t i = 0; i < received_count; ++i) {
+		if (received[i].taken || received[i].kind != kind) {
+			continue;
+		}
+		// Sockets bound elsewhere belong to an old configuration and are left to be closed.
+		struct sockaddr_in address;
+		socklen_t length = sizeof(address);
+		if (getsockname(received[i].fd, (struct sockaddr *)&address, &length) == 0
+				&& address.sin_family == AF_INET && ntohs(address.sin_port) == port) {
+			received[i].taken = 1;
+			return received[i].fd;
+		}
+	}
+	return -1;
+}
+
+void handoff_register(handoff_kind_t kind, int fd) {
+	pthread_mutex_lock(&registered_lock);
+	if (registered_count < HANDOFF_MAX_SOCKETS) {
+		registered[registered_count].fd = fd;
+		registered[registered_count].kind = kind;
+		registered[registered_count].taken = 0;
+		++registered_count;
+	}
+	pthread_mutex_unlock(&registered_lock);
+}
+
+void handoff_unregister(int fd) {
+	pthread_mutex_lock(&registered_lock);
+	for (size_t i = 0; i < registered_count; ++i) {
+		if (registered[i].fd == fd) {
+			registered[i] = registered[--registered_count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&registered_lock);
+}
+
+int handoff_start(const char *path) {
+	// The old server would close these when it exits; queued connections on them are lost.
+	close_received();
+
+	int result = 0;
+	if (path != NULL) {
+		struct sockaddr_un address;
+		result = control_address(path, &address);
+		if (result == 0 && pipe(wake_pipe) < 0) {
+			perror("pipe() fallita");
+			result = -1;
+		}
+		if (result == 0) {
+			// Replaces the socket file of the previous server, which no longer needs it.
+			unlink(path);
+			control_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+			if (control_socket < 0 || bind(control_socket, (struct sockaddr *)&address, sizeof(address)) < 0
+					|| listen(control_socket, 1) < 0) {
+				perror("bind() del socket di handoff fallita");
+				result = -1;
+			}
+		}
+		pthread_t thread;
+		if (result == 0 && pthread_create(&thread, NULL, handoff_main, NULL) != 0) {
+			fprintf(stderr, "pthread_create() fallita per il socket di handoff\n");
+			result = -1;
+		}
+		if (result == 0) {
+			pthread_detach(thread);
+		} else {
+			fprintf(stderr, "Riavvio a caldo non disponibile\n");
+			if (control_socket >= 0) {
+				close(control_socket);
+				control_socket = -1;
+			}
+			for (int i = 0; i < 2; ++i) {
+				if (wake_pipe[i] >= 0) {
+					close(wake_pipe[i]);
+					wake_pipe[i] = -1;
+				}
+			}
+		}
+	}
+
+	if (previous_server >= 0) {
+		const char ready = HANDOFF_READY;
+		if (send(previous_server, &ready, 1, MSG_NOSIGNAL) != 1) {
+			perror("send() al server precedente fallita");
+		}
+		close(previous_server);
+		previous_server = -1;
+	}
+	return result;
+}
+
+int handoff_wake_fd(void) {
+	return wake_pipe[0];
+}
+
+int handoff_draining(void) {
+	return atomic_load(&draining);
+}
+
+#else
+
+int handoff_available(void) {
+	return 0;
+}
+
+int handoff_receive(const char *path) {
+	(void)path;
+	return 0;
+}
+
+int handoff_take(handoff_kind_t kind, unsigned short port) {
+	(void)kind;
+	(void)port;
+	return -1;
+}
+
+void handoff_register(handoff_kind_t kind, int fd) {
+	(void)kind;
+	(void)fd;
+}
+
+void handoff_unregister(int fd) {
+	(void)fd;
+}
+
+int handoff_start(const char *path) {
+	return path != NULL ? -1 : 0;
+}
+
+int handoff_wake_fd(void) {
+	return -1;
+}
+
+int handoff_draining(void) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * handoff.h
+ *
+ * Hot restart
+ * With --handoff path a server listens on a Unix socket at path. A new
+ * server started with the same path connects there first and receives the
+ * running server's listening sockets (TCP, UDP and admin) instead of
+ * binding its own, so connections waiting in the accept queues are never
+ * refused. Once the new server is ready to serve it says so; only then
+ * does the old one stop accepting, finish its open connections and exit.
+ * If the new server dies before that, the old one keeps serving (Linux
+ * only).
+ */
+
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+// Listening sockets that survive a restart
+typedef enum {
+	HANDOFF_TCP,
+	HANDOFF_UDP,
+	HANDOFF_ADMIN
+} handoff_kind_t;
+
+// Returns 1 when sockets can be handed over on this platform.
+int handoff_available(void);
+
+// Asks the server listening on path for its sockets. Returns 1 when they
+// were received, 0 when no server answered (a normal start) and -1 when
+// the exchange failed.
+int handoff_receive(const char *path);
+
+// Takes the next received socket of kind bound to port, or returns -1 when
+// there is none and the caller must bind a new one.
+int handoff_take(handoff_kind_t kind, unsigned short port);
+
+// Adds a listening socket to those the next handoff passes on.
+void handoff_register(handoff_kind_t kind, int fd);
+
+// Removes a registered socket about to be closed.
+void handoff_unregister(int fd);
+
+// Called once every listener is set up: closes the received sockets no
+// one took, tells the previous server it may drain, and listens on path
+// for the next restart. Returns -1 if path could not be bound; the server
+// then runs without hot restart.
+int handoff_start(const char *path);
+
+// Becomes readable once the sockets were handed to a new server: event
+// loops watch it to stop accepting. -1 when handoff_start() was not called.
+int handoff_wake_fd(void);
+
+// Set once the sockets were handed over and this process is draining.
+int handoff_draining(void);
+
+#endif /* HANDOFF_H_ */
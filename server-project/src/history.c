@@ -0,0 +1,378 @@
+/*
+ * history.c
+ *
+ * Weather sample history
+ *
+ * Every series is a pair of columns, timestamps and values, used as one
+ * ring: samples are appended in time order under the series lock, so the
+ * live part of the ring is sorted and a time window is found by binary
+ * search. The window (or each of its buckets) is then at most two
+ * contiguous runs of floats, folded by a branch-free pass with
+ * independent lanes that the compiler turns into SIMD min/max/add.
+ *
+ * Series are found through an open-addressing table keyed like the value
+ * cache, sized at init for every (city, type) pair of the catalog at half
+ * load. Claims stop at half load and no lookup probes more than
+ * MAX_PROBES slots, so a record on the request path stays a few cache
+ * lines even when the table cannot take more series. The all-cities query
+ * walks the list of claimed slots instead of the whole table.
+ */
+
+#define _GNU_SOURCE
+
+#include "history.h"
+#include "catalog.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_TABLE_BITS 10
+#define MAX_PROBES 32       // Slots a lookup looks at before giving up
+#define MIN_CAPACITY 16     // Keeps the value column a whole number of cache lines
+#define LANES 16            // Independent accumulators per pass
+#define BLOCK_SIZE 4096     // Values summed in single precision before the sum moves to double
+
+typedef struct {
+	atomic_flag lock;
+	unsigned int generation; // Catalog generation the samples belong to
+	uint64_t written;        // Samples ever appended; the newest is at (written - 1) & mask
+	uint64_t *times;         // Monotonic clock, milliseconds
+	float *values;
+} history_series_t;
+
+typedef struct {
+	uint64_t count;
+	double sum;
+	float min;
+	float max;
+} history_acc_t;
+
+static size_t capacity;
+static size_t mask;
+static unsigned int table_bits;
+static size_t table_size;
+static atomic_uint *keys;                     // city_index * WEATHER_TYPE_COUNT + type slot + 1, 0 when free
+static _Atomic(history_series_t *) *series_table;
+static atomic_uint *claimed;                  // Claimed slot + 1, in claim order; 0 until written
+static atomic_uint claimed_count;
+static atomic_ullong dropped;
+static atomic_flag drop_reported = ATOMIC_FLAG_INIT;
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static uint32_t make_key(long city_index, char type) {
+	const int slot = weather_type_index(type);
+	if (city_index < 0 || city_index >= (long)(UINT32_MAX / WEATHER_TYPE_COUNT) - 1 || slot < 0) {
+		return 0;
+	}
+	return (uint32_t)city_index * WEATHER_TYPE_COUNT + (uint32_t)slot + 1u;
+}
+
+static void series_lock(history_series_t *series) {
+	while (atomic_flag_test_and_set_explicit(&series->lock, memory_order_acquire)) {
+	}
+}
+
+static void series_unlock(history_series_t *series) {
+	atomic_flag_clear_explicit(&series->lock, memory_order_release);
+}
+
+static history_series_t *series_alloc(void) {
+	history_series_t *series = calloc(1, sizeof(*series));
+	if (series == NULL) {
+		return NULL;
+	}
+	series->times = malloc(capacity * sizeof(*series->times));
+	series->values = aligned_alloc(64, capacity * sizeof(*series->values));
+	if (series->times == NULL || series->values == NULL) {
+		free(series->times);
+		free(series->values);
+		free(series);
+		return NULL;
+	}
+	atomic_flag_clear(&series->lock);
+	series->generation = catalog_generation();
+	return series;
+}
+
+// Returns the series of key, claiming a table slot for it if create is set.
+// NULL when it does not exist, the table has no room for it or memory ran out.
+static history_series_t *find_series(uint32_t key, int create) {
+	size_t slot = (key * 2654435769u) >> (32 - table_bits);
+	for (size_t probe = 0; probe < MAX_PROBES; ++probe, slot = (slot + 1) & (table_size - 1)) {
+		unsigned int current = atomic_load_explicit(&keys[slot], memory_order_acquire);
+		if (current == 0) {
+			// Past half load probe sequences grow long: no more series are claimed.
+			if (!create || atomic_load_explicit(&claimed_count, memory_order_relaxed) >= table_size / 2) {
+				return NULL;
+			}
+			if (atomic_compare_exchange_strong(&keys[slot], &current, key)) {
+				// Until the pointer is published, samples for key are dropped.
+				history_series_t *series = series_alloc();
+				atomic_store_explicit(&series_table[slot], series, memory_order_release);
+				const unsigned int position = atomic_fetch_add(&claimed_count, 1);
+				atomic_store_explicit(&claimed[position], (unsigned int)slot + 1, memory_order_release);
+				return series;
+			}
+		}
+		if (current == key) {
+			return atomic_load_explicit(&series_table[slot], memory_order_acquire);
+		}
+	}
+	return NULL;
+}
+
+int history_init(unsigned int samples, size_t cities) {
+	capacity = 0;
+	mask = 0;
+	if (samples == 0) {
+		return 0;
+	}
+
+	table_bits = MIN_TABLE_BITS;
+	while (((size_t)1 << table_bits) < HISTORY_MAX_SERIES && ((size_t)1 << table_bits) / 2 < cities * WEATHER_TYPE_COUNT) {
+		++table_bits;
+	}
+	table_size = (size_t)1 << table_bits;
+	keys = calloc(table_size, sizeof(*keys));
+	series_table = calloc(table_size, sizeof(*series_table));
+	claimed = calloc(table_size, sizeof(*claimed));
+	if (keys == NULL || series_table == NULL || claimed == NULL) {
+		free(keys);
+		free(series_table);
+		free(claimed);
+		return -1;
+	}
+
+	capacity = MIN_CAPACITY;
+	while (capacity < samples) {
+		capacity <<= 1;
+	}
+	mask = capacity - 1;
+	return 0;
+}
+
+static void count_drop(void) {
+	atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+	if (!atomic_flag_test_and_set(&drop_reported)) {
+		fprintf(stderr, "Storico pieno: le nuove serie non vengono registrate (%zu serie)\n",
+				(size_t)atomic_load(&claimed_count));
+	}
+}
+
+void history_record(long city_index, char type, float value) {
+	if (capacity == 0) {
+		return;
+	}
+
+	const uint32_t key = make_key(city_index, type);
+	if (key == 0) {
+		return;
+	}
+	history_series_t *series = find_series(key, 1);
+	if (series == NULL) {
+		count_drop();
+		return;
+	}
+
+	const unsigned int generation = catalog_generation();
+	series_lock(series);
+	if (series->generation != generation) {
+		// The city index now names another city.
+		series->generation = generation;
+		series->written = 0;
+	}
+	// Stamped under the lock, so the ring stays in time order.
+	const size_t at = (size_t)series->written & mask;
+	series->times[at] = now_ms();
+	series->values[at] = value;
+	++series->written;
+	series_unlock(series);
+}
+
+static void acc_reset(history_acc_t *acc) {
+	acc->count = 0;
+	acc->sum = 0.0;
+	acc->min = INFINITY;
+	acc->max = -INFINITY;
+}
+
+static void acc_merge(history_acc_t *acc, const history_acc_t *other) {
+	acc->count += other->count;
+	acc->sum += other->sum;
+	acc->min = other->min < acc->min ? other->min : acc->min;
+	acc->max = other->max > acc->max ? other->max : acc->max;
+}
+
+// Folds values[0..count) into acc.
+static void accumulate(history_acc_t *acc, const float *values, size_t count) {
+	size_t i = 0;
+	while (count - i >= LANES) {
+		const size_t block_end = count - i > BLOCK_SIZE ? i + BLOCK_SIZE : count;
+		float lane_min[LANES];
+		float lane_max[LANES];
+		float lane_sum[LANES];
+		for (int lane = 0; lane < LANES; ++lane) {
+			lane_min[lane] = values[i + lane];
+			lane_max[lane] = values[i + lane];
+			lane_sum[lane] = values[i + lane];
+		}
+
+		for (i += LANES; block_end - i >= LANES; i += LANES) {
+			for (int lane = 0; lane < LANES; ++lane) {
+				const float value = values[i + lane];
+				lane_min[lane] = value < lane_min[lane] ? value : lane_min[lane];
+				lane_max[lane] = value > lane_max[lane] ? value : lane_max[lane];
+				lane_sum[lane] += value;
+			}
+		}
+
+		for (int lane = 0; lane < LANES; ++lane) {
+			acc->min = lane_min[lane] < acc->min ? lane_min[lane] : acc->min;
+			acc->max = lane_max[lane] > acc->max ? lane_max[lane] : acc->max;
+			acc->sum += lane_sum[lane];
+		}
+	}
+
+	for (; i < count; ++i) {
+		acc->min = values[i] < acc->min ? values[i] : acc->min;
+		acc->max = values[i] > acc->max ? values[i] : acc->max;
+		acc->sum += values[i];
+	}
+	acc->count += count;
+}
+
+// Folds logical samples [begin, end) of a ring whose oldest live sample is
+// logical 0 at absolute position oldest.
+static void accumulate_range(history_acc_t *acc, const history_series_t *series, uint64_t oldest, size_t begin, size_t end) {
+	if (begin >= end) {
+		return;
+	}
+	const size_t start = (size_t)(oldest + begin) & mask;
+	const size_t length = end - begin;
+	const size_t first = length < capacity - start ? length : capacity - start;
+	accumulate(acc, series->values + start, first);
+	accumulate(acc, series->values, length - first);
+}
+
+// First logical sample stamped at or after bound.
+static size_t lower_bound(const history_series_t *series, uint64_t oldest, size_t live, int64_t bound) {
+	size_t low = 0;
+	size_t high = live;
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		if ((int64_t)series->times[(size_t)(oldest + middle) & mask] < bound) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+typedef struct {
+	unsigned int generation;
+	int64_t from;              // Window start, may precede the clock's origin
+	uint64_t window_ms;
+	unsigned int points;
+	history_acc_t *buckets;    // points entries, or one for the whole window
+	uint64_t last_time;
+	float last;
+	int has_last;
+} history_scan_t;
+
+static void scan_series(history_series_t *series, history_scan_t *scan) {
+	series_lock(series);
+	if (series->generation == scan->generation && series->written > 0) {
+		const size_t live = series->written < capacity ? (size_t)series->written : capacity;
+		const uint64_t oldest = series->written - live;
+		size_t begin = lower_bound(series, oldest, live, scan->from);
+
+		if (begin < live) {
+			const size_t newest = (size_t)(series->written - 1) & mask;
+			if (!scan->has_last || series->times[newest] >= scan->last_time) {
+				scan->last_time = series->times[newest];
+				scan->last = series->values[newest];
+				scan->has_last = 1;
+			}
+		}
+
+		if (scan->points == 0) {
+			accumulate_range(&scan->buckets[0], series, oldest, begin, live);
+		} else {
+			for (unsigned int b = 0; b < scan->points && begin < live; ++b) {
+				const size_t end = b + 1 == scan->points ? live
+						: lower_bound(series, oldest, live, scan->from + (int64_t)(scan->window_ms * (b + 1) / scan->points));
+				accumulate_range(&scan->buckets[b], series, oldest, begin, end);
+				begin = end;
+			}
+		}
+	}
+	series_unlock(series);
+}
+
+void history_query(long city_index, char type, unsigned int window_s, unsigned int points, weather_history_t *out) {
+	history_acc_t buckets[MAX_HISTORY_POINTS];
+	history_scan_t scan;
+	memset(&scan, 0, sizeof(scan));
+	scan.points = points < MAX_HISTORY_POINTS ? points : MAX_HISTORY_POINTS;
+	scan.window_ms = (uint64_t)window_s * 1000u;
+	scan.from = (int64_t)now_ms() - (int64_t)scan.window_ms;
+	scan.generation = catalog_generation();
+	scan.buckets = buckets;
+	for (unsigned int b = 0; b < MAX_HISTORY_POINTS; ++b) {
+		acc_reset(&buckets[b]);
+	}
+
+	const int type_slot = weather_type_index(type);
+	if (capacity > 0 && type_slot >= 0) {
+		if (city_index >= 0) {
+			const uint32_t key = make_key(city_index, type);
+			history_series_t *series = key != 0 ? find_series(key, 0) : NULL;
+			if (series != NULL) {
+				scan_series(series, &scan);
+			}
+		} else {
+			const unsigned int count = atomic_load_explicit(&claimed_count, memory_order_acquire);
+			for (unsigned int position = 0; position < count; ++position) {
+				const unsigned int slot = atomic_load_explicit(&claimed[position], memory_order_acquire);
+				if (slot == 0 || (atomic_load_explicit(&keys[slot - 1], memory_order_relaxed) - 1) % WEATHER_TYPE_COUNT != (uint32_t)type_slot) {
+					continue;
+				}
+				history_series_t *series = atomic_load_explicit(&series_table[slot - 1], memory_order_acquire);
+				if (series != NULL) {
+					scan_series(series, &scan);
+				}
+			}
+		}
+	}
+
+	history_acc_t total;
+	acc_reset(&total);
+	for (unsigned int b = 0; b < (scan.points > 0 ? scan.points : 1); ++b) {
+		acc_merge(&total, &buckets[b]);
+	}
+
+	out->samples = total.count < UINT32_MAX ? (uint32_t)total.count : UINT32_MAX;
+	out->min = total.count > 0 ? total.min : 0.0f;
+	out->max = total.count > 0 ? total.max : 0.0f;
+	out->mean = total.count > 0 ? (float)(total.sum / (double)total.count) : 0.0f;
+	out->last = scan.has_last ? scan.last : 0.0f;
+	out->points = scan.points;
+	for (unsigned int b = 0; b < scan.points; ++b) {
+		out->series[b] = buckets[b].count > 0 ? (float)(buckets[b].sum / (double)buckets[b].count) : NAN;
+	}
+}
+
+uint64_t history_dropped(void) {
+	return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
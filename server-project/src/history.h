@@ -0,0 +1,48 @@
+/*
+ * history.h
+ *
+ * Weather sample history
+ * Records every value the generators produce in a fixed-size ring per
+ * (city, type) (--history, samples kept per series) and answers range
+ * queries over the last window seconds: min, max, mean and last value,
+ * optionally downsampled into equal-width buckets, for one city or
+ * across every city.
+ *
+ * Series are allocated on their first sample, so memory follows the
+ * cities actually queried rather than the catalog size; only the table
+ * that finds them is sized from the catalog. Once it is half full, or a
+ * series is not found within a few probes, new series are not recorded
+ * (and are missing from all-cities answers): their samples are counted
+ * by history_dropped(). A catalog reload renumbers cities and therefore
+ * discards every recorded series.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "weatherproto.h"
+
+#define DEFAULT_HISTORY_SAMPLES 1024
+#define MAX_HISTORY_SAMPLES (1u << 20)
+#define HISTORY_MAX_SERIES (1u << 20) // Series table slots at most, whatever the catalog size
+
+// Sets the samples kept per series (at most MAX_HISTORY_SAMPLES, rounded up
+// to a power of two) and sizes the series table for every type of cities
+// cities; samples 0 disables the history. Returns -1 when out of memory.
+int history_init(unsigned int samples, size_t cities);
+
+// Appends a freshly generated value to the (city, type) series.
+void history_record(long city_index, char type, float value);
+
+// Aggregates the type samples of the last window_s seconds for one city,
+// or for every city when city_index is negative, into out (status left
+// untouched). points > 0 also fills that many bucket means, oldest first.
+void history_query(long city_index, char type, unsigned int window_s, unsigned int points, weather_history_t *out);
+
+// Samples not recorded because their series found no room in the table.
+uint64_t history_dropped(void);
+
+#endif /* HISTORY_H_ */
@@ -0,0 +1,381 @@
+/*
+ * local.c
+ *
+ * Local transport
+ *
+ * The Unix socket only carries the setup: the client's memfd one way, the
+ * doorbell eventfd and an acknowledgement the other. After that the
+ * connection stays silent, and it becoming readable or hung up means the
+ * client went away.
+ *
+ * The thread polls the request ring of every channel. While requests keep
+ * coming it spins and looks at the sockets only every LOCAL_POLL_ROUNDS
+ * rounds; after shm_spin_ns() without work it marks every ring as waiting
+ * and sleeps in epoll_wait(), and a client publishing into a marked ring
+ * rings the doorbell. Answers are published in one go per ring and per
+ * round, with a futex wake only for a client that went to sleep.
+ *
+ * The client owns the memory, so every index read from it is checked and
+ * every request is copied out before it is looked at.
+ */
+
+#define _GNU_SOURCE
+
+#include "local.h"
+#include "admission.h"
+#include "cache.h"
+#include "catalog.h"
+#include "metrics.h"
+#include "rng.h"
+#include "shmring.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#define LOCAL_MAX_CLIENTS 1024 // Open channels, setups included
+#define LOCAL_EVENTS 64        // Socket events taken per epoll_wait()
+#define LOCAL_POLL_ROUNDS 1024 // Busy rounds between two looks at the sockets
+#define LOCAL_DRAIN_POLL_MS 10 // Period of the open channel check in local_drain()
+
+typedef struct {
+	int socket;
+	shm_channel_t *channel; // NULL until the client's memfd arrived
+	uint32_t request_head;
+	uint32_t response_tail;
+	size_t position;        // Index in active[] once the channel is mapped
+} local_client_t;
+
+static int listen_socket = -1;
+static int doorbell = -1;
+static int epoll_fd = -1;
+static local_client_t *active[LOCAL_MAX_CLIENTS]; // Clients with a mapped channel
+static size_t active_count;
+static atomic_size_t client_count;                // Accepted and not yet closed
+static uint32_t loopback_addr;                    // Source address in the request log
+
+static void close_client(local_client_t *client) {
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+	close(client->socket);
+	if (client->channel != NULL) {
+		shm_channel_unmap(client->channel);
+		active[client->position] = active[--active_count];
+		active[client->position]->position = client->position;
+	}
+	free(client);
+	--client_count;
+	admission_close();
+}
+
+static void accept_clients(void) {
+	while (1) {
+		const int socket_fd = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socket_fd < 0) {
+			if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+				perror("accept() sul socket locale fallita");
+			}
+			if (errno != EINTR) {
+				return;
+			}
+			continue;
+		}
+		metrics_count_accept();
+
+		// A refused client falls back to TCP.
+		if (client_count >= LOCAL_MAX_CLIENTS || admission_open(loopback_addr) != ADMISSION_ACCEPTED) {
+			shm_send_message(socket_fd, SHM_REFUSED, -1);
+			close(socket_fd);
+			continue;
+		}
+		local_client_t *client = calloc(1, sizeof(*client));
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = client;
+		if (client == NULL || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &event) < 0) {
+			shm_send_message(socket_fd, SHM_REFUSED, -1);
+			close(socket_fd);
+			free(client);
+			admission_close();
+			continue;
+		}
+		client->socket = socket_fd;
+		++client_count;
+	}
+}
+
+// Maps the channel the client sent and answers with the doorbell.
+static int open_channel(local_client_t *client) {
+	char kind = 0;
+	int fd = -1;
+	if (shm_recv_message(client->socket, &kind, &fd) < 0) {
+		return errno == EAGAIN ? 0 : -1;
+	}
+	if (kind == SHM_HELLO && fd >= 0) {
+		client->channel = shm_channel_map(fd);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (client->channel == NULL) {
+		shm_send_message(client->socket, SHM_REFUSED, -1);
+		return -1;
+	}
+
+	// The indices are the client's to set; a fresh channel starts at 0.
+	client->request_head = 0;
+	client->response_tail = 0;
+	client->position = active_count;
+	active[active_count++] = client;
+	return shm_send_message(client->socket, SHM_HELLO, doorbell);
+}
+
+static void client_event(local_client_t *client, uint32_t events) {
+	if (client->channel == NULL && (events & EPOLLIN)) {
+		if (open_channel(client) < 0) {
+			close_client(client);
+		}
+		return;
+	}
+	// Nothing is sent after the setup: any event is the client leaving.
+	close_client(client);
+}
+
+// Answers what is queued on the client's ring; returns the number of
+// requests answered, or -1 when the client broke the ring's invariants.
+static int serve_client(local_client_t *client) {
+	shm_channel_t *channel = client->channel;
+	const uint32_t ready = shm_ring_ready(&channel->requests, client->request_head);
+	if (ready == 0) {
+		return 0;
+	}
+	// A client never has more than SHM_RING_SLOTS requests unanswered or
+	// answers unread, so there is always room for what it queued.
+	const uint32_t space = shm_ring_space(&channel->responses, client->response_tail);
+	if (ready > SHM_RING_SLOTS || space > SHM_RING_SLOTS || space < ready) {
+		return -1;
+	}
+
+	const uint64_t started_ns = metrics_now_ns();
+	for (uint32_t i = 0; i < ready; ++i) {
+		weather_request_t request;
+		memcpy(&request, &channel->request_slots[(client->request_head + i) % SHM_RING_SLOTS], sizeof(request));
+		request.city[MAX_CITY_LEN - 1] = '\0';
+
+		weather_response_t response;
+		build_weather_response(&request, &response);
+		channel->response_slots[(client->response_tail + i) % SHM_RING_SLOTS] = response;
+		log_weather_request(&request, response.status, loopback_addr);
+		metrics_count_request(request.type, response.status);
+	}
+	client->request_head += ready;
+	client->response_tail += ready;
+	shm_ring_consume(&channel->requests, client->request_head);
+	if (shm_ring_publish(&channel->responses, client->response_tail)) {
+		shm_ring_wake(&channel->responses);
+	}
+
+	const uint64_t elapsed_ns = metrics_now_ns() - started_ns;
+	for (uint32_t i = 0; i < ready; ++i) {
+		metrics_observe_latency(elapsed_ns);
+	}
+	return (int)ready;
+}
+
+static unsigned int serve_channels(void) {
+	unsigned int served = 0;
+	for (size_t i = 0; i < active_count; ++i) {
+		const int answered = serve_client(active[i]);
+		if (answered < 0) {
+			fprintf(stderr, "Canale locale non valido, chiuso\n");
+			// The last client moved into slot i.
+			close_client(active[i--]);
+			continue;
+		}
+		served += (unsigned int)answered;
+	}
+	return served;
+}
+
+// Marks every ring before a sleep; returns 0, with no ring marked, if a
+// request arrived in the meantime.
+static int prepare_sleep(void) {
+	for (size_t i = 0; i < active_count; ++i) {
+		if (!shm_ring_prepare_wait(&active[i]->channel->requests, active[i]->request_head)) {
+			for (size_t j = 0; j < i; ++j) {
+				shm_ring_finish_wait(&active[j]->channel->requests);
+			}
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void finish_sleep(void) {
+	for (size_t i = 0; i < active_count; ++i) {
+		shm_ring_finish_wait(&active[i]->channel->requests);
+	}
+}
+
+static void *local_main(void *arg) {
+	(void)arg;
+	// The stream after the UDP threads' ones, so -S runs stay reproducible.
+	rng_thread_init(MAX_WORKERS * 2);
+
+	const uint64_t spin_ns = shm_spin_ns();
+	uint64_t last_work_ns = metrics_now_ns();
+	unsigned int rounds = 0;
+	struct epoll_event events[LOCAL_EVENTS];
+
+	while (1) {
+		if (serve_channels() > 0) {
+			last_work_ns = metrics_now_ns();
+		}
+
+		int timeout_ms = 0;
+		if (active_count > 0 && metrics_now_ns() - last_work_ns < spin_ns) {
+			if (++rounds % LOCAL_POLL_ROUNDS != 0) {
+				shm_cpu_relax();
+				continue;
+			}
+		} else if (prepare_sleep()) {
+			timeout_ms = -1;
+		} else {
+			continue;
+		}
+
+		const int count = epoll_wait(epoll_fd, events, LOCAL_EVENTS, timeout_ms);
+		if (timeout_ms != 0) {
+			finish_sleep();
+			last_work_ns = metrics_now_ns();
+		}
+		if (count < 0 && errno != EINTR) {
+			perror("epoll_wait() fallita");
+		}
+		for (int i = 0; i < count; ++i) {
+			if (events[i].data.ptr == &listen_socket) {
+				accept_clients();
+			} else if (events[i].data.ptr == &doorbell) {
+				uint64_t rings;
+				if (read(doorbell, &rings, sizeof(rings)) < 0 && errno != EAGAIN) {
+					perror("read() sul campanello fallita");
+				}
+			} else {
+				client_event(events[i].data.ptr, events[i].events);
+			}
+		}
+		catalog_poll_reload();
+		weather_cache_poll_report();
+	}
+
+	return NULL;
+}
+
+static int watch(int fd, void *tag) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = tag;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Whether a server accepts connections on the socket at address.
+static int socket_alive(const struct sockaddr_un *address) {
+	const int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (probe < 0) {
+		return 0;
+	}
+	// A full accept queue (EAGAIN) still means someone listens.
+	const int alive = connect(probe, (const struct sockaddr *)address, sizeof(*address)) == 0 || errno == EAGAIN;
+	close(probe);
+	return alive;
+}
+
+int local_available(void) {
+	return 1;
+}
+
+int local_start(const server_config_t *config, int takeover) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (local_socket_path(config->port, address.sun_path, sizeof(address.sun_path)) < 0) {
+		fprintf(stderr, "Percorso del socket locale troppo lungo\n");
+		return -1;
+	}
+	loopback_addr = htonl(INADDR_LOOPBACK);
+
+	struct stat existing;
+	if (lstat(address.sun_path, &existing) == 0) {
+		if (!S_ISSOCK(existing.st_mode)) {
+			fprintf(stderr, "%s esiste e non è un socket\n", address.sun_path);
+			return -1;
+		}
+		// A hot restart takes the path over from the old server, whose open channels stay with it.
+		if (!takeover && socket_alive(&address)) {
+			fprintf(stderr, "Un altro server con --local è attivo su %s\n", address.sun_path);
+			return -1;
+		}
+		unlink(address.sun_path);
+	}
+	listen_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_socket < 0 || bind(listen_socket, (struct sockaddr *)&address, sizeof(address)) < 0
+			|| listen(listen_socket, config->backlog) < 0) {
+		perror("bind() del socket locale fallita");
+		return -1;
+	}
+
+	doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (doorbell < 0 || epoll_fd < 0 || watch(listen_socket, &listen_socket) < 0 || watch(doorbell, &doorbell) < 0) {
+		perror("Preparazione del trasporto locale fallita");
+		return -1;
+	}
+
+	pthread_t thread;
+	const int result = pthread_create(&thread, NULL, local_main, NULL);
+	if (result != 0) {
+		fprintf(stderr, "pthread_create() fallita: %s\n", strerror(result));
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+void local_drain(unsigned int timeout_ms) {
+	const struct timespec pause = { 0, LOCAL_DRAIN_POLL_MS * 1000000L };
+	for (unsigned int waited = 0; atomic_load(&client_count) > 0 && waited < timeout_ms; waited += LOCAL_DRAIN_POLL_MS) {
+		nanosleep(&pause, NULL);
+	}
+}
+
+#else
+
+int local_available(void) {
+	return 0;
+}
+
+int local_start(const server_config_t *config, int takeover) {
+	(void)config;
+	(void)takeover;
+	return -1;
+}
+
+void local_drain(unsigned int timeout_ms) {
+	(void)timeout_ms;
+}
+
+#endif
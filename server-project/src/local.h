@@ -0,0 +1,30 @@
+/*
+ * local.h
+ *
+ * Local transport
+ * With --local the server also listens on a Unix socket named after its
+ * port (LOCAL_SOCKET_FORMAT) where clients on the same host hand over a
+ * shared-memory channel (shmring.h). One thread answers the requests of
+ * every channel straight from their rings, with no system call per
+ * request while it is busy (Linux only).
+ */
+
+#ifndef LOCAL_H_
+#define LOCAL_H_
+
+#include "protocol.h"
+
+// Returns 1 when the local transport is compiled in for this platform.
+int local_available(void);
+
+// Binds the Unix socket for config->port and starts the channel thread. A
+// socket file nobody answers on is replaced; a live server's only when
+// takeover is set, i.e. this start received its sockets in a hot restart.
+// Returns -1 if the path is taken or the socket or thread could not start.
+int local_start(const server_config_t *config, int takeover);
+
+// After a hot restart new clients reach the new server, while those already
+// connected stay here: waits until they left or timeout_ms passed.
+void local_drain(unsigned int timeout_ms);
+
+#endif /* LOCAL_H_ */
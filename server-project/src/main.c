@@ -7,6 +7,8 @@
  * portable across Windows, Linux and macOS.
  */
 
+#define _GNU_SOURCE
+
 #if defined WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -18,34 +20,37 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <poll.h>
 #define closesocket close
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include "protocol.h"
-
-#if defined WIN32
-#ifndef strcasecmp
-#define strcasecmp _stricmp
-#endif
-#endif
+#include "reactor.h"
+#include "uring.h"
+#include "datagram.h"
+#include "admission.h"
+#include "workers.h"
+#include "catalog.h"
+#include "rng.h"
+#include "cache.h"
+#include "history.h"
+#include "handoff.h"
+#include "local.h"
+#include "shmring.h"
+#include "request_log.h"
+#include "metrics.h"
+#include "wire.h"
+#include "netio.h"
 
 #ifndef NO_ERROR
 #define NO_ERROR 0
 #endif
-#define SEED_RNG_ONCE() \
-	do { \
-		static int seeded = 0; \
-		if (!seeded) { \
-			srand((unsigned int)time(NULL)); \
-			seeded = 1; \
-		} \
-	} while (0)
-
-// List of valid cities accepted by the service (case-insensitive).
+// Built-in list of valid cities (case-insensitive), used when no catalog file is given with -c.
 static const char *SUPPORTED_CITIES[] = {
 	"Bari",
 	"Roma",
@@ -71,37 +76,39 @@ void error_handler(const char *message) {
 	exit(EXIT_FAILURE);
 }
 
+float weather_generate(int index) {
+	return rng_uniform(WEATHER_TYPES[index].min, WEATHER_TYPES[index].max);
+}
+
 float get_temperature(void) {
-	const float min = -10.0f;
-	const float max = 40.0f;
-	SEED_RNG_ONCE();
-	// rand() / RAND_MAX produces [0,1]; scale to requested range.
-	float normalized = (float)rand() / (float)RAND_MAX;
-	return min + normalized * (max - min);
+	return weather_generate(WEATHER_TYPE_TEMPERATURE);
 }
 
 float get_humidity(void) {
-	const float min = 20.0f;
-	const float max = 100.0f;
-	SEED_RNG_ONCE();
-	float normalized = (float)rand() / (float)RAND_MAX;
-	return min + normalized * (max - min);
+	return weather_generate(WEATHER_TYPE_HUMIDITY);
 }
 
 float get_wind(void) {
-	const float min = 0.0f;
-	const float max = 100.0f;
-	SEED_RNG_ONCE();
-	float normalized = (float)rand() / (float)RAND_MAX;
-	return min + normalized * (max - min);
+	return weather_generate(WEATHER_TYPE_WIND);
 }
 
 float get_pressure(void) {
-	const float min = 950.0f;
-	const float max = 1050.0f;
-	SEED_RNG_ONCE();
-	float normalized = (float)rand() / (float)RAND_MAX;
-	return min + normalized * (max - min);
+	return weather_generate(WEATHER_TYPE_PRESSURE);
+}
+
+// Maps a [0, 1) sample onto the range of the given metric; returns -1 for an unknown type.
+static int scale_sample(char type, float sample, float *value) {
+	const int index = weather_type_index(type);
+	if (index < 0) {
+		return -1;
+	}
+	const weather_type_info_t *metric = &WEATHER_TYPES[index];
+	*value = metric->min + sample * (metric->max - metric->min);
+	return 0;
+}
+
+long find_city(const char *city) {
+	return catalog_find_city(city);
 }
 
 int is_supported_city(const char *city) {
@@ -109,22 +116,52 @@ int is_supported_city(const char *city) {
 		return 0;
 	}
 
-	const size_t total = sizeof(SUPPORTED_CITIES) / sizeof(SUPPORTED_CITIES[0]);
-	for (size_t i = 0; i < total; ++i) {
-		if (strcasecmp(city, SUPPORTED_CITIES[i]) == 0) {
-			return 1;
-		}
+	return find_city(city) >= 0;
+}
+
+// Parses the value of option argv[*index] as an integer in [min, max] and advances *index.
+static int parse_unsigned_option(int argc, char *argv[], int *index, unsigned long min, unsigned long max, unsigned long *value) {
+	const char *option = argv[*index];
+	if (*index + 1 >= argc) {
+		fprintf(stderr, "Valore mancante per l'opzione %s.\n", option);
+		return -1;
 	}
 
+	char *endptr = NULL;
+	const char *text = argv[++*index];
+	*value = strtoul(text, &endptr, 10);
+	if (endptr == NULL || endptr == text || *endptr != '\0' || text[0] == '-' || *value < min || *value > max) {
+		fprintf(stderr, "Il valore di %s deve essere nel range %lu-%lu.\n", option, min, max);
+		return -1;
+	}
 	return 0;
 }
 
-int parse_arguments(int argc, char *argv[], unsigned short *port) {
-	if (port == NULL) {
+int parse_arguments(int argc, char *argv[], server_config_t *config) {
+	if (config == NULL) {
 		return -1;
 	}
 
-	*port = DEFAULT_SERVER_PORT;
+	config->port = DEFAULT_SERVER_PORT;
+	config->backend = reactor_available() ? BACKEND_EPOLL : BACKEND_SERIAL;
+	config->workers = 1;
+	config->keep_alive = 0;
+	config->catalog_path = NULL;
+	config->seed = 0;
+	config->cache_ttl_ms = 0;
+	config->history_samples = DEFAULT_HISTORY_SAMPLES;
+	config->log_level = LOG_LEVEL_INFO;
+	config->log_sample = 1;
+	config->metrics_port = 0;
+	config->udp = 0;
+	config->backlog = QUEUE_SIZE;
+	config->read_timeout_ms = DEFAULT_IO_TIMEOUT_MS;
+	config->write_timeout_ms = DEFAULT_IO_TIMEOUT_MS;
+	config->max_connections = 0;
+	config->ip_rate = 0;
+	config->ip_burst = 0;
+	config->handoff_path = NULL;
+	config->local = 0;
 
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-p") == 0) {
@@ -145,13 +182,226 @@ int parse_arguments(int argc, char *argv[], unsigned short *port) {
 				return -1;
 			}
 
-			*port = (unsigned short)value;
+			config->port = (unsigned short)value;
+		} else if (strcmp(argv[i], "-m") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -m.\n");
+				return -1;
+			}
+
+			char *endptr = NULL;
+			long value = strtol(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value <= 0 || value > 65535) {
+				fprintf(stderr, "La porta di amministrazione deve essere nel range 1-65535.\n");
+				return -1;
+			}
+
+			if (!metrics_available()) {
+				fprintf(stderr, "Endpoint delle metriche non disponibile su questa piattaforma.\n");
+				return -1;
+			}
+
+			config->metrics_port = (unsigned short)value;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -b.\n");
+				return -1;
+			}
+
+			const char *backend = argv[++i];
+			if (strcmp(backend, "serial") == 0) {
+				config->backend = BACKEND_SERIAL;
+			} else if (strcmp(backend, "epoll") == 0) {
+				if (!reactor_available()) {
+					fprintf(stderr, "Backend epoll non disponibile su questa piattaforma.\n");
+					return -1;
+				}
+				config->backend = BACKEND_EPOLL;
+			} else if (strcmp(backend, "uring") == 0) {
+				if (!uring_available()) {
+					fprintf(stderr, "Backend io_uring non disponibile su questa piattaforma.\n");
+					return -1;
+				}
+				config->backend = BACKEND_URING;
+			} else {
+				fprintf(stderr, "Backend sconosciuto: %s\n", backend);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-c") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -c.\n");
+				return -1;
+			}
+
+			config->catalog_path = argv[++i];
+		} else if (strcmp(argv[i], "-S") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -S.\n");
+				return -1;
+			}
+
+			char *endptr = NULL;
+			unsigned long long value = strtoull(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value == 0) {
+				fprintf(stderr, "Seme non valido: %s\n", argv[i]);
+				return -1;
+			}
+
+			config->seed = (uint64_t)value;
+		} else if (strcmp(argv[i], "--cache-ttl") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione --cache-ttl.\n");
+				return -1;
+			}
+
+			char *endptr = NULL;
+			long value = strtol(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value < 0 || value > MAX_CACHE_TTL_MS) {
+				fprintf(stderr, "Il TTL della cache deve essere nel range 0-%d ms.\n", MAX_CACHE_TTL_MS);
+				return -1;
+			}
+
+			config->cache_ttl_ms = (unsigned int)value;
+		} else if (strcmp(argv[i], "--history") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione --history.\n");
+				return -1;
+			}
+
+			char *endptr = NULL;
+			long value = strtol(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value < 0 || value > (long)MAX_HISTORY_SAMPLES) {
+				fprintf(stderr, "I campioni dello storico devono essere nel range 0-%u.\n", MAX_HISTORY_SAMPLES);
+				return -1;
+			}
+
+			config->history_samples = (unsigned int)value;
+		} else if (strcmp(argv[i], "--handoff") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione --handoff.\n");
+				return -1;
+			}
+
+			if (!handoff_available()) {
+				fprintf(stderr, "Riavvio a caldo non disponibile su questa piattaforma.\n");
+				return -1;
+			}
+
+			config->handoff_path = argv[++i];
+		} else if (strcmp(argv[i], "--local") == 0) {
+			if (!local_available()) {
+				fprintf(stderr, "Trasporto locale non disponibile su questa piattaforma.\n");
+				return -1;
+			}
+
+			config->local = 1;
+		} else if (strcmp(argv[i], "-l") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -l.\n");
+				return -1;
+			}
+
+			const char *level = argv[++i];
+			if (strcmp(level, "off") == 0) {
+				config->log_level = LOG_LEVEL_OFF;
+			} else if (strcmp(level, "warn") == 0) {
+				config->log_level = LOG_LEVEL_WARN;
+			} else if (strcmp(level, "info") == 0) {
+				config->log_level = LOG_LEVEL_INFO;
+			} else {
+				fprintf(stderr, "Livello di log sconosciuto: %s\n", level);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--log-sample") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione --log-sample.\n");
+				return -1;
+			}
+
+			char *endptr = NULL;
+			unsigned long value = strtoul(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value == 0 || value > 1000000) {
+				fprintf(stderr, "Il campionamento del log deve essere nel range 1-1000000.\n");
+				return -1;
+			}
+
+			config->log_sample = (unsigned int)value;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			config->keep_alive = 1;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			if (!datagram_available()) {
+				fprintf(stderr, "Modalità UDP non disponibile su questa piattaforma.\n");
+				return -1;
+			}
+			config->udp = 1;
+		} else if (strcmp(argv[i], "--backlog") == 0) {
+			unsigned long value = 0;
+			if (parse_unsigned_option(argc, argv, &i, 1, MAX_BACKLOG, &value) < 0) {
+				return -1;
+			}
+			config->backlog = (int)value;
+		} else if (strcmp(argv[i], "--read-timeout") == 0 || strcmp(argv[i], "--write-timeout") == 0) {
+			const int is_read = argv[i][2] == 'r';
+			unsigned long value = 0;
+			if (parse_unsigned_option(argc, argv, &i, 0, MAX_IO_TIMEOUT_MS, &value) < 0) {
+				return -1;
+			}
+			if (is_read) {
+				config->read_timeout_ms = (unsigned int)value;
+			} else {
+				config->write_timeout_ms = (unsigned int)value;
+			}
+		} else if (strcmp(argv[i], "--max-conn") == 0) {
+			unsigned long value = 0;
+			if (parse_unsigned_option(argc, argv, &i, 0, 1000000, &value) < 0) {
+				return -1;
+			}
+			config->max_connections = (unsigned int)value;
+		} else if (strcmp(argv[i], "--ip-rate") == 0) {
+			unsigned long value = 0;
+			if (parse_unsigned_option(argc, argv, &i, 0, MAX_IP_RATE, &value) < 0) {
+				return -1;
+			}
+			config->ip_rate = (unsigned int)value;
+		} else if (strcmp(argv[i], "--ip-burst") == 0) {
+			unsigned long value = 0;
+			if (parse_unsigned_option(argc, argv, &i, 1, MAX_IP_BURST, &value) < 0) {
+				return -1;
+			}
+			config->ip_burst = (unsigned int)value;
+		} else if (strcmp(argv[i], "-w") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Valore mancante per l'opzione -w.\n");
+				return -1;
+			}
+
+			char *endptr = NULL;
+			long value = strtol(argv[++i], &endptr, 10);
+			if (endptr == NULL || *endptr != '\0' || value < 1 || value > MAX_WORKERS) {
+				fprintf(stderr, "Il numero di worker deve essere nel range 1-%d.\n", MAX_WORKERS);
+				return -1;
+			}
+
+			if (value > 1 && !workers_available()) {
+				fprintf(stderr, "Worker multipli non disponibili su questa piattaforma.\n");
+				return -1;
+			}
+
+			config->workers = (int)value;
 		} else {
 			fprintf(stderr, "Argomento sconosciuto: %s\n", argv[i]);
 			return -1;
 		}
 	}
 
+	if (config->ip_burst == 0) {
+		// Default bucket: one second's worth of tokens, within the burst limit.
+		config->ip_burst = config->ip_rate < MAX_IP_BURST ? config->ip_rate : MAX_IP_BURST;
+		if (config->ip_burst == 0) {
+			config->ip_burst = 1;
+		}
+	}
+
 	return 0;
 }
 
@@ -164,8 +414,18 @@ struct sockaddr_in build_server_address(unsigned short port) {
 	return server_addr;
 }
 
-int create_listening_socket(unsigned short port) {
-	int listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+int create_listening_socket(const server_config_t *config) {
+	// After a hot restart the previous server's socket is reused, accept queue included.
+	int listen_socket = handoff_take(HANDOFF_TCP, config->port);
+	if (listen_socket >= 0) {
+		if (listen(listen_socket, config->backlog) < 0) {
+			perror("listen() fallita");
+		}
+		handoff_register(HANDOFF_TCP, listen_socket);
+		return listen_socket;
+	}
+
+	listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (listen_socket < 0) {
 		error_handler("socket() fallita");
 	}
@@ -176,100 +436,514 @@ int create_listening_socket(unsigned short port) {
 		error_handler("setsockopt() fallita");
 	}
 
-	struct sockaddr_in server_addr = build_server_address(port);
+#if defined SO_REUSEPORT
+	// Sharded listeners: every worker binds its own socket and the kernel balances between them.
+	if (config->workers > 1 && setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT, (char *)&enable, sizeof(enable)) < 0) {
+		closesocket(listen_socket);
+		error_handler("setsockopt(SO_REUSEPORT) fallita");
+	}
+#endif
+
+	struct sockaddr_in server_addr = build_server_address(config->port);
 	if (bind(listen_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
 		closesocket(listen_socket);
 		error_handler("bind() fallita");
 	}
 
-	if (listen(listen_socket, QUEUE_SIZE) < 0) {
+	if (listen(listen_socket, config->backlog) < 0) {
 		closesocket(listen_socket);
 		error_handler("listen() fallita");
 	}
 
+	handoff_register(HANDOFF_TCP, listen_socket);
 	return listen_socket;
 }
 
-void handle_client(int client_socket) {
+int create_datagram_socket(const server_config_t *config) {
+	int datagram_socket = handoff_take(HANDOFF_UDP, config->port);
+	if (datagram_socket >= 0) {
+		handoff_register(HANDOFF_UDP, datagram_socket);
+		return datagram_socket;
+	}
+
+	datagram_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (datagram_socket < 0) {
+		error_handler("socket() fallita");
+	}
+
+#if defined SO_REUSEPORT
+	// One socket per UDP thread, balanced by the kernel like the TCP listeners.
+	int enable = 1;
+	if (config->workers > 1 && setsockopt(datagram_socket, SOL_SOCKET, SO_REUSEPORT, (char *)&enable, sizeof(enable)) < 0) {
+		closesocket(datagram_socket);
+		error_handler("setsockopt(SO_REUSEPORT) fallita");
+	}
+#endif
+
+	struct sockaddr_in server_addr = build_server_address(config->port);
+	if (bind(datagram_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+		closesocket(datagram_socket);
+		error_handler("bind() fallita");
+	}
+
+	handoff_register(HANDOFF_UDP, datagram_socket);
+	return datagram_socket;
+}
+
+void reject_connection(int client_socket) {
+	// Abortive close: the client gets an immediate RST and no TIME_WAIT is left behind.
+	struct linger abort_linger;
+	abort_linger.l_onoff = 1;
+	abort_linger.l_linger = 0;
+	setsockopt(client_socket, SOL_SOCKET, SO_LINGER, (char *)&abort_linger, sizeof(abort_linger));
+	closesocket(client_socket);
+}
+
+static void set_socket_timeout(int client_socket, int option, unsigned int timeout_ms) {
+#if defined WIN32
+	DWORD timeout = timeout_ms;
+#else
+	struct timeval timeout;
+	timeout.tv_sec = (time_t)(timeout_ms / 1000);
+	timeout.tv_usec = (suseconds_t)(timeout_ms % 1000) * 1000;
+#endif
+	if (setsockopt(client_socket, SOL_SOCKET, option, (char *)&timeout, sizeof(timeout)) < 0) {
+		perror("setsockopt() fallita");
+	}
+}
+
+void set_socket_deadlines(int client_socket, const server_config_t *config) {
+	// Blocking sockets only: the deadline bounds each recv()/send() call, not the whole request.
+	if (config->read_timeout_ms > 0) {
+		set_socket_timeout(client_socket, SO_RCVTIMEO, config->read_timeout_ms);
+	}
+	if (config->write_timeout_ms > 0) {
+		set_socket_timeout(client_socket, SO_SNDTIMEO, config->write_timeout_ms);
+	}
+}
+
+void log_weather_request(const weather_request_t *request, unsigned int status, uint32_t client_addr) {
+	request_log_push(request, status, client_addr);
+}
+
+// Error answers never change, so they are encoded once and sent straight from
+// these tables. Static storage also zeroes the struct padding that goes on the wire.
+static const weather_response_t LEGACY_ERROR_RESPONSES[STATUS_COUNT] = {
+	{ STATUS_SUCCESS, '\0', 0.0f },
+	{ STATUS_CITY_NOT_AVAILABLE, '\0', 0.0f },
+	{ STATUS_INVALID_REQUEST, '\0', 0.0f }
+};
+static const weather_batch_response_t BATCH_INVALID_RESPONSE = { STATUS_INVALID_REQUEST, 0 };
+
+// Returns the cached value of (city, type) or generates a fresh one,
+// caches it and records it in the history.
+static float cached_value(long city_index, char type, int index) {
+	float value = 0.0f;
+	if (!weather_cache_get(city_index, type, &value)) {
+		value = weather_generate(index);
+		weather_cache_put(city_index, type, value);
+		history_record(city_index, type, value);
+	}
+	return value;
+}
+
+int weather_value(long city_index, char type, float *value) {
+	const int index = weather_type_index(type);
+	if (index < 0) {
+		return -1;
+	}
+	*value = cached_value(city_index, type, index);
+	return 0;
+}
+
+// Resolves a request to its status code; on success also stores the city
+// index (if city_index is not NULL) and the value to send.
+static unsigned int resolve_request(const weather_request_t *request, long *city_index, float *value) {
+	if (weather_type_index(request->type) < 0) {
+		return STATUS_INVALID_REQUEST;
+	}
+	const long index = find_city(request->city);
+	if (index < 0) {
+		return STATUS_CITY_NOT_AVAILABLE;
+	}
+	if (weather_value(index, request->type, value) < 0) {
+		return STATUS_INVALID_REQUEST;
+	}
+	if (city_index != NULL) {
+		*city_index = index;
+	}
+	return STATUS_SUCCESS;
+}
+
+void build_weather_response(const weather_request_t *request, weather_response_t *response) {
+	memset(response, 0, sizeof(*response));
+	float value = 0.0f;
+	response->status = resolve_request(request, NULL, &value);
+	if (response->status == STATUS_SUCCESS) {
+		response->type = request->type;
+		response->value = value;
+	}
+}
+
+size_t request_frame_length(const char *data, size_t available) {
+	if (wire_is_compact((const unsigned char *)data, available)) {
+		const long length = wire_request_length((const unsigned char *)data, available);
+		// Malformed header: consumed as-is, answered with an error, then the connection is closed.
+		return length < 0 ? available : (size_t)length;
+	}
+
+	if (available < sizeof(weather_request_t)) {
+		return 0;
+	}
+
+	if (data[0] != REQUEST_TYPE_BATCH) {
+		return sizeof(weather_request_t);
+	}
+
+	const unsigned char count = (unsigned char)data[1];
+	if (count == 0 || count > MAX_BATCH_ITEMS) {
+		// Malformed header: consumed on its own, answered with an error, then the connection is closed.
+		return sizeof(weather_batch_request_t);
+	}
+
+	return sizeof(weather_batch_request_t) + (size_t)count * sizeof(weather_request_t);
+}
+
+// Answers a compact history query; the city is empty for every city.
+static int process_history_frame(const char *frame, size_t frame_length, uint32_t client_addr, char *out, size_t *out_len) {
 	weather_request_t request;
+	weather_history_t history;
+	unsigned int window_s = 0;
+	unsigned int points = 0;
 	memset(&request, 0, sizeof(request));
+	memset(&history, 0, sizeof(history));
+
+	if (wire_decode_history_query((const unsigned char *)frame, frame_length, &window_s, &points,
+			&request.type, request.city, sizeof(request.city)) < 0) {
+		metrics_count_request('\0', STATUS_INVALID_REQUEST);
+		history.status = STATUS_INVALID_REQUEST;
+		*out_len = wire_encode_history((unsigned char *)out, &history);
+		return -1;
+	}
+
+	long city_index = -1;
+	if (weather_type_index(request.type) < 0 || window_s == 0 || window_s > MAX_HISTORY_WINDOW_S) {
+		history.status = STATUS_INVALID_REQUEST;
+	} else if (request.city[0] != '\0' && (city_index = find_city(request.city)) < 0) {
+		history.status = STATUS_CITY_NOT_AVAILABLE;
+	} else {
+		history.status = STATUS_SUCCESS;
+		history_query(city_index, request.type, window_s, points, &history);
+	}
+	log_weather_request(&request, history.status, client_addr);
+	metrics_count_request(request.type, history.status);
+	*out_len = wire_encode_history((unsigned char *)out, &history);
+	return 0;
+}
+
+int process_request_frame(const char *frame, size_t frame_length, uint32_t client_addr, char *out,
+		const char **reply, size_t *reply_len) {
+	weather_request_t request;
+	float value = 0.0f;
 
-	size_t received_total = 0;
-	char *request_bytes = (char *)&request;
-	// Ensure the full request struct is received even if TCP fragments it.
-	while (received_total < sizeof(request)) {
-		int received = recv(client_socket, request_bytes + received_total, (int)(sizeof(request) - received_total), 0);
-		if (received <= 0) {
-			if (received < 0) {
-				perror("recv() fallita");
+	if (wire_is_subscribe((const unsigned char *)frame, frame_length)) {
+		// Only an event loop that can push (the epoll reactor) accepts subscriptions.
+		metrics_count_request(WIRE_SUBSCRIBE, STATUS_INVALID_REQUEST);
+		*reply_len = wire_encode_response((unsigned char *)out, STATUS_INVALID_REQUEST, WIRE_SUBSCRIBE, 0.0f);
+		*reply = out;
+		return -1;
+	}
+
+	if (wire_is_history((const unsigned char *)frame, frame_length)) {
+		*reply = out;
+		return process_history_frame(frame, frame_length, client_addr, out, reply_len);
+	}
+
+	if (wire_is_compact((const unsigned char *)frame, frame_length)) {
+		// Compact requests are answered in the compact format.
+		*reply_len = WIRE_RESPONSE_SIZE;
+		if (wire_decode_request((const unsigned char *)frame, frame_length, &request.type, request.city, sizeof(request.city)) < 0) {
+			metrics_count_request('\0', STATUS_INVALID_REQUEST);
+			*reply = (const char *)wire_error_response(STATUS_INVALID_REQUEST);
+			return -1;
+		}
+		const unsigned int status = resolve_request(&request, NULL, &value);
+		log_weather_request(&request, status, client_addr);
+		metrics_count_request(request.type, status);
+		if (status != STATUS_SUCCESS) {
+			*reply = (const char *)wire_error_response(status);
+			return 0;
+		}
+		wire_encode_response((unsigned char *)out, status, request.type, value);
+		*reply = out;
+		return 0;
+	}
+
+	if (frame[0] != REQUEST_TYPE_BATCH) {
+		memcpy(&request, frame, sizeof(request));
+		request.city[sizeof(request.city) - 1] = '\0';
+		const unsigned int status = resolve_request(&request, NULL, &value);
+		log_weather_request(&request, status, client_addr);
+		metrics_count_request(request.type, status);
+		*reply_len = sizeof(weather_response_t);
+		if (status != STATUS_SUCCESS) {
+			*reply = (const char *)&LEGACY_ERROR_RESPONSES[status];
+			return 0;
+		}
+		weather_response_t response;
+		memset(&response, 0, sizeof(response));
+		response.status = status;
+		response.type = request.type;
+		response.value = value;
+		memcpy(out, &response, sizeof(response));
+		*reply = out;
+		return 0;
+	}
+
+	weather_batch_request_t header;
+	memcpy(&header, frame, sizeof(header));
+
+	if (header.count == 0 || header.count > MAX_BATCH_ITEMS) {
+		metrics_count_request(header.type, STATUS_INVALID_REQUEST);
+		*reply = (const char *)&BATCH_INVALID_RESPONSE;
+		*reply_len = sizeof(BATCH_INVALID_RESPONSE);
+		return -1;
+	}
+
+	const weather_batch_response_t batch_response = { STATUS_SUCCESS, header.count };
+	memcpy(out, &batch_response, sizeof(batch_response));
+	size_t written = sizeof(batch_response);
+
+	// Draw every sample of the batch in one vectorized pass, then scale per item.
+	float samples[MAX_BATCH_ITEMS];
+	rng_fill_unit(samples, header.count);
+
+	const char *items = frame + sizeof(header);
+	for (unsigned int i = 0; i < header.count; ++i) {
+		memcpy(&request, items + i * sizeof(request), sizeof(request));
+		request.city[sizeof(request.city) - 1] = '\0';
+
+		weather_batch_entry_t entry;
+		memset(&entry, 0, sizeof(entry));
+		value = 0.0f;
+		long city_index = -1;
+		if (scale_sample(request.type, samples[i], &value) < 0) {
+			entry.status = STATUS_INVALID_REQUEST;
+		} else if ((city_index = find_city(request.city)) < 0) {
+			entry.status = STATUS_CITY_NOT_AVAILABLE;
+		} else {
+			// A cached value wins over the fresh sample so batch and single answers agree.
+			if (!weather_cache_get(city_index, request.type, &value)) {
+				weather_cache_put(city_index, request.type, value);
+				history_record(city_index, request.type, value);
 			}
-			return;
+			entry.status = STATUS_SUCCESS;
+			entry.type = request.type;
+			entry.value = value;
 		}
-		received_total += (size_t)received;
+		log_weather_request(&request, entry.status, client_addr);
+		metrics_count_request(request.type, entry.status);
+		memcpy(out + written, &entry, sizeof(entry));
+		written += sizeof(entry);
 	}
 
-	request.city[sizeof(request.city) - 1] = '\0';
+	*reply = out;
+	*reply_len = written;
+	return 0;
+}
+
+int process_subscribe_frame(const char *frame, size_t frame_length, uint32_t client_addr,
+		subscribe_request_t *subscribe, char *out, size_t *out_len) {
+	weather_request_t items[MAX_SUBSCRIBE_ITEMS];
+	size_t count = 0;
+	unsigned int interval_ms = 0;
 
-	char client_ip[INET_ADDRSTRLEN] = "sconosciuto";
-	struct sockaddr_in client_addr;
-	socklen_t client_addr_len = sizeof(client_addr);
-	// Retrieve client address for logging; ignore failures gracefully.
-	if (getpeername(client_socket, (struct sockaddr *)&client_addr, &client_addr_len) == 0) {
-		if (inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, sizeof(client_ip)) == NULL) {
-			strcpy(client_ip, "sconosciuto");
+	subscribe->count = 0;
+	if (wire_decode_subscribe((const unsigned char *)frame, frame_length, &interval_ms, items, &count) < 0
+			|| interval_ms < MIN_SUBSCRIBE_INTERVAL_MS || interval_ms > MAX_SUBSCRIBE_INTERVAL_MS) {
+		metrics_count_request(WIRE_SUBSCRIBE, STATUS_INVALID_REQUEST);
+		*out_len = wire_encode_response((unsigned char *)out, STATUS_INVALID_REQUEST, WIRE_SUBSCRIBE, 0.0f);
+		return -1;
+	}
+
+	// One acknowledgement per item, carrying the current value so the stream starts populated.
+	subscribe->interval_ms = interval_ms;
+	// Read before any lookup: a reload in between only makes the stream end early.
+	subscribe->generation = catalog_generation();
+	size_t written = 0;
+	for (size_t i = 0; i < count; ++i) {
+		float value = 0.0f;
+		long city_index = -1;
+		const unsigned int status = resolve_request(&items[i], &city_index, &value);
+		log_weather_request(&items[i], status, client_addr);
+		metrics_count_request(items[i].type, status);
+		if (status == STATUS_SUCCESS) {
+			subscribe->entries[subscribe->count].item = (unsigned char)i;
+			subscribe->entries[subscribe->count].type = items[i].type;
+			subscribe->entries[subscribe->count].city_index = city_index;
+			++subscribe->count;
 		}
+		written += wire_encode_response((unsigned char *)out + written, status,
+				status == STATUS_SUCCESS ? items[i].type : '\0', value);
 	}
 
-	printf("Richiesta '%c %s' dal client ip %s\n", request.type, request.city, client_ip);
+	*out_len = written;
+	return subscribe->count > 0 ? 0 : -1;
+}
 
-	weather_response_t response;
-	memset(&response, 0, sizeof(response));
-	response.status = STATUS_INVALID_REQUEST;
-	response.type = '\0';
-	response.value = 0.0f;
+// Tells a recv()/send() that hit SO_RCVTIMEO/SO_SNDTIMEO from a real error.
+static int socket_timed_out(void) {
+#if defined WIN32
+	return WSAGetLastError() == WSAETIMEDOUT;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
 
-	const int valid_type = (request.type == 't' || request.type == 'h' || request.type == 'w' || request.type == 'p');
-	if (!valid_type) {
-		response.status = STATUS_INVALID_REQUEST;
-	} else if (!is_supported_city(request.city)) {
-		response.status = STATUS_CITY_NOT_AVAILABLE;
-	} else {
-		response.status = STATUS_SUCCESS;
-		response.type = request.type;
+void handle_client(int client_socket, uint32_t client_addr, const server_config_t *config) {
+	// Holds one frame plus whatever the client already pipelined after it.
+	char rx[MAX_REQUEST_FRAME_SIZE * 2];
+	size_t rx_len = 0;
+	// Answers built per request; constant error answers are sent from their templates instead.
+	char replies[MAX_RESPONSE_FRAME_SIZE * 4];
+	net_chunk_t chunks[NET_MAX_CHUNKS];
+	int frame_result = 0;
+	int served = 0;
+	// Called right after accept(): the first response's latency is measured from here.
+	uint64_t started_ns = metrics_now_ns();
 
-		switch (request.type) {
-			case 't':
-				response.value = get_temperature();
-				break;
-			case 'h':
-				response.value = get_humidity();
-				break;
-			case 'w':
-				response.value = get_wind();
-				break;
-			case 'p':
-				response.value = get_pressure();
-				break;
-			default:
-				response.status = STATUS_INVALID_REQUEST;
-				response.type = '\0';
-				response.value = 0.0f;
+	// With keep-alive, serve back-to-back requests until the client closes the stream.
+	do {
+		// Read until a whole frame is buffered, however TCP fragments it; the
+		// first bytes tell a compact request from a legacy or batch struct.
+		while (request_frame_length(rx, rx_len) == 0) {
+			int received = recv(client_socket, rx + rx_len, (int)(sizeof(rx) - rx_len), 0);
+			if (received <= 0) {
+				if (received < 0 && socket_timed_out()) {
+					admission_count_timeout(DEADLINE_READ);
+				} else if (received < 0) {
+					perror("recv() fallita");
+				}
+				return;
+			}
+			const int continues_frame = rx_len > 0;
+			metrics_count_recv((size_t)received, continues_frame);
+			if (!continues_frame && served > 0) {
+				started_ns = metrics_now_ns();
+			}
+			rx_len += (size_t)received;
+		}
+
+		// Answer every frame already pipelined behind the first one, then
+		// hand all the answers to one gathered send.
+		size_t consumed = 0;
+		size_t replies_used = 0;
+		size_t chunk_count = 0;
+		size_t frame_length = 0;
+		while (chunk_count < NET_MAX_CHUNKS && sizeof(replies) - replies_used >= MAX_RESPONSE_FRAME_SIZE
+				&& (frame_length = request_frame_length(rx + consumed, rx_len - consumed)) > 0) {
+			const char *reply = NULL;
+			size_t reply_length = 0;
+			frame_result = process_request_frame(rx + consumed, frame_length, client_addr,
+					replies + replies_used, &reply, &reply_length);
+			if (reply == replies + replies_used) {
+				replies_used += reply_length;
+			}
+			chunks[chunk_count].data = reply;
+			chunks[chunk_count].length = reply_length;
+			++chunk_count;
+			consumed += frame_length;
+			if (!config->keep_alive || frame_result != 0) {
 				break;
+			}
 		}
-	}
+		memmove(rx, rx + consumed, rx_len - consumed);
+		rx_len -= consumed;
 
-	size_t sent_total = 0;
-	const char *response_bytes = (const char *)&response;
-	// Send the entire response struct, handling partial writes.
-	while (sent_total < sizeof(response)) {
-		int sent = send(client_socket, response_bytes + sent_total, (int)(sizeof(response) - sent_total), 0);
-		if (sent <= 0) {
-			if (sent < 0) {
+		if (net_send_chunks(client_socket, chunks, chunk_count, metrics_count_send) < 0) {
+			if (socket_timed_out()) {
+				admission_count_timeout(DEADLINE_WRITE);
+			} else {
 				perror("send() fallita");
 			}
 			return;
 		}
-		sent_total += (size_t)sent;
+		const uint64_t elapsed_ns = metrics_now_ns() - started_ns;
+		for (size_t i = 0; i < chunk_count; ++i) {
+			metrics_observe_latency(elapsed_ns);
+		}
+		served += (int)chunk_count;
+	} while (config->keep_alive && frame_result == 0);
+}
+
+// Waits until listen_socket has a connection to accept; returns 0 once the
+// socket was handed to a new server instead.
+static int wait_for_connection(int listen_socket) {
+#if defined WIN32
+	(void)listen_socket;
+	return 1;
+#else
+	const int wake_fd = handoff_wake_fd();
+	if (wake_fd < 0) {
+		return 1;
+	}
+	struct pollfd fds[2] = { { listen_socket, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+	while (poll(fds, 2, -1) < 0) {
+		if (errno != EINTR) {
+			perror("poll() fallita");
+			return 1;
+		}
+	}
+	return fds[1].revents == 0;
+#endif
+}
+
+void serve_listener(int listen_socket, const server_config_t *config) {
+	if (config->backend == BACKEND_URING) {
+		// Kernels without io_uring (or without buffer rings) get the epoll loop instead.
+		if (uring_run(listen_socket, config) == 0) {
+			return;
+		}
+		fprintf(stderr, "Backend io_uring non avviato, uso epoll\n");
+	}
+
+	if (config->backend == BACKEND_EPOLL || config->backend == BACKEND_URING) {
+		// The reactor only fails if it could not be set up; fall back to the serial loop.
+		if (reactor_run(listen_socket, config) == 0) {
+			return;
+		}
+		fprintf(stderr, "Backend epoll non avviato, uso il ciclo seriale\n");
+	}
+
+	while (wait_for_connection(listen_socket)) {
+		//printf("In attesa di connessioni in ingresso...\n"); TODO: Chiedere al professore se possiamo lasciare questo output
+		struct sockaddr_in client_addr;
+		socklen_t client_addr_len = sizeof(client_addr);
+		int client_socket = accept(listen_socket, (struct sockaddr *)&client_addr, &client_addr_len);
+		catalog_poll_reload();
+		weather_cache_poll_report();
+		if (client_socket < 0) {
+#if !defined WIN32
+			// A socket inherited from the epoll backend is non-blocking; another process may win the connection.
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+#endif
+			perror("accept() fallita");
+			continue;
+		}
+
+		metrics_count_accept();
+		if (admission_open(client_addr.sin_addr.s_addr) != ADMISSION_ACCEPTED) {
+			reject_connection(client_socket);
+			continue;
+		}
+
+		set_socket_deadlines(client_socket, config);
+		// The peer address comes from accept(): no getpeername() per connection.
+		handle_client(client_socket, client_addr.sin_addr.s_addr, config);
+		closesocket(client_socket);
+		admission_close();
 	}
 }
 
@@ -284,28 +958,95 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
-	unsigned short port;
-	if (parse_arguments(argc, argv, &port) < 0) {
-		fprintf(stderr, "Uso: %s [-p port]\n", argv[0]);
+	server_config_t config;
+	if (parse_arguments(argc, argv, &config) < 0) {
+		fprintf(stderr, "Uso: %s [-p port] [-b serial|epoll|uring] [-w workers] [-k] [-c catalog.bin] [-S seed] [--cache-ttl ms] [--history N] [-l off|warn|info] [--log-sample N] [-m admin-port] [-u] [--backlog N] [--read-timeout ms] [--write-timeout ms] [--max-conn N] [--ip-rate N [--ip-burst N]] [--handoff path] [--local]\n", argv[0]);
 		clearwinsock();
 		return EXIT_FAILURE;
 	}
 
-	int listen_socket = create_listening_socket(port);
-	printf("Server meteo in ascolto sulla porta %u\n", port);
+	const size_t builtin_count = sizeof(SUPPORTED_CITIES) / sizeof(SUPPORTED_CITIES[0]);
+	if (catalog_load(config.catalog_path, SUPPORTED_CITIES, builtin_count) < 0) {
+		if (config.catalog_path != NULL) {
+			fprintf(stderr, "Catalogo città non valido o illeggibile: %s\n", config.catalog_path);
+		} else {
+			fprintf(stderr, "Impossibile costruire l'indice delle città\n");
+		}
+		clearwinsock();
+		return EXIT_FAILURE;
+	}
+	catalog_install_reload_handler();
+	rng_seed(config.seed);
+	admission_init(&config);
 
-	while (1) {
-		//printf("In attesa di connessioni in ingresso...\n"); TODO: Chiedere al professore se possiamo lasciare questo output
-		struct sockaddr_in client_addr;
-		socklen_t client_addr_len = sizeof(client_addr);
-		int client_socket = accept(listen_socket, (struct sockaddr *)&client_addr, &client_addr_len);
-		if (client_socket < 0) {
-			perror("accept() fallita");
-			continue;
+	if (weather_cache_init(config.cache_ttl_ms) < 0) {
+		fprintf(stderr, "Memoria insufficiente per la cache dei valori meteo\n");
+		clearwinsock();
+		return EXIT_FAILURE;
+	}
+	weather_cache_install_report_handler();
+	if (history_init(config.history_samples, catalog_city_count()) < 0) {
+		fprintf(stderr, "Memoria insufficiente per lo storico dei campioni\n");
+		clearwinsock();
+		return EXIT_FAILURE;
+	}
+	request_log_start((log_level_t)config.log_level, config.log_sample);
+
+	// Sockets of a running server are taken over before any listener is bound.
+	int inherited = 0;
+	if (config.handoff_path != NULL) {
+		inherited = handoff_receive(config.handoff_path);
+		if (inherited < 0) {
+			fprintf(stderr, "Passaggio dei socket da %s non riuscito\n", config.handoff_path);
+			clearwinsock();
+			return EXIT_FAILURE;
+		}
+		if (inherited > 0) {
+			printf("Socket ereditati dal server in esecuzione su %s\n", config.handoff_path);
 		}
+	}
 
-		handle_client(client_socket);
-		closesocket(client_socket);
+	if (config.metrics_port != 0) {
+		if (metrics_start(config.metrics_port) < 0) {
+			clearwinsock();
+			return EXIT_FAILURE;
+		}
+		printf("Metriche disponibili sulla porta %u\n", config.metrics_port);
+	}
+
+	if (config.udp) {
+		if (datagram_start(&config) < 0) {
+			clearwinsock();
+			return EXIT_FAILURE;
+		}
+		printf("Richieste UDP accettate sulla porta %u\n", config.port);
+	}
+
+	if (config.local) {
+		if (local_start(&config, inherited > 0) < 0) {
+			clearwinsock();
+			return EXIT_FAILURE;
+		}
+		printf("Canali locali in memoria condivisa su " LOCAL_SOCKET_FORMAT "\n", config.port);
+	}
+
+	if (config.workers > 1) {
+		printf("Server meteo in ascolto sulla porta %u con %d worker\n", config.port, config.workers);
+		const int result = workers_run(&config);
+		if (result == 0 && config.local) {
+			local_drain(DRAIN_TIMEOUT_MS);
+		}
+		clearwinsock();
+		return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	int listen_socket = create_listening_socket(&config);
+	printf("Server meteo in ascolto sulla porta %u\n", config.port);
+	handoff_start(config.handoff_path);
+
+	serve_listener(listen_socket, &config);
+	if (config.local) {
+		local_drain(DRAIN_TIMEOUT_MS);
 	}
 
 	closesocket(listen_socket);
@@ -0,0 +1,376 @@
+/*
+ * metrics.c
+ *
+ * Server instrumentation
+ *
+ * Every serving thread registers its own cache-line-aligned shard on first
+ * use and is the only writer of it: counters are bumped with relaxed
+ * load/store pairs, which compile to plain increments, never to locked
+ * read-modify-writes. The admin thread sums all shards on every scrape, so
+ * the request path shares no cache line with other cores or with scrapes.
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "protocol.h"
+#include "cache.h"
+#include "history.h"
+#include "request_log.h"
+#include "admission.h"
+#include "handoff.h"
+#include "netio.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define METRICS_MAX_SHARDS (MAX_WORKERS * 2)
+#define METRICS_TYPES (WEATHER_TYPE_COUNT + 1) // WEATHER_TYPES order, then anything else
+#define METRICS_STATUSES STATUS_COUNT
+#define METRICS_PAGE_SIZE 8192
+#define CACHE_LINE_SIZE 64
+
+// Upper bounds of the latency buckets in nanoseconds; a final +Inf bucket follows.
+static const uint64_t LATENCY_BOUNDS_NS[] = {
+	50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+	10000000, 25000000, 50000000, 100000000, 250000000, 500000000, 1000000000
+};
+#define LATENCY_BUCKETS (sizeof(LATENCY_BOUNDS_NS) / sizeof(LATENCY_BOUNDS_NS[0]) + 1)
+
+#define TYPE_LABEL(name, type, label, unit, min, max) { type, '\0' },
+static const char TYPE_LABELS[METRICS_TYPES][8] = { WEATHER_METRICS(TYPE_LABEL) "invalid" };
+static const char *STATUS_LABELS[METRICS_STATUSES] = { "success", "city_not_available", "invalid_request" };
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_ullong accepted;
+	atomic_ullong requests[METRICS_TYPES];
+	atomic_ullong responses[METRICS_STATUSES];
+	atomic_ullong bytes_in;
+	atomic_ullong bytes_out;
+	atomic_ullong recv_calls;
+	atomic_ullong partial_recv;
+	atomic_ullong send_calls;
+	atomic_ullong partial_send;
+	atomic_ullong latency[LATENCY_BUCKETS];
+	atomic_ullong latency_sum_ns;
+	atomic_ullong latency_count;
+} metrics_shard_t;
+
+static _Atomic(metrics_shard_t *) shards[METRICS_MAX_SHARDS];
+static atomic_uint shard_count;
+static metrics_shard_t overflow_shard; // Shared fallback once every slot is taken
+static _Thread_local metrics_shard_t *thread_shard;
+
+static inline void bump(atomic_ullong *counter, uint64_t amount) {
+	// Single writer per shard: no atomic read-modify-write needed.
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static metrics_shard_t *register_shard(void) {
+	const unsigned int slot = atomic_fetch_add(&shard_count, 1);
+	metrics_shard_t *shard = NULL;
+	if (slot < METRICS_MAX_SHARDS) {
+		shard = aligned_alloc(CACHE_LINE_SIZE, sizeof(*shard));
+	}
+	if (shard == NULL) {
+		// Racy but harmless: counts from extra threads may lose increments.
+		thread_shard = &overflow_shard;
+		return thread_shard;
+	}
+	memset(shard, 0, sizeof(*shard));
+	atomic_store_explicit(&shards[slot], shard, memory_order_release);
+	thread_shard = shard;
+	return shard;
+}
+
+static inline metrics_shard_t *local_shard(void) {
+	return thread_shard != NULL ? thread_shard : register_shard();
+}
+
+uint64_t metrics_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_count_accept(void) {
+	bump(&local_shard()->accepted, 1);
+}
+
+void metrics_count_request(char type, unsigned int status) {
+	metrics_shard_t *shard = local_shard();
+	const int known_type = weather_type_index(type);
+	const int type_index = known_type >= 0 ? known_type : METRICS_TYPES - 1;
+	bump(&shard->requests[type_index], 1);
+	if (status < METRICS_STATUSES) {
+		bump(&shard->responses[status], 1);
+	}
+}
+
+void metrics_count_recv(size_t received, int partial) {
+	metrics_shard_t *shard = local_shard();
+	bump(&shard->recv_calls, 1);
+	bump(&shard->bytes_in, received);
+	if (partial) {
+		bump(&shard->partial_recv, 1);
+	}
+}
+
+void metrics_count_send(size_t sent, size_t requested) {
+	metrics_shard_t *shard = local_shard();
+	bump(&shard->send_calls, 1);
+	bump(&shard->bytes_out, sent);
+	if (sent < requested) {
+		bump(&shard->partial_send, 1);
+	}
+}
+
+void metrics_observe_latency(uint64_t elapsed_ns) {
+	metrics_shard_t *shard = local_shard();
+	size_t bucket = 0;
+	while (bucket < LATENCY_BUCKETS - 1 && elapsed_ns > LATENCY_BOUNDS_NS[bucket]) {
+		++bucket;
+	}
+	bump(&shard->latency[bucket], 1);
+	bump(&shard->latency_sum_ns, elapsed_ns);
+	bump(&shard->latency_count, 1);
+}
+
+static void add_shard(metrics_shard_t *total, const metrics_shard_t *shard) {
+	// Every field is an atomic_ullong, so the shard can be summed as an array of them.
+	const atomic_ullong *from = &shard->accepted;
+	atomic_ullong *to = &total->accepted;
+	const size_t fields = (offsetof(metrics_shard_t, latency_count) + sizeof(atomic_ullong)) / sizeof(atomic_ullong);
+	for (size_t i = 0; i < fields; ++i) {
+		const uint64_t value = atomic_load_explicit(&from[i], memory_order_relaxed);
+		atomic_store_explicit(&to[i], atomic_load_explicit(&to[i], memory_order_relaxed) + value, memory_order_relaxed);
+	}
+}
+
+#define COUNTER(total, field) ((unsigned long long)atomic_load_explicit(&(total).field, memory_order_relaxed))
+
+// Renders the aggregated counters as Prometheus text; returns the length written.
+static size_t render_metrics(char *page, size_t size) {
+	static metrics_shard_t total;
+	memset(&total, 0, sizeof(total));
+	unsigned int count = atomic_load_explicit(&shard_count, memory_order_acquire);
+	if (count > METRICS_MAX_SHARDS) {
+		count = METRICS_MAX_SHARDS;
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		const metrics_shard_t *shard = atomic_load_explicit(&shards[i], memory_order_acquire);
+		if (shard != NULL) {
+			add_shard(&total, shard);
+		}
+	}
+	add_shard(&total, &overflow_shard);
+
+	size_t used = 0;
+#define EMIT(...) do { \
+		int written_ = snprintf(page + used, size - used, __VA_ARGS__); \
+		if (written_ < 0 || (size_t)written_ >= size - used) { return used; } \
+		used += (size_t)written_; \
+	} while (0)
+
+	EMIT("# HELP weather_connections_accepted_total Connections accepted.\n"
+			"# TYPE weather_connections_accepted_total counter\n"
+			"weather_connections_accepted_total %llu\n", COUNTER(total, accepted));
+
+	EMIT("# HELP weather_requests_total Requests received, by type.\n"
+			"# TYPE weather_requests_total counter\n");
+	for (int i = 0; i < METRICS_TYPES; ++i) {
+		EMIT("weather_requests_total{type=\"%s\"} %llu\n", TYPE_LABELS[i], COUNTER(total, requests[i]));
+	}
+
+	EMIT("# HELP weather_responses_total Responses sent, by status.\n"
+			"# TYPE weather_responses_total counter\n");
+	for (int i = 0; i < METRICS_STATUSES; ++i) {
+		EMIT("weather_responses_total{status=\"%s\"} %llu\n", STATUS_LABELS[i], COUNTER(total, responses[i]));
+	}
+
+	EMIT("# HELP weather_bytes_received_total Bytes read from clients.\n"
+			"# TYPE weather_bytes_received_total counter\n"
+			"weather_bytes_received_total %llu\n", COUNTER(total, bytes_in));
+	EMIT("# HELP weather_bytes_sent_total Bytes written to clients.\n"
+			"# TYPE weather_bytes_sent_total counter\n"
+			"weather_bytes_sent_total %llu\n", COUNTER(total, bytes_out));
+	EMIT("# HELP weather_recv_calls_total recv() calls that returned data.\n"
+			"# TYPE weather_recv_calls_total counter\n"
+			"weather_recv_calls_total %llu\n", COUNTER(total, recv_calls));
+	EMIT("# HELP weather_partial_recv_total recv() calls that continued a fragmented request.\n"
+			"# TYPE weather_partial_recv_total counter\n"
+			"weather_partial_recv_total %llu\n", COUNTER(total, partial_recv));
+	EMIT("# HELP weather_send_calls_total send() calls that wrote data.\n"
+			"# TYPE weather_send_calls_total counter\n"
+			"weather_send_calls_total %llu\n", COUNTER(total, send_calls));
+	EMIT("# HELP weather_partial_send_total send() calls that wrote less than requested.\n"
+			"# TYPE weather_partial_send_total counter\n"
+			"weather_partial_send_total %llu\n", COUNTER(total, partial_send));
+
+	EMIT("# HELP weather_response_latency_seconds Time from accept (or from the arrival of a pipelined request) to the response being sent.\n"
+			"# TYPE weather_response_latency_seconds histogram\n");
+	unsigned long long cumulative = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		cumulative += COUNTER(total, latency[i]);
+		if (i < LATENCY_BUCKETS - 1) {
+			EMIT("weather_response_latency_seconds_bucket{le=\"%g\"} %llu\n", (double)LATENCY_BOUNDS_NS[i] / 1e9, cumulative);
+		} else {
+			EMIT("weather_response_latency_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+		}
+	}
+	EMIT("weather_response_latency_seconds_sum %.9f\n", (double)COUNTER(total, latency_sum_ns) / 1e9);
+	EMIT("weather_response_latency_seconds_count %llu\n", COUNTER(total, latency_count));
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	weather_cache_stats(&hits, &misses);
+	EMIT("# HELP weather_cache_lookups_total Value cache lookups, by result.\n"
+			"# TYPE weather_cache_lookups_total counter\n"
+			"weather_cache_lookups_total{result=\"hit\"} %llu\n"
+			"weather_cache_lookups_total{result=\"miss\"} %llu\n",
+			(unsigned long long)hits, (unsigned long long)misses);
+	EMIT("# HELP weather_log_dropped_total Request log records dropped on a full ring.\n"
+			"# TYPE weather_log_dropped_total counter\n"
+			"weather_log_dropped_total %llu\n", (unsigned long long)request_log_dropped());
+	EMIT("# HELP weather_history_dropped_total Samples not recorded because the history table had no room for their series.\n"
+			"# TYPE weather_history_dropped_total counter\n"
+			"weather_history_dropped_total %llu\n", (unsigned long long)history_dropped());
+
+	admission_stats_t admission;
+	admission_stats(&admission);
+	EMIT("# HELP weather_connections_active Connections being served (tracked with --max-conn).\n"
+			"# TYPE weather_connections_active gauge\n"
+			"weather_connections_active %llu\n", (unsigned long long)admission.active);
+	EMIT("# HELP weather_connections_rejected_total Connections refused at accept time, by reason.\n"
+			"# TYPE weather_connections_rejected_total counter\n"
+			"weather_connections_rejected_total{reason=\"max_connections\"} %llu\n"
+			"weather_connections_rejected_total{reason=\"rate_limit\"} %llu\n",
+			(unsigned long long)admission.rejected_busy, (unsigned long long)admission.rejected_rate);
+	EMIT("# HELP weather_datagrams_rate_limited_total UDP queries dropped by the per-address rate limit.\n"
+			"# TYPE weather_datagrams_rate_limited_total counter\n"
+			"weather_datagrams_rate_limited_total %llu\n", (unsigned long long)admission.datagrams_rate_limited);
+	EMIT("# HELP weather_connections_timed_out_total Connections closed by a deadline, by deadline.\n"
+			"# TYPE weather_connections_timed_out_total counter\n"
+			"weather_connections_timed_out_total{deadline=\"read\"} %llu\n"
+			"weather_connections_timed_out_total{deadline=\"write\"} %llu\n",
+			(unsigned long long)admission.timed_out_read, (unsigned long long)admission.timed_out_write);
+
+#undef EMIT
+	return used;
+}
+
+#if !defined WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#define ADMIN_POLL_MS 100 // How soon the admin thread notices a handoff
+#define ADMIN_RETRY_MS 100 // Pause after a failed accept()
+
+static int admin_socket = -1;
+
+static void *admin_main(void *arg) {
+	(void)arg;
+	static char page[METRICS_PAGE_SIZE];
+	char response[METRICS_PAGE_SIZE + 256];
+
+	// After a handoff the socket is shared with the new server, which answers from then on.
+	while (!handoff_draining()) {
+		struct pollfd pfd = { admin_socket, POLLIN, 0 };
+		if (poll(&pfd, 1, ADMIN_POLL_MS) <= 0 || handoff_draining()) {
+			continue;
+		}
+		// Non-blocking: the new server may take the connection first.
+		int client_socket = accept(admin_socket, NULL, NULL);
+		if (client_socket < 0) {
+			if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK) {
+				// Out of descriptors or memory: the connection stays queued, so back off instead of spinning.
+				perror("accept() sulla porta di amministrazione fallita");
+				const struct timespec pause = { 0, ADMIN_RETRY_MS * 1000000L };
+				nanosleep(&pause, NULL);
+			}
+			continue;
+		}
+
+		// Any request gets the metrics page; the request itself is read and ignored.
+		char request[1024];
+		struct timeval timeout = { 1, 0 };
+		setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		if (recv(client_socket, request, sizeof(request), 0) >= 0) {
+			const size_t body_length = render_metrics(page, sizeof(page));
+			int header_length = snprintf(response, sizeof(response),
+					"HTTP/1.0 200 OK\r\n"
+					"Content-Type: text/plain; version=0.0.4\r\n"
+					"Content-Length: %zu\r\n"
+					"Connection: close\r\n\r\n", body_length);
+			if (header_length > 0 && (size_t)header_length + body_length <= sizeof(response)) {
+				memcpy(response + header_length, page, body_length);
+				net_send_all(client_socket, response, (size_t)header_length + body_length, NULL);
+			}
+		}
+		close(client_socket);
+	}
+	return NULL;
+}
+
+int metrics_available(void) {
+	return 1;
+}
+
+int metrics_start(unsigned short port) {
+	admin_socket = handoff_take(HANDOFF_ADMIN, port);
+	if (admin_socket < 0) {
+		admin_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (admin_socket < 0) {
+			perror("socket() fallita");
+			return -1;
+		}
+
+		int enable = 1;
+		setsockopt(admin_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+		struct sockaddr_in admin_addr = build_server_address(port);
+		if (bind(admin_socket, (struct sockaddr *)&admin_addr, sizeof(admin_addr)) < 0 || listen(admin_socket, QUEUE_SIZE) < 0) {
+			perror("bind() della porta di amministrazione fallita");
+			close(admin_socket);
+			admin_socket = -1;
+			return -1;
+		}
+	}
+	handoff_register(HANDOFF_ADMIN, admin_socket);
+	fcntl(admin_socket, F_SETFL, fcntl(admin_socket, F_GETFL) | O_NONBLOCK);
+
+	pthread_t thread;
+	int result = pthread_create(&thread, NULL, admin_main, NULL);
+	if (result != 0) {
+		fprintf(stderr, "pthread_create() fallita: %s\n", strerror(result));
+		close(admin_socket);
+		admin_socket = -1;
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+#else
+
+int metrics_available(void) {
+	return 0;
+}
+
+int metrics_start(unsigned short port) {
+	(void)port;
+	(void)render_metrics;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * metrics.h
+ *
+ * Server instrumentation
+ * Per-thread counters and latency histograms, summed only when the admin
+ * port (-m) is scraped and served in the Prometheus text format.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returns 1 when the admin endpoint can be served on this platform.
+int metrics_available(void);
+
+// Starts the admin listener thread on port; returns -1 if it could not be bound.
+int metrics_start(unsigned short port);
+
+// Monotonic clock in nanoseconds, the time base of the latency histogram.
+uint64_t metrics_now_ns(void);
+
+// Hot-path hooks: each one only touches the calling thread's counters.
+void metrics_count_accept(void);
+void metrics_count_request(char type, unsigned int status);
+// A partial iteration is a recv() continuing a fragmented request or a send() shorter than requested.
+void metrics_count_recv(size_t received, int partial);
+void metrics_count_send(size_t sent, size_t requested);
+void metrics_observe_latency(uint64_t elapsed_ns);
+
+#endif /* METRICS_H_ */
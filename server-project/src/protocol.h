@@ -9,41 +9,93 @@
 #define PROTOCOL_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
-// Shared application parameters
-#define DEFAULT_SERVER_PORT 56700
-#define DEFAULT_SERVER_ADDRESS "127.0.0.1"
-#define BUFFER_SIZE 512
-#define MAX_CITY_LEN 64
-#define RESPONSE_MESSAGE_LEN 256
-#define QUEUE_SIZE 5
+#include "weatherproto.h"
 
-// Application status codes
-#define STATUS_SUCCESS 0
-#define STATUS_CITY_NOT_AVAILABLE 1
-#define STATUS_INVALID_REQUEST 2
+// Server parameters
+#define QUEUE_SIZE 1024 // Default listen() backlog (--backlog)
+#define MAX_BACKLOG 65535
+#define MAX_WORKERS 256
+#define MAX_CACHE_TTL_MS 3600000
+#define DEFAULT_IO_TIMEOUT_MS 10000
+#define MAX_IO_TIMEOUT_MS 3600000
+#define MAX_IP_RATE 1000000
+#define MAX_IP_BURST 1000
+#define DRAIN_TIMEOUT_MS 30000  // Longest wait for open connections after a hot restart
 
+// I/O backends available to the accept/serve loop
+typedef enum {
+	BACKEND_SERIAL, // Blocking accept + handle_client, one client at a time
+	BACKEND_EPOLL,  // Non-blocking event loop (Linux only)
+	BACKEND_URING   // io_uring completion loop (Linux 5.19+), falls back to epoll
+} server_backend_t;
+
+// Runtime configuration built from the command line
 typedef struct {
-	char type;                // Weather data type: 't', 'h', 'w', 'p'
-	char city[MAX_CITY_LEN];  // Null-terminated city name
-} weather_request_t;
+	unsigned short port;
+	server_backend_t backend;
+	int workers;      // Worker threads, each with its own listener and event loop
+	int keep_alive;   // Serve pipelined requests until the client closes the stream
+	const char *catalog_path; // Memory-mapped city catalog (-c), NULL for the built-in list
+	uint64_t seed;    // Base PRNG seed (-S), 0 for a time-based seed
+	unsigned int cache_ttl_ms; // Lifetime of cached values (--cache-ttl), 0 disables the cache
+	unsigned int history_samples; // Samples kept per city and type (--history), 0 disables the history
+	int log_level;    // Request log threshold (-l), a log_level_t
+	unsigned int log_sample; // Log 1 of every N requests per thread (--log-sample)
+	unsigned short metrics_port; // Admin port serving the metrics page (-m), 0 disables it
+	int udp;          // Also answer queries as UDP datagrams on the same port (-u)
+	int backlog;      // listen() backlog (--backlog)
+	unsigned int read_timeout_ms;  // Longest wait for a complete request (--read-timeout), 0 disables it
+	unsigned int write_timeout_ms; // Longest wait for a blocked response to drain (--write-timeout), 0 disables it
+	unsigned int max_connections;  // Concurrent connections before new ones are refused (--max-conn), 0 for no cap
+	unsigned int ip_rate;          // Connections/queries per second per source address (--ip-rate), 0 disables it
+	unsigned int ip_burst;         // Token bucket depth for ip_rate
+	const char *handoff_path;      // Unix socket for hot restarts (--handoff), NULL disables them
+	int local;                     // Also serve shared-memory channels to clients on this host (--local)
+} server_config_t;
 
+// A validated subscribe frame: its interval and the items the server accepted
 typedef struct {
-	unsigned int status; // Response status code
-	char type;           // Echo of the requested type
-	float value;         // Weather data value
-} weather_response_t;
+	unsigned int interval_ms;
+	unsigned int generation; // Catalog generation the city indexes belong to
+	size_t count;
+	struct {
+		unsigned char item; // Position in the subscribe frame, echoed in every update
+		char type;
+		long city_index;
+	} entries[MAX_SUBSCRIBE_ITEMS];
+} subscribe_request_t;
 
 // Function prototypes
 void error_handler(const char *message);
+float weather_generate(int index); // Fresh value of WEATHER_TYPES[index]
 float get_temperature(void);
 float get_humidity(void);
 float get_wind(void);
 float get_pressure(void);
+long find_city(const char *city);
+int weather_value(long city_index, char type, float *value);
 int is_supported_city(const char *city);
-int parse_arguments(int argc, char *argv[], unsigned short *port);
-int create_listening_socket(unsigned short port);
+int parse_arguments(int argc, char *argv[], server_config_t *config);
+int create_listening_socket(const server_config_t *config);
+int create_datagram_socket(const server_config_t *config);
+void reject_connection(int client_socket);
+void set_socket_deadlines(int client_socket, const server_config_t *config);
 struct sockaddr_in build_server_address(unsigned short port);
-void handle_client(int client_socket);
+void log_weather_request(const weather_request_t *request, unsigned int status, uint32_t client_addr);
+void build_weather_response(const weather_request_t *request, weather_response_t *response);
+size_t request_frame_length(const char *data, size_t available);
+// Answers one complete frame. *reply points either at out, where the answer
+// was built, or at a shared read-only template for a constant error answer.
+int process_request_frame(const char *frame, size_t frame_length, uint32_t client_addr, char *out,
+		const char **reply, size_t *reply_len);
+// Answers a subscribe frame with one acknowledgement per item into out and
+// fills subscribe with the accepted items. Returns -1 when nothing was
+// accepted (malformed frame, bad interval or no valid item).
+int process_subscribe_frame(const char *frame, size_t frame_length, uint32_t client_addr,
+		subscribe_request_t *subscribe, char *out, size_t *out_len);
+void handle_client(int client_socket, uint32_t client_addr, const server_config_t *config);
+void serve_listener(int listen_socket, const server_config_t *config);
 
 #endif /* PROTOCOL_H_ */
@@ -0,0 +1,677 @@
+/*
+ * reactor.c
+ *
+ * Event-driven server loop
+ *
+ * Each connection is a small state machine driven by epoll readiness
+ * notifications: buffered input is parsed into requests, responses are
+ * queued in order and flushed, so a slow or stalled client only parks its
+ * own state instead of blocking the accept loop. With keep-alive enabled
+ * a client may pipeline many request frames on one stream.
+ *
+ * A connection waiting for a request sits on the read deadline list, one
+ * waiting for its output to drain on the write deadline list. Both lists
+ * have a single timeout each, so appending keeps them sorted by expiry:
+ * epoll_wait() sleeps until the earliest head expires and expiring is a
+ * walk from the heads.
+ *
+ * A subscribe frame turns the connection into a stream: it leaves the
+ * read deadline list, further input is discarded, and the loop's
+ * subscription hub appends updates to its output buffer. Every connection
+ * that received updates in one pass is flushed once; a subscriber too
+ * slow to drain them loses updates while its buffer is full and is
+ * closed by the write deadline.
+ *
+ * After a hot restart handed the listening socket to a new server, the
+ * loop stops accepting and keeps serving its open connections until the
+ * last one closes or DRAIN_TIMEOUT_MS passes, then returns.
+ */
+
+#define _GNU_SOURCE
+
+#include "reactor.h"
+#include "catalog.h"
+#include "cache.h"
+#include "metrics.h"
+#include "admission.h"
+#include "subscription.h"
+#include "handoff.h"
+#include "wire.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define REACTOR_MAX_EVENTS 256
+// Pipelined requests parsed per wakeup before yielding to other connections.
+#define CONNECTION_MAX_ROUNDS 16
+// Room for at least one maximal request frame plus the start of the next one.
+#define CONNECTION_RX_SIZE (MAX_REQUEST_FRAME_SIZE * 2)
+#define CONNECTION_TX_SIZE (MAX_RESPONSE_FRAME_SIZE * 4)
+
+struct deadline_list;
+
+typedef struct connection {
+	int fd;
+	uint32_t events;                   // Interest currently registered with epoll
+	int closing;                       // Close once the pending output is flushed
+	size_t rx_len;                     // Buffered request bytes not yet parsed
+	size_t tx_len;                     // Buffered response bytes
+	size_t tx_sent;                    // Response bytes already written
+	uint32_t client_addr;              // Peer IPv4 address from accept(), network order
+	uint64_t started_ns;               // Accept or request arrival time, 0 once answered
+	uint64_t deadline_ns;              // Expiry on deadline_list
+	struct deadline_list *deadline_list; // Read or write deadline list, NULL when on none
+	struct connection *deadline_prev;
+	struct connection *deadline_next;
+	struct connection *next_free;      // Free-list link while unused
+	subscription_t *subscription;      // Set once the connection streams updates
+	int updated;                       // On the reactor's updated list
+	struct connection *next_updated;
+	unsigned char rx_buf[CONNECTION_RX_SIZE];
+	unsigned char tx_buf[CONNECTION_TX_SIZE];
+} connection_t;
+
+typedef struct deadline_list {
+	connection_t *head;                // Earliest expiry
+	connection_t *tail;
+	uint64_t timeout_ns;               // 0 when the deadline is disabled
+	deadline_kind_t kind;
+} deadline_list_t;
+
+typedef struct {
+	int epoll_fd;
+	int listen_socket;
+	const server_config_t *config;
+	connection_t *free_list;           // Recycled connection objects
+	deadline_list_t read_deadlines;    // Waiting for a complete request
+	deadline_list_t write_deadlines;   // Waiting for the output to drain
+	subscription_hub_t *hub;           // Streaming subscriptions of this loop
+	connection_t *updated;             // Streams with updates to flush
+	size_t connection_count;           // Open connections
+	uint64_t drain_deadline_ns;        // Set once the listening socket was handed over
+} reactor_t;
+
+static int set_nonblocking(int fd, int enable) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) {
+		return -1;
+	}
+	flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(fd, F_SETFL, flags);
+}
+
+static void deadline_cancel(connection_t *conn) {
+	deadline_list_t *list = conn->deadline_list;
+	if (list == NULL) {
+		return;
+	}
+	if (conn->deadline_prev != NULL) {
+		conn->deadline_prev->deadline_next = conn->deadline_next;
+	} else {
+		list->head = conn->deadline_next;
+	}
+	if (conn->deadline_next != NULL) {
+		conn->deadline_next->deadline_prev = conn->deadline_prev;
+	} else {
+		list->tail = conn->deadline_prev;
+	}
+	conn->deadline_list = NULL;
+	conn->deadline_prev = NULL;
+	conn->deadline_next = NULL;
+}
+
+// (Re)starts the list's deadline for conn, measured from now.
+static void deadline_arm(deadline_list_t *list, connection_t *conn) {
+	deadline_cancel(conn);
+	if (list->timeout_ns == 0) {
+		return;
+	}
+	conn->deadline_ns = metrics_now_ns() + list->timeout_ns;
+	conn->deadline_list = list;
+	conn->deadline_prev = list->tail;
+	if (list->tail != NULL) {
+		list->tail->deadline_next = conn;
+	} else {
+		list->head = conn;
+	}
+	list->tail = conn;
+}
+
+// Milliseconds until the earliest deadline, rounded up, or -1 when none is pending.
+static int deadline_wait_ms(const reactor_t *reactor) {
+	uint64_t earliest = UINT64_MAX;
+	if (reactor->read_deadlines.head != NULL) {
+		earliest = reactor->read_deadlines.head->deadline_ns;
+	}
+	if (reactor->write_deadlines.head != NULL && reactor->write_deadlines.head->deadline_ns < earliest) {
+		earliest = reactor->write_deadlines.head->deadline_ns;
+	}
+	if (earliest == UINT64_MAX) {
+		return -1;
+	}
+	const uint64_t now = metrics_now_ns();
+	return earliest <= now ? 0 : (int)((earliest - now + 999999) / 1000000);
+}
+
+static connection_t *connection_alloc(reactor_t *reactor) {
+	connection_t *conn = reactor->free_list;
+	if (conn != NULL) {
+		reactor->free_list = conn->next_free;
+	} else {
+		conn = malloc(sizeof(*conn));
+		if (conn == NULL) {
+			return NULL;
+		}
+	}
+	// Only the header needs resetting; the buffers are tracked by their lengths.
+	memset(conn, 0, offsetof(connection_t, rx_buf));
+	conn->fd = -1;
+	return conn;
+}
+
+static void connection_close(reactor_t *reactor, connection_t *conn) {
+	deadline_cancel(conn);
+	if (conn->subscription != NULL) {
+		subscription_cancel(reactor->hub, conn->subscription);
+		free(conn->subscription);
+		conn->subscription = NULL;
+	}
+	admission_close();
+	--reactor->connection_count;
+	// close() also removes the descriptor from the epoll interest list.
+	close(conn->fd);
+	conn->fd = -1;
+	conn->next_free = reactor->free_list;
+	reactor->free_list = conn;
+}
+
+static int connection_watch(reactor_t *reactor, connection_t *conn, uint32_t events) {
+	if (conn->events == events) {
+		return 0;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = conn;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+		perror("epoll_ctl() fallita");
+		return -1;
+	}
+	conn->events = events;
+	return 0;
+}
+
+// Acknowledges a subscribe frame and, if any item was accepted, registers
+// the connection with the hub. A refused subscription closes the connection.
+static void connection_subscribe(reactor_t *reactor, connection_t *conn, const char *frame, size_t frame_length) {
+	subscribe_request_t request;
+	size_t ack_length = 0;
+	const int result = process_subscribe_frame(frame, frame_length, conn->client_addr, &request,
+			(char *)conn->tx_buf + conn->tx_len, &ack_length);
+	conn->tx_len += ack_length;
+	if (result < 0) {
+		conn->closing = 1;
+		return;
+	}
+
+	conn->subscription = malloc(sizeof(*conn->subscription));
+	if (conn->subscription == NULL
+			|| subscription_add(reactor->hub, conn->subscription, conn, &request, metrics_now_ns() / 1000000) < 0) {
+		fprintf(stderr, "Memoria insufficiente per una sottoscrizione\n");
+		free(conn->subscription);
+		conn->subscription = NULL;
+		conn->closing = 1;
+	}
+}
+
+// Hub delivery: queues one update, dropped if the subscriber's buffer is full.
+static void connection_deliver(void *context, void *owner, unsigned int item, char type, float value) {
+	reactor_t *reactor = context;
+	connection_t *conn = owner;
+	if (CONNECTION_TX_SIZE - conn->tx_len < WIRE_UPDATE_SIZE) {
+		return;
+	}
+	conn->tx_len += wire_encode_update(conn->tx_buf + conn->tx_len, item, type, value);
+	if (!conn->updated) {
+		conn->updated = 1;
+		conn->next_updated = reactor->updated;
+		reactor->updated = conn;
+	}
+}
+
+// Hub expiry: the stream's cities were renumbered by a catalog reload, so it
+// ends once the updates already queued are flushed.
+static void connection_expire(void *context, void *owner) {
+	reactor_t *reactor = context;
+	connection_t *conn = owner;
+	conn->closing = 1;
+	if (!conn->updated) {
+		conn->updated = 1;
+		conn->next_updated = reactor->updated;
+		reactor->updated = conn;
+	}
+}
+
+// Turns every complete buffered request frame into a response, in arrival
+// order, as long as the output buffer can hold the largest possible answer.
+// Returns the number of frames answered.
+static int connection_process(reactor_t *reactor, connection_t *conn) {
+	size_t offset = 0;
+	int processed = 0;
+	if (conn->subscription != NULL) {
+		// A stream only carries updates: anything the client sends is dropped.
+		conn->rx_len = 0;
+		return 0;
+	}
+
+	while (!conn->closing && CONNECTION_TX_SIZE - conn->tx_len >= MAX_RESPONSE_FRAME_SIZE) {
+		const char *frame = (const char *)conn->rx_buf + offset;
+		size_t frame_length = request_frame_length(frame, conn->rx_len - offset);
+		if (frame_length == 0 || frame_length > conn->rx_len - offset) {
+			break;
+		}
+
+		if (wire_is_subscribe((const unsigned char *)frame, frame_length)) {
+			connection_subscribe(reactor, conn, frame, frame_length);
+			offset += frame_length;
+			++processed;
+			break;
+		}
+
+		char *out = (char *)conn->tx_buf + conn->tx_len;
+		const char *reply = NULL;
+		size_t reply_length = 0;
+		const int frame_result = process_request_frame(frame, frame_length, conn->client_addr, out, &reply, &reply_length);
+		if (reply != out) {
+			// Error template: the output buffer must stay contiguous for a single send.
+			memcpy(out, reply, reply_length);
+		}
+		if (frame_result < 0) {
+			// Framing is lost after a malformed batch header: answer it, then hang up.
+			conn->closing = 1;
+		}
+		conn->tx_len += reply_length;
+		offset += frame_length;
+		++processed;
+
+		if (!reactor->config->keep_alive) {
+			// One request per connection: anything the client sent after it is ignored.
+			conn->closing = 1;
+		}
+	}
+
+	if (conn->subscription != NULL) {
+		conn->rx_len = 0;
+	} else if (offset > 0) {
+		memmove(conn->rx_buf, conn->rx_buf + offset, conn->rx_len - offset);
+		conn->rx_len -= offset;
+	}
+	return processed;
+}
+
+// Writes as much pending output as the socket accepts.
+// Returns 1 when everything was sent, 0 if it must wait for EPOLLOUT, -1 on error.
+static int connection_flush(connection_t *conn) {
+	while (conn->tx_sent < conn->tx_len) {
+		ssize_t sent = send(conn->fd, conn->tx_buf + conn->tx_sent, conn->tx_len - conn->tx_sent, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			perror("send() fallita");
+			return -1;
+		}
+		metrics_count_send((size_t)sent, conn->tx_len - conn->tx_sent);
+		conn->tx_sent += (size_t)sent;
+	}
+	if (conn->tx_len > 0 && conn->started_ns != 0) {
+		metrics_observe_latency(metrics_now_ns() - conn->started_ns);
+		conn->started_ns = 0;
+	}
+	conn->tx_len = 0;
+	conn->tx_sent = 0;
+	return 1;
+}
+
+// Reads whatever is available into the input buffer.
+// Returns 1 on data, 0 if the socket would block, -1 on EOF or error.
+static int connection_fill(connection_t *conn) {
+	if (conn->rx_len == CONNECTION_RX_SIZE) {
+		// Still holding unparsed requests: process them before reading more.
+		return 1;
+	}
+
+	while (1) {
+		ssize_t received = recv(conn->fd, conn->rx_buf + conn->rx_len, CONNECTION_RX_SIZE - conn->rx_len, 0);
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			perror("recv() fallita");
+			return -1;
+		}
+		if (received == 0) {
+			return -1;
+		}
+		metrics_count_recv((size_t)received, conn->rx_len > 0);
+		if (conn->started_ns == 0) {
+			conn->started_ns = metrics_now_ns();
+		}
+		conn->rx_len += (size_t)received;
+		return 1;
+	}
+}
+
+// Drives a connection as far as it can go without blocking: parse buffered
+// requests, flush responses, read more input, and park on the right event.
+static void connection_pump(reactor_t *reactor, connection_t *conn) {
+	int processed = 0;
+	for (int round = 0; round < CONNECTION_MAX_ROUNDS; ++round) {
+		processed += connection_process(reactor, conn);
+
+		int flushed = connection_flush(conn);
+		if (flushed < 0) {
+			connection_close(reactor, conn);
+			return;
+		}
+		if (flushed == 0) {
+			// Backpressure: stop reading until the client drains its responses.
+			if (connection_watch(reactor, conn, EPOLLOUT) < 0) {
+				connection_close(reactor, conn);
+				return;
+			}
+			// Partial progress does not extend the write deadline.
+			if (conn->deadline_list != &reactor->write_deadlines) {
+				deadline_arm(&reactor->write_deadlines, conn);
+			}
+			return;
+		}
+		if (conn->closing) {
+			connection_close(reactor, conn);
+			return;
+		}
+
+		if (round == CONNECTION_MAX_ROUNDS - 1) {
+			// Yield without reading: input read now would sit unparsed with no event to resume it.
+			break;
+		}
+
+		int filled = connection_fill(conn);
+		if (filled < 0) {
+			// EOF or error: answer whatever complete requests are still buffered, then close.
+			connection_process(reactor, conn);
+			conn->closing = 1;
+			continue;
+		}
+		if (filled == 0) {
+			break;
+		}
+	}
+
+	// Level-triggered EPOLLIN brings us back if more input is already queued.
+	if (connection_watch(reactor, conn, EPOLLIN | EPOLLRDHUP) < 0) {
+		connection_close(reactor, conn);
+		return;
+	}
+	if (conn->subscription != NULL) {
+		// Streams are idle by design: no read deadline.
+		deadline_cancel(conn);
+	} else if (processed > 0 || conn->deadline_list != &reactor->read_deadlines) {
+		// The read deadline restarts with each answered request, not with each fragment.
+		deadline_arm(&reactor->read_deadlines, conn);
+	}
+}
+
+// Fires the due subscription topics, then flushes every stream that got updates.
+static void push_updates(reactor_t *reactor) {
+	subscription_advance(reactor->hub, metrics_now_ns() / 1000000);
+
+	connection_t *conn = reactor->updated;
+	reactor->updated = NULL;
+	while (conn != NULL) {
+		connection_t *next = conn->next_updated;
+		conn->updated = 0;
+		conn->next_updated = NULL;
+		// started_ns is for request latency; pushes are not answers to a request.
+		conn->started_ns = 0;
+
+		if (conn->events & EPOLLOUT) {
+			// Already waiting to drain: EPOLLOUT flushes the new updates too.
+		} else {
+			int flushed = connection_flush(conn);
+			if (flushed < 0 || (flushed > 0 && conn->closing)) {
+				connection_close(reactor, conn);
+			} else if (flushed == 0) {
+				if (connection_watch(reactor, conn, EPOLLOUT) < 0) {
+					connection_close(reactor, conn);
+				} else {
+					deadline_arm(&reactor->write_deadlines, conn);
+				}
+			}
+		}
+		conn = next;
+	}
+}
+
+// Sleep until the earliest deadline or subscription tick, -1 for neither.
+static int reactor_wait_ms(const reactor_t *reactor) {
+	const uint64_t now = metrics_now_ns();
+	int deadline_ms = deadline_wait_ms(reactor);
+	if (reactor->drain_deadline_ns != 0) {
+		const int drain_ms = reactor->drain_deadline_ns <= now ? 0 : (int)((reactor->drain_deadline_ns - now + 999999) / 1000000);
+		deadline_ms = deadline_ms >= 0 && deadline_ms < drain_ms ? deadline_ms : drain_ms;
+	}
+	const int update_ms = subscription_wait_ms(reactor->hub, now / 1000000);
+	if (deadline_ms < 0) {
+		return update_ms;
+	}
+	return update_ms >= 0 && update_ms < deadline_ms ? update_ms : deadline_ms;
+}
+
+// The listening socket now belongs to a new server: stop accepting and
+// give the open connections DRAIN_TIMEOUT_MS to finish.
+static void start_drain(reactor_t *reactor) {
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, reactor->listen_socket, NULL);
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, handoff_wake_fd(), NULL);
+	reactor->drain_deadline_ns = metrics_now_ns() + (uint64_t)DRAIN_TIMEOUT_MS * 1000000;
+}
+
+static int drained(const reactor_t *reactor) {
+	return reactor->drain_deadline_ns != 0
+			&& (reactor->connection_count == 0 || metrics_now_ns() >= reactor->drain_deadline_ns);
+}
+
+// Closes every connection whose deadline has passed.
+static void expire_connections(reactor_t *reactor) {
+	deadline_list_t *lists[2] = { &reactor->read_deadlines, &reactor->write_deadlines };
+	if (lists[0]->head == NULL && lists[1]->head == NULL) {
+		return;
+	}
+
+	const uint64_t now = metrics_now_ns();
+	for (int i = 0; i < 2; ++i) {
+		while (lists[i]->head != NULL && lists[i]->head->deadline_ns <= now) {
+			admission_count_timeout(lists[i]->kind);
+			connection_close(reactor, lists[i]->head);
+		}
+	}
+}
+
+static void accept_connections(reactor_t *reactor) {
+	while (1) {
+		struct sockaddr_in client_addr;
+		socklen_t client_addr_len = sizeof(client_addr);
+		int client_socket = accept4(reactor->listen_socket, (struct sockaddr *)&client_addr, &client_addr_len, SOCK_NONBLOCK);
+		if (client_socket < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("accept() fallita");
+			}
+			return;
+		}
+
+		metrics_count_accept();
+		if (admission_open(client_addr.sin_addr.s_addr) != ADMISSION_ACCEPTED) {
+			reject_connection(client_socket);
+			continue;
+		}
+
+		connection_t *conn = connection_alloc(reactor);
+		if (conn == NULL) {
+			fprintf(stderr, "Memoria insufficiente per una nuova connessione\n");
+			close(client_socket);
+			admission_close();
+			continue;
+		}
+
+		conn->fd = client_socket;
+		++reactor->connection_count;
+		conn->started_ns = metrics_now_ns();
+		// The peer address is already known from accept(): no getpeername() needed,
+		// and it is only turned into text by the log writer.
+		conn->client_addr = client_addr.sin_addr.s_addr;
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = conn;
+		if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+			perror("epoll_ctl() fallita");
+			connection_close(reactor, conn);
+			continue;
+		}
+		conn->events = event.events;
+		deadline_arm(&reactor->read_deadlines, conn);
+	}
+}
+
+int reactor_available(void) {
+	return 1;
+}
+
+int reactor_run(int listen_socket, const server_config_t *config) {
+	reactor_t reactor;
+	memset(&reactor, 0, sizeof(reactor));
+	reactor.listen_socket = listen_socket;
+	reactor.config = config;
+	reactor.read_deadlines.timeout_ns = (uint64_t)config->read_timeout_ms * 1000000;
+	reactor.read_deadlines.kind = DEADLINE_READ;
+	reactor.write_deadlines.timeout_ns = (uint64_t)config->write_timeout_ms * 1000000;
+	reactor.write_deadlines.kind = DEADLINE_WRITE;
+
+	reactor.hub = subscription_hub_create(connection_deliver, connection_expire, &reactor);
+	if (reactor.hub == NULL) {
+		fprintf(stderr, "Memoria insufficiente per le sottoscrizioni\n");
+		return -1;
+	}
+
+	reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor.epoll_fd < 0) {
+		perror("epoll_create1() fallita");
+		subscription_hub_destroy(reactor.hub);
+		return -1;
+	}
+
+	if (set_nonblocking(listen_socket, 1) < 0) {
+		perror("fcntl() fallita");
+		close(reactor.epoll_fd);
+		subscription_hub_destroy(reactor.hub);
+		return -1;
+	}
+
+	// The listening socket is registered with a NULL pointer to tell it apart from clients.
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) < 0) {
+		perror("epoll_ctl() fallita");
+		set_nonblocking(listen_socket, 0);
+		close(reactor.epoll_fd);
+		subscription_hub_destroy(reactor.hub);
+		return -1;
+	}
+
+	// The handoff pipe is registered with the reactor's own address.
+	const int wake_fd = handoff_wake_fd();
+	event.events = EPOLLIN;
+	event.data.ptr = &reactor;
+	if (wake_fd >= 0 && epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+		perror("epoll_ctl() fallita");
+	}
+
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	while (!drained(&reactor)) {
+		int ready = epoll_wait(reactor.epoll_fd, events, REACTOR_MAX_EVENTS, reactor_wait_ms(&reactor));
+		catalog_poll_reload();
+		weather_cache_poll_report();
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait() fallita");
+			break;
+		}
+
+		for (int i = 0; i < ready; ++i) {
+			connection_t *conn = events[i].data.ptr;
+			if (conn == NULL) {
+				accept_connections(&reactor);
+			} else if (events[i].data.ptr == &reactor) {
+				start_drain(&reactor);
+			} else {
+				connection_pump(&reactor, conn);
+			}
+		}
+		push_updates(&reactor);
+		expire_connections(&reactor);
+	}
+
+	if (reactor.drain_deadline_ns != 0) {
+		// Connections still open past the drain timeout are dropped when the process exits.
+		close(reactor.epoll_fd);
+		return 0;
+	}
+
+	// Only reached on a fatal epoll error: hand the socket back in blocking mode.
+	set_nonblocking(listen_socket, 0);
+	close(reactor.epoll_fd);
+	subscription_hub_destroy(reactor.hub);
+	return -1;
+}
+
+#else
+
+int reactor_available(void) {
+	return 0;
+}
+
+int reactor_run(int listen_socket, const server_config_t *config) {
+	(void)listen_socket;
+	(void)config;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * reactor.h
+ *
+ * Event-driven server loop
+ * Non-blocking epoll reactor that multiplexes many client connections
+ * on a single thread (Linux only).
+ */
+
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include "protocol.h"
+
+// Returns 1 when the epoll backend is compiled in for this platform.
+int reactor_available(void);
+
+// Serves clients from listen_socket until a fatal error; returns -1 if the
+// event loop could not be set up (the caller may fall back to another backend)
+// and 0 once the socket was handed to a new server and the open connections
+// were drained.
+int reactor_run(int listen_socket, const server_config_t *config);
+
+#endif /* REACTOR_H_ */
@@ -0,0 +1,242 @@
+/*
+ * request_log.c
+ *
+ * Asynchronous request log
+ *
+ * Every thread that logs owns a single-producer ring of fixed-size records,
+ * registered on its first record. The writer thread is the only consumer:
+ * it drains all rings in turn, formats the lines into one buffer and writes
+ * it with a single fwrite + fflush. Producers touch only their own ring
+ * and a thread-local sampling counter, so there is no shared lock or
+ * contended cache line on the request path.
+ */
+
+#define _GNU_SOURCE
+
+#include "request_log.h"
+
+#if defined WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_RING_SIZE 4096 // Records per thread, power of two
+#define LOG_MAX_RINGS (MAX_WORKERS * 2)
+#define LOG_LINE_LEN (MAX_CITY_LEN + 64)
+#define LOG_WRITE_BUFFER 65536
+#define LOG_IDLE_SLEEP_NS 2000000L
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+	uint32_t client_addr; // IPv4 address, network order
+	unsigned char status;
+	char type;
+	char city[MAX_CITY_LEN];
+} log_record_t;
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head; // Written by the producer
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail; // Written by the writer thread
+	_Alignas(CACHE_LINE_SIZE) atomic_ullong dropped;
+	log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+static log_level_t threshold = LOG_LEVEL_INFO;
+static unsigned int sample_every = 1;
+static int asynchronous;
+static _Atomic(log_ring_t *) rings[LOG_MAX_RINGS];
+static atomic_uint ring_count;
+static atomic_ullong unregistered_dropped; // Records from threads that got no ring
+static _Thread_local log_ring_t *thread_ring;
+static _Thread_local int thread_ring_failed;
+static _Thread_local unsigned int thread_sample_counter;
+
+static void format_record(const log_record_t *record, char *line, size_t line_size, int *length) {
+	char client_ip[INET_ADDRSTRLEN];
+	struct in_addr addr;
+	addr.s_addr = record->client_addr;
+	if (inet_ntop(AF_INET, &addr, client_ip, sizeof(client_ip)) == NULL) {
+		strcpy(client_ip, "sconosciuto");
+	}
+	*length = snprintf(line, line_size, "Richiesta '%c %.*s' dal client ip %s\n",
+			record->type, MAX_CITY_LEN - 1, record->city, client_ip);
+}
+
+static void write_record(const log_record_t *record) {
+	char line[LOG_LINE_LEN];
+	int length = 0;
+	format_record(record, line, sizeof(line), &length);
+	fputs(line, stdout);
+}
+
+static log_ring_t *register_ring(void) {
+	if (thread_ring_failed) {
+		return NULL;
+	}
+
+	const unsigned int slot = atomic_fetch_add(&ring_count, 1);
+	log_ring_t *ring = slot < LOG_MAX_RINGS ? calloc(1, sizeof(*ring)) : NULL;
+	if (ring == NULL) {
+		thread_ring_failed = 1;
+		return NULL;
+	}
+	atomic_store_explicit(&rings[slot], ring, memory_order_release);
+	thread_ring = ring;
+	return ring;
+}
+
+void request_log_push(const weather_request_t *request, unsigned int status, uint32_t client_addr) {
+	const log_level_t level = status == STATUS_SUCCESS ? LOG_LEVEL_INFO : LOG_LEVEL_WARN;
+	if (level > threshold) {
+		return;
+	}
+	if (sample_every > 1 && thread_sample_counter++ % sample_every != 0) {
+		return;
+	}
+
+	log_record_t record;
+	record.client_addr = client_addr;
+	record.status = (unsigned char)status;
+	record.type = request->type;
+	memcpy(record.city, request->city, sizeof(record.city));
+
+	if (!asynchronous) {
+		write_record(&record);
+		return;
+	}
+
+	log_ring_t *ring = thread_ring != NULL ? thread_ring : register_ring();
+	if (ring == NULL) {
+		atomic_fetch_add_explicit(&unregistered_dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail >= LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	ring->records[head & (LOG_RING_SIZE - 1)] = record;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+uint64_t request_log_dropped(void) {
+	uint64_t total = atomic_load_explicit(&unregistered_dropped, memory_order_relaxed);
+	unsigned int count = atomic_load_explicit(&ring_count, memory_order_acquire);
+	if (count > LOG_MAX_RINGS) {
+		count = LOG_MAX_RINGS;
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		const log_ring_t *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+		if (ring != NULL) {
+			total += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		}
+	}
+	return total;
+}
+
+#if !defined WIN32
+
+#include <pthread.h>
+#include <time.h>
+
+// Drains every ring once into buffer, flushing it whenever it fills up.
+// Returns the number of records written.
+static size_t drain_rings(char *buffer, size_t *used) {
+	size_t written = 0;
+	unsigned int count = atomic_load_explicit(&ring_count, memory_order_acquire);
+	if (count > LOG_MAX_RINGS) {
+		count = LOG_MAX_RINGS;
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		log_ring_t *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+		if (ring == NULL) {
+			continue;
+		}
+
+		size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for (; tail != head; ++tail) {
+			if (LOG_WRITE_BUFFER - *used < LOG_LINE_LEN) {
+				fwrite(buffer, 1, *used, stdout);
+				*used = 0;
+			}
+			int length = 0;
+			format_record(&ring->records[tail & (LOG_RING_SIZE - 1)], buffer + *used, LOG_LINE_LEN, &length);
+			if (length > 0) {
+				*used += (size_t)length < LOG_LINE_LEN ? (size_t)length : LOG_LINE_LEN - 1;
+			}
+			++written;
+		}
+		// Hand the slots back only after they have been formatted.
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+	return written;
+}
+
+static void *writer_main(void *arg) {
+	(void)arg;
+	static char buffer[LOG_WRITE_BUFFER];
+	uint64_t reported_dropped = 0;
+
+	while (1) {
+		size_t used = 0;
+		const size_t written = drain_rings(buffer, &used);
+		if (used > 0) {
+			fwrite(buffer, 1, used, stdout);
+			fflush(stdout);
+		}
+
+		const uint64_t dropped = request_log_dropped();
+		if (dropped != reported_dropped) {
+			fprintf(stderr, "Log: %llu record scartati (ring pieno)\n", (unsigned long long)(dropped - reported_dropped));
+			reported_dropped = dropped;
+		}
+
+		if (written == 0) {
+			const struct timespec idle = { 0, LOG_IDLE_SLEEP_NS };
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+int request_log_start(log_level_t level, unsigned int sample) {
+	threshold = level;
+	sample_every = sample > 0 ? sample : 1;
+	if (threshold == LOG_LEVEL_OFF) {
+		return 0;
+	}
+
+	pthread_t writer;
+	int result = pthread_create(&writer, NULL, writer_main, NULL);
+	if (result != 0) {
+		fprintf(stderr, "pthread_create() fallita: %s, log sincrono\n", strerror(result));
+		return -1;
+	}
+	pthread_detach(writer);
+	asynchronous = 1;
+	return 0;
+}
+
+#else
+
+int request_log_start(log_level_t level, unsigned int sample) {
+	// No writer thread: records are formatted and written by the caller.
+	threshold = level;
+	sample_every = sample > 0 ? sample : 1;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * request_log.h
+ *
+ * Asynchronous request log
+ * Serving threads push fixed-size binary records into their own lock-free
+ * ring; a background thread formats and writes them to stdout in batches,
+ * so logging never blocks the request path on the terminal or a pipe.
+ */
+
+#ifndef REQUEST_LOG_H_
+#define REQUEST_LOG_H_
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Record levels, also used as the threshold set with -l
+typedef enum {
+	LOG_LEVEL_OFF = 0,  // Log nothing
+	LOG_LEVEL_WARN = 1, // Only requests answered with an error status
+	LOG_LEVEL_INFO = 2  // Every request
+} log_level_t;
+
+// Sets the threshold, keeps 1 of every `sample` records per thread and starts
+// the writer thread; without threads, records are written synchronously.
+int request_log_start(log_level_t level, unsigned int sample);
+
+// Queues one request record; client_addr is the IPv4 address in network order.
+// Never blocks: a record that does not fit in the ring is counted as dropped.
+void request_log_push(const weather_request_t *request, unsigned int status, uint32_t client_addr);
+
+// Records dropped so far because a ring was full.
+uint64_t request_log_dropped(void);
+
+#endif /* REQUEST_LOG_H_ */
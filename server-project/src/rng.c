@@ -0,0 +1,135 @@
+/*
+ * rng.c
+ *
+ * Per-thread pseudo-random generator
+ *
+ * Each thread owns one scalar xoshiro128+ state for single values and a
+ * bank of RNG_LANES independent states in structure-of-arrays form for
+ * bulk fills. Every state is derived from (base seed, stream, lane) with
+ * splitmix64, so streams never overlap in practice and are reproducible.
+ */
+
+#include "rng.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+#define RNG_LANES 8
+
+typedef struct {
+	uint32_t s[4];
+} rng_scalar_t;
+
+typedef struct {
+	uint32_t s0[RNG_LANES];
+	uint32_t s1[RNG_LANES];
+	uint32_t s2[RNG_LANES];
+	uint32_t s3[RNG_LANES];
+} rng_lanes_t;
+
+static uint64_t base_seed;
+static atomic_uint next_stream;
+
+static _Thread_local int thread_ready;
+static _Thread_local rng_scalar_t thread_scalar;
+static _Thread_local rng_lanes_t thread_lanes;
+
+static uint64_t splitmix64(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint32_t rotl(uint32_t x, int k) {
+	return (x << k) | (x >> (32 - k));
+}
+
+// Top 24 bits of a 32-bit output mapped exactly onto a float in [0, 1).
+static inline float to_unit(uint32_t x) {
+	return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+static uint32_t scalar_next(rng_scalar_t *rng) {
+	uint32_t *s = rng->s;
+	const uint32_t result = s[0] + s[3];
+	const uint32_t t = s[1] << 9;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 11);
+	return result;
+}
+
+void rng_seed(uint64_t seed) {
+	if (seed == 0) {
+		seed = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+	}
+	base_seed = seed;
+}
+
+void rng_thread_init(unsigned int stream) {
+	uint64_t state = base_seed ^ ((uint64_t)stream * 0xd1b54a32d192ed03ULL);
+	for (int i = 0; i < 4; ++i) {
+		thread_scalar.s[i] = (uint32_t)splitmix64(&state);
+	}
+	for (int lane = 0; lane < RNG_LANES; ++lane) {
+		thread_lanes.s0[lane] = (uint32_t)splitmix64(&state);
+		thread_lanes.s1[lane] = (uint32_t)splitmix64(&state);
+		thread_lanes.s2[lane] = (uint32_t)splitmix64(&state);
+		thread_lanes.s3[lane] = (uint32_t)splitmix64(&state);
+	}
+	thread_ready = 1;
+}
+
+static inline void ensure_thread_ready(void) {
+	if (!thread_ready) {
+		if (base_seed == 0) {
+			rng_seed(0);
+		}
+		rng_thread_init(atomic_fetch_add(&next_stream, 1));
+	}
+}
+
+float rng_uniform(float min, float max) {
+	ensure_thread_ready();
+	return min + to_unit(scalar_next(&thread_scalar)) * (max - min);
+}
+
+void rng_fill_unit(float *out, size_t count) {
+	ensure_thread_ready();
+	rng_lanes_t *l = &thread_lanes;
+
+	size_t i = 0;
+	// Advance all lanes in lockstep; each step yields RNG_LANES values.
+	while (i < count) {
+		uint32_t result[RNG_LANES];
+		for (int lane = 0; lane < RNG_LANES; ++lane) {
+			result[lane] = l->s0[lane] + l->s3[lane];
+			const uint32_t t = l->s1[lane] << 9;
+			l->s2[lane] ^= l->s0[lane];
+			l->s3[lane] ^= l->s1[lane];
+			l->s1[lane] ^= l->s2[lane];
+			l->s0[lane] ^= l->s3[lane];
+			l->s2[lane] ^= t;
+			l->s3[lane] = rotl(l->s3[lane], 11);
+		}
+
+		const size_t remaining = count - i;
+		const size_t take = remaining < RNG_LANES ? remaining : RNG_LANES;
+		for (size_t lane = 0; lane < take; ++lane) {
+			out[i + lane] = to_unit(result[lane]);
+		}
+		i += take;
+	}
+}
+
+void rng_fill_uniform(float *out, size_t count, float min, float max) {
+	rng_fill_unit(out, count);
+	const float span = max - min;
+	for (size_t i = 0; i < count; ++i) {
+		out[i] = min + out[i] * span;
+	}
+}
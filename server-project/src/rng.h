@@ -0,0 +1,33 @@
+/*
+ * rng.h
+ *
+ * Per-thread pseudo-random generator
+ * xoshiro128+ streams kept in thread-local state, so the get_* generators
+ * never share hidden state or take a libc lock. A fixed seed (-S) makes
+ * every worker stream reproducible for load tests.
+ */
+
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sets the base seed for all streams; call before any worker starts. 0 picks a time-based seed.
+void rng_seed(uint64_t seed);
+
+// Binds the calling thread to stream number `stream` (e.g. its worker index).
+// Threads that never call it get the next free stream on first use.
+void rng_thread_init(unsigned int stream);
+
+// Uniform float in [min, max).
+float rng_uniform(float min, float max);
+
+// Fills out[0..count) with uniform floats in [0, 1) using several interleaved
+// generator lanes, a layout the compiler can vectorize.
+void rng_fill_unit(float *out, size_t count);
+
+// Fills out[0..count) with uniform floats in [min, max).
+void rng_fill_uniform(float *out, size_t count, float min, float max);
+
+#endif /* RNG_H_ */
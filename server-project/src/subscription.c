@@ -0,0 +1,238 @@
+/*
+ * subscription.c
+ *
+ * Streaming subscriptions
+ *
+ * Topics sit on a hashed timer wheel of SUBSCRIPTION_WHEEL_SLOTS slots,
+ * one per tick; a topic due more than a turn away stays in its slot and
+ * is skipped until the turn it is due. Advancing visits only the slots of
+ * the ticks that elapsed, so the cost follows the number of due topics,
+ * not the number of subscribers or the length of the intervals.
+ *
+ * A topic is found again by (city, type, interval, catalog generation)
+ * through a small hash table, so new subscribers join the existing
+ * schedule while those of a reloaded catalog never share a topic with the
+ * old ones. Topics whose last subscriber left are freed lazily, when the
+ * wheel reaches them.
+ */
+
+#include "subscription.h"
+#include "catalog.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct subscription_topic {
+	long city_index;
+	unsigned int generation;           // Catalog generation city_index belongs to
+	char type;
+	uint64_t interval_ticks;
+	uint64_t due_tick;
+	subscription_link_t *subscribers;
+	subscription_topic_t *wheel_next;  // Same wheel slot
+	subscription_topic_t *hash_next;   // Same hash bucket
+};
+
+struct subscription_hub {
+	subscription_deliver_t deliver;
+	subscription_expire_t expire;
+	void *context;
+	uint64_t tick;                     // Last tick processed
+	size_t topic_count;
+	subscription_topic_t *wheel[SUBSCRIPTION_WHEEL_SLOTS];
+	subscription_topic_t *topics[SUBSCRIPTION_HASH_BUCKETS];
+};
+
+static size_t topic_bucket(long city_index, char type, uint64_t interval_ticks) {
+	// The generation is left out: topics of two generations at most coexist, briefly.
+	uint64_t key = (uint64_t)city_index * 0x9e3779b97f4a7c15ULL;
+	key ^= ((uint64_t)(unsigned char)type << 56) ^ interval_ticks;
+	key ^= key >> 31;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 29;
+	return (size_t)(key % SUBSCRIPTION_HASH_BUCKETS);
+}
+
+static void wheel_insert(subscription_hub_t *hub, subscription_topic_t *topic) {
+	const size_t slot = (size_t)(topic->due_tick % SUBSCRIPTION_WHEEL_SLOTS);
+	topic->wheel_next = hub->wheel[slot];
+	hub->wheel[slot] = topic;
+}
+
+static subscription_topic_t *topic_get(subscription_hub_t *hub, long city_index, unsigned int generation, char type,
+		uint64_t interval_ticks) {
+	const size_t bucket = topic_bucket(city_index, type, interval_ticks);
+	for (subscription_topic_t *topic = hub->topics[bucket]; topic != NULL; topic = topic->hash_next) {
+		if (topic->city_index == city_index && topic->generation == generation && topic->type == type
+				&& topic->interval_ticks == interval_ticks) {
+			return topic;
+		}
+	}
+
+	subscription_topic_t *topic = calloc(1, sizeof(*topic));
+	if (topic == NULL) {
+		return NULL;
+	}
+	topic->city_index = city_index;
+	topic->generation = generation;
+	topic->type = type;
+	topic->interval_ticks = interval_ticks;
+	topic->due_tick = hub->tick + interval_ticks;
+	topic->hash_next = hub->topics[bucket];
+	hub->topics[bucket] = topic;
+	wheel_insert(hub, topic);
+	++hub->topic_count;
+	return topic;
+}
+
+// Frees a topic already taken off the wheel.
+static void topic_free(subscription_hub_t *hub, subscription_topic_t *topic) {
+	subscription_topic_t **link = &hub->topics[topic_bucket(topic->city_index, topic->type, topic->interval_ticks)];
+	while (*link != topic) {
+		link = &(*link)->hash_next;
+	}
+	*link = topic->hash_next;
+	free(topic);
+	--hub->topic_count;
+}
+
+// One value per topic, whatever the number of subscribers.
+static void topic_fire(subscription_hub_t *hub, const subscription_topic_t *topic) {
+	if (topic->generation != catalog_generation()) {
+		// city_index may name another city now: the subscribers are cancelled, not misled.
+		for (const subscription_link_t *link = topic->subscribers; link != NULL; link = link->next) {
+			hub->expire(hub->context, link->owner);
+		}
+		return;
+	}
+
+	float value = 0.0f;
+	if (weather_value(topic->city_index, topic->type, &value) < 0) {
+		return;
+	}
+	for (const subscription_link_t *link = topic->subscribers; link != NULL; link = link->next) {
+		hub->deliver(hub->context, link->owner, link->item, topic->type, value);
+	}
+}
+
+subscription_hub_t *subscription_hub_create(subscription_deliver_t deliver, subscription_expire_t expire, void *context) {
+	subscription_hub_t *hub = calloc(1, sizeof(*hub));
+	if (hub == NULL) {
+		return NULL;
+	}
+	hub->deliver = deliver;
+	hub->expire = expire;
+	hub->context = context;
+	return hub;
+}
+
+void subscription_hub_destroy(subscription_hub_t *hub) {
+	if (hub == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < SUBSCRIPTION_HASH_BUCKETS; ++i) {
+		subscription_topic_t *topic = hub->topics[i];
+		while (topic != NULL) {
+			subscription_topic_t *next = topic->hash_next;
+			free(topic);
+			topic = next;
+		}
+	}
+	free(hub);
+}
+
+int subscription_add(subscription_hub_t *hub, subscription_t *subscription, void *owner,
+		const subscribe_request_t *request, uint64_t now_ms) {
+	uint64_t interval_ticks = (request->interval_ms + SUBSCRIPTION_TICK_MS - 1) / SUBSCRIPTION_TICK_MS;
+	if (interval_ticks == 0) {
+		interval_ticks = 1;
+	}
+	if (hub->topic_count == 0) {
+		// An idle hub is not advanced, so its clock may be stale.
+		hub->tick = now_ms / SUBSCRIPTION_TICK_MS;
+	}
+
+	subscription->count = 0;
+	for (size_t i = 0; i < request->count; ++i) {
+		subscription_topic_t *topic = topic_get(hub, request->entries[i].city_index, request->generation,
+				request->entries[i].type, interval_ticks);
+		if (topic == NULL) {
+			subscription_cancel(hub, subscription);
+			return -1;
+		}
+
+		subscription_link_t *link = &subscription->links[subscription->count++];
+		link->topic = topic;
+		link->owner = owner;
+		link->item = request->entries[i].item;
+		link->prev = NULL;
+		link->next = topic->subscribers;
+		if (topic->subscribers != NULL) {
+			topic->subscribers->prev = link;
+		}
+		topic->subscribers = link;
+	}
+	return 0;
+}
+
+void subscription_cancel(subscription_hub_t *hub, subscription_t *subscription) {
+	(void)hub;
+	for (size_t i = 0; i < subscription->count; ++i) {
+		subscription_link_t *link = &subscription->links[i];
+		if (link->prev != NULL) {
+			link->prev->next = link->next;
+		} else {
+			link->topic->subscribers = link->next;
+		}
+		if (link->next != NULL) {
+			link->next->prev = link->prev;
+		}
+	}
+	subscription->count = 0;
+}
+
+void subscription_advance(subscription_hub_t *hub, uint64_t now_ms) {
+	const uint64_t target = now_ms / SUBSCRIPTION_TICK_MS;
+	if (hub->topic_count == 0) {
+		hub->tick = target;
+		return;
+	}
+	// After a long stall one turn of the wheel visits every topic once.
+	if (target > hub->tick + SUBSCRIPTION_WHEEL_SLOTS) {
+		hub->tick = target - SUBSCRIPTION_WHEEL_SLOTS;
+	}
+
+	while (hub->tick < target) {
+		++hub->tick;
+		const size_t slot = (size_t)(hub->tick % SUBSCRIPTION_WHEEL_SLOTS);
+		subscription_topic_t *topic = hub->wheel[slot];
+		hub->wheel[slot] = NULL;
+
+		while (topic != NULL) {
+			subscription_topic_t *next = topic->wheel_next;
+			if (topic->subscribers == NULL) {
+				topic_free(hub, topic);
+			} else {
+				if (topic->due_tick <= hub->tick) {
+					topic_fire(hub, topic);
+					topic->due_tick = hub->tick + topic->interval_ticks;
+				}
+				wheel_insert(hub, topic);
+			}
+			topic = next;
+		}
+	}
+}
+
+int subscription_wait_ms(const subscription_hub_t *hub, uint64_t now_ms) {
+	if (hub->topic_count == 0) {
+		return -1;
+	}
+	for (uint64_t tick = hub->tick + 1; tick <= hub->tick + SUBSCRIPTION_WHEEL_SLOTS; ++tick) {
+		if (hub->wheel[tick % SUBSCRIPTION_WHEEL_SLOTS] != NULL) {
+			const uint64_t due_ms = tick * SUBSCRIPTION_TICK_MS;
+			return due_ms <= now_ms ? 0 : (int)(due_ms - now_ms);
+		}
+	}
+	return SUBSCRIPTION_WHEEL_SLOTS * SUBSCRIPTION_TICK_MS;
+}
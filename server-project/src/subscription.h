@@ -0,0 +1,78 @@
+/*
+ * subscription.h
+ *
+ * Streaming subscriptions
+ * A subscriber registers (city, type) pairs with an update interval. Every
+ * distinct (city, type, interval) is one topic, however many connections
+ * follow it: when a topic falls due on the timer wheel, one value is
+ * generated and fanned out to all of its subscribers through the hub's
+ * delivery callback.
+ *
+ * Topics name their cities by catalog index, which a catalog reload
+ * renumbers: a topic whose generation is no longer current is never fired
+ * again, and each of its subscribers is handed to the hub's expiry
+ * callback instead, to be cancelled.
+ *
+ * A hub belongs to one event loop thread and is never shared.
+ */
+
+#ifndef SUBSCRIPTION_H_
+#define SUBSCRIPTION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define SUBSCRIPTION_TICK_MS 10        // Timer wheel resolution
+#define SUBSCRIPTION_WHEEL_SLOTS 1024  // Slots per wheel turn (~10 s at 10 ms)
+#define SUBSCRIPTION_HASH_BUCKETS 1024 // Topic lookup table size
+
+// Called once per subscriber of a due topic: owner is the subscriber given
+// to subscription_add(), item its subscribe item number. It must not add or
+// cancel subscriptions.
+typedef void (*subscription_deliver_t)(void *context, void *owner, unsigned int item, char type, float value);
+
+// Called once per subscriber of a due topic whose cities a catalog reload
+// renumbered; the same restrictions as for delivery apply.
+typedef void (*subscription_expire_t)(void *context, void *owner);
+
+typedef struct subscription_topic subscription_topic_t;
+
+// One subscribed item, linked into its topic's subscriber list
+typedef struct subscription_link {
+	subscription_topic_t *topic;
+	struct subscription_link *prev;
+	struct subscription_link *next;
+	void *owner;
+	unsigned char item;
+} subscription_link_t;
+
+// All the items of one subscriber
+typedef struct {
+	subscription_link_t links[MAX_SUBSCRIBE_ITEMS];
+	size_t count;
+} subscription_t;
+
+typedef struct subscription_hub subscription_hub_t;
+
+subscription_hub_t *subscription_hub_create(subscription_deliver_t deliver, subscription_expire_t expire, void *context);
+void subscription_hub_destroy(subscription_hub_t *hub);
+
+// Links every accepted item of request into its topic; the first update of
+// a new topic follows one interval after now_ms. Returns -1 if out of
+// memory, with nothing registered.
+int subscription_add(subscription_hub_t *hub, subscription_t *subscription, void *owner,
+		const subscribe_request_t *request, uint64_t now_ms);
+
+// Unlinks every item of the subscription; topics left without subscribers
+// are freed the next time they fall due.
+void subscription_cancel(subscription_hub_t *hub, subscription_t *subscription);
+
+// Fires every topic due by now_ms.
+void subscription_advance(subscription_hub_t *hub, uint64_t now_ms);
+
+// Milliseconds until the next occupied wheel slot, or -1 when there are no topics.
+int subscription_wait_ms(const subscription_hub_t *hub, uint64_t now_ms);
+
+#endif /* SUBSCRIPTION_H_ */
@@ -0,0 +1,868 @@
+/*
+ * uring.c
+ *
+ * io_uring server loop
+ *
+ * The ring is driven through the raw io_uring_setup/enter/register system
+ * calls, so the backend needs no library beyond the kernel headers.
+ *
+ * One multishot accept produces every new connection. Receives select a
+ * buffer from a provided buffer ring, so idle connections pin no receive
+ * buffer in the kernel; the data is copied into the connection's request
+ * buffer and the buffer is handed straight back. Responses are sent from
+ * the connection's output buffer, and the final send of a connection is
+ * linked to its close. Every operation queued while handling a batch of
+ * completions, across all connections, goes to the kernel in the single
+ * io_uring_enter() that also waits for the next completions.
+ *
+ * Deadlines use the same sorted read/write lists as the epoll backend; the
+ * wait is bounded by the earliest one, and an expired connection has its
+ * pending receive and send cancelled before it is closed.
+ *
+ * A poll on the handoff pipe tells the loop that a new server took the
+ * listening socket: the multishot accept is cancelled and the open
+ * connections get DRAIN_TIMEOUT_MS to finish, as with epoll.
+ */
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+#include "catalog.h"
+#include "cache.h"
+#include "metrics.h"
+#include "request_log.h"
+#include "admission.h"
+#include "handoff.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+
+#define URING_ENTRIES 1024
+#define URING_BUFFER_COUNT 1024 // Provided receive buffers, power of two
+#define URING_BUFFER_SIZE 1024
+#define URING_BUFFER_GROUP 0
+#define CONNECTION_RX_SIZE (MAX_REQUEST_FRAME_SIZE * 2)
+#define CONNECTION_TX_SIZE (MAX_RESPONSE_FRAME_SIZE * 4)
+
+// Operation tag stored in the low bits of user_data, next to the connection pointer.
+enum {
+	OP_ACCEPT = 0,
+	OP_RECV = 1,
+	OP_SEND = 2,
+	OP_CLOSE = 3,
+	OP_CANCEL = 4,
+	OP_HANDOFF = 5,
+	OP_MASK = 7
+};
+
+struct deadline_list;
+
+typedef struct uring_connection {
+	int fd;
+	int closing;                       // Stop reading; close once the output is sent
+	int recv_pending;
+	int send_pending;
+	int close_pending;
+	int cancel_pending;
+	int send_cancel_pending;
+	int expired;                       // Closed by a deadline: pending output is dropped
+	size_t rx_len;                     // Buffered request bytes not yet parsed
+	size_t tx_len;                     // Buffered response bytes
+	size_t tx_sent;                    // Response bytes already written
+	size_t send_len;                   // Size of the send in flight
+	uint32_t client_addr;              // Peer IPv4 address, network order
+	uint64_t started_ns;               // Accept or request arrival time, 0 once answered
+	uint64_t deadline_ns;              // Expiry on deadline_list
+	struct deadline_list *deadline_list; // Read or write deadline list, NULL when on none
+	struct uring_connection *deadline_prev;
+	struct uring_connection *deadline_next;
+	struct uring_connection *live_prev; // Accepted and not yet released
+	struct uring_connection *live_next;
+	struct uring_connection *next_free;
+	unsigned char rx_buf[CONNECTION_RX_SIZE];
+	unsigned char tx_buf[CONNECTION_TX_SIZE];
+} uring_connection_t;
+
+_Static_assert(_Alignof(max_align_t) > OP_MASK, "connection pointers must leave room for the operation tag");
+
+typedef struct deadline_list {
+	uring_connection_t *head;          // Earliest expiry
+	uring_connection_t *tail;
+	uint64_t timeout_ns;               // 0 when the deadline is disabled
+	deadline_kind_t kind;
+} deadline_list_t;
+
+typedef struct {
+	int ring_fd;
+	int listen_socket;
+	int failed;                        // Set when the ring can no longer take submissions
+	const server_config_t *config;
+	size_t connection_count;           // Accepted and not yet released
+	uint64_t drain_deadline_ns;        // Set once the listening socket was handed over
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_local_tail;            // Entries filled in, published on submit
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	unsigned char *buffers;
+	unsigned short buf_tail;
+
+	uring_connection_t *live;          // Accepted and not yet released
+	uring_connection_t *free_list;     // Recycled connection objects
+	deadline_list_t read_deadlines;    // Waiting for a complete request
+	deadline_list_t write_deadlines;   // Waiting for the output to drain
+} uring_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static uint64_t make_user_data(uring_connection_t *conn, unsigned op) {
+	return (uint64_t)(uintptr_t)conn | op;
+}
+
+// Publishes the queued entries and, when wait is set, blocks for at least one
+// completion, or until wait_ns elapses when it is not UINT64_MAX (fails with ETIME).
+static int uring_submit(uring_t *ur, int wait, uint64_t wait_ns) {
+	__atomic_store_n(ur->sq_tail, ur->sq_local_tail, __ATOMIC_RELEASE);
+	const unsigned to_submit = ur->sq_local_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	if (to_submit == 0 && !wait) {
+		return 0;
+	}
+	if (!wait || wait_ns == UINT64_MAX) {
+		return sys_io_uring_enter(ur->ring_fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	}
+
+	struct __kernel_timespec timeout;
+	timeout.tv_sec = (long long)(wait_ns / 1000000000);
+	timeout.tv_nsec = (long long)(wait_ns % 1000000000);
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&timeout;
+	return sys_io_uring_enter(ur->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static struct io_uring_sqe *uring_sqe(uring_t *ur) {
+	if (ur->sq_local_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >= ur->sq_entries) {
+		// Queue full: hand what we have to the kernel before queueing more.
+		if (uring_submit(ur, 0, UINT64_MAX) < 0 || ur->sq_local_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >= ur->sq_entries) {
+			perror("io_uring_enter() fallita");
+			ur->failed = 1;
+			return NULL;
+		}
+	}
+
+	const unsigned index = ur->sq_local_tail & ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->sq_array[index] = index;
+	++ur->sq_local_tail;
+	return sqe;
+}
+
+static void buffer_recycle(uring_t *ur, unsigned short bid) {
+	struct io_uring_buf *buf = &ur->buf_ring->bufs[ur->buf_tail & (URING_BUFFER_COUNT - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(ur->buffers + (size_t)bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = bid;
+	++ur->buf_tail;
+	__atomic_store_n(&ur->buf_ring->tail, ur->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void arm_accept(uring_t *ur) {
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = ur->listen_socket;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = make_user_data(NULL, OP_ACCEPT);
+}
+
+static void arm_handoff_poll(uring_t *ur) {
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = handoff_wake_fd();
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = make_user_data(NULL, OP_HANDOFF);
+}
+
+static void arm_recv(uring_t *ur, uring_connection_t *conn) {
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	sqe->len = URING_BUFFER_SIZE;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = make_user_data(conn, OP_RECV);
+	conn->recv_pending = 1;
+}
+
+static void arm_close(uring_t *ur, uring_connection_t *conn) {
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = conn->fd;
+	sqe->user_data = make_user_data(conn, OP_CLOSE);
+	conn->close_pending = 1;
+}
+
+static void arm_send(uring_t *ur, uring_connection_t *conn, int link_close) {
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return;
+	}
+	conn->send_len = conn->tx_len - conn->tx_sent;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(conn->tx_buf + conn->tx_sent);
+	sqe->len = (unsigned)conn->send_len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = make_user_data(conn, OP_SEND);
+	conn->send_pending = 1;
+
+	if (link_close) {
+		// A short send still succeeds and would let the close truncate the
+		// response. With MSG_WAITALL the kernel keeps sending until the whole
+		// buffer is out, and a send that ends short anyway breaks the link:
+		// the close then completes with -ECANCELED and on_close() retries.
+		sqe->msg_flags |= MSG_WAITALL;
+		sqe->flags |= IOSQE_IO_LINK;
+		arm_close(ur, conn);
+	}
+}
+
+static int arm_cancel(uring_t *ur, uring_connection_t *conn, unsigned op) {
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = make_user_data(conn, op);
+	// The cancel completion carries no connection: it may arrive after the connection is gone.
+	sqe->user_data = make_user_data(NULL, OP_CANCEL);
+	return 0;
+}
+
+static void arm_cancel_recv(uring_t *ur, uring_connection_t *conn) {
+	if (arm_cancel(ur, conn, OP_RECV) == 0) {
+		conn->cancel_pending = 1;
+	}
+}
+
+static void arm_cancel_send(uring_t *ur, uring_connection_t *conn) {
+	if (arm_cancel(ur, conn, OP_SEND) == 0) {
+		conn->send_cancel_pending = 1;
+	}
+}
+
+static void deadline_cancel(uring_connection_t *conn) {
+	deadline_list_t *list = conn->deadline_list;
+	if (list == NULL) {
+		return;
+	}
+	if (conn->deadline_prev != NULL) {
+		conn->deadline_prev->deadline_next = conn->deadline_next;
+	} else {
+		list->head = conn->deadline_next;
+	}
+	if (conn->deadline_next != NULL) {
+		conn->deadline_next->deadline_prev = conn->deadline_prev;
+	} else {
+		list->tail = conn->deadline_prev;
+	}
+	conn->deadline_list = NULL;
+	conn->deadline_prev = NULL;
+	conn->deadline_next = NULL;
+}
+
+// (Re)starts the list's deadline for conn, measured from now.
+static void deadline_arm(deadline_list_t *list, uring_connection_t *conn) {
+	deadline_cancel(conn);
+	if (list->timeout_ns == 0) {
+		return;
+	}
+	conn->deadline_ns = metrics_now_ns() + list->timeout_ns;
+	conn->deadline_list = list;
+	conn->deadline_prev = list->tail;
+	if (list->tail != NULL) {
+		list->tail->deadline_next = conn;
+	} else {
+		list->head = conn;
+	}
+	list->tail = conn;
+}
+
+// Nanoseconds until the earliest deadline, or UINT64_MAX when none is pending.
+static uint64_t deadline_wait_ns(const uring_t *ur) {
+	uint64_t earliest = UINT64_MAX;
+	if (ur->read_deadlines.head != NULL) {
+		earliest = ur->read_deadlines.head->deadline_ns;
+	}
+	if (ur->write_deadlines.head != NULL && ur->write_deadlines.head->deadline_ns < earliest) {
+		earliest = ur->write_deadlines.head->deadline_ns;
+	}
+	if (ur->drain_deadline_ns != 0 && ur->drain_deadline_ns < earliest) {
+		earliest = ur->drain_deadline_ns;
+	}
+	if (earliest == UINT64_MAX) {
+		return UINT64_MAX;
+	}
+	const uint64_t now = metrics_now_ns();
+	// Never 0: a zero timeout would still wait for a completion on some kernels.
+	return earliest <= now ? 1 : earliest - now;
+}
+
+static uring_connection_t *connection_alloc(uring_t *ur) {
+	uring_connection_t *conn = ur->free_list;
+	if (conn != NULL) {
+		ur->free_list = conn->next_free;
+	} else {
+		conn = malloc(sizeof(*conn));
+		if (conn == NULL) {
+			return NULL;
+		}
+	}
+	memset(conn, 0, offsetof(uring_connection_t, rx_buf));
+	conn->fd = -1;
+	return conn;
+}
+
+static void connection_release(uring_t *ur, uring_connection_t *conn) {
+	deadline_cancel(conn);
+	admission_close();
+	--ur->connection_count;
+	if (conn->live_prev != NULL) {
+		conn->live_prev->live_next = conn->live_next;
+	} else {
+		ur->live = conn->live_next;
+	}
+	if (conn->live_next != NULL) {
+		conn->live_next->live_prev = conn->live_prev;
+	}
+	conn->fd = -1;
+	conn->next_free = ur->free_list;
+	ur->free_list = conn;
+}
+
+// Same framing as the epoll backend: answer every complete buffered frame in
+// order while the output buffer can hold the largest possible response.
+// Returns the number of frames answered.
+static int connection_process(uring_t *ur, uring_connection_t *conn) {
+	size_t offset = 0;
+	int processed = 0;
+	while (!conn->closing && CONNECTION_TX_SIZE - conn->tx_len >= MAX_RESPONSE_FRAME_SIZE) {
+		const char *frame = (const char *)conn->rx_buf + offset;
+		size_t frame_length = request_frame_length(frame, conn->rx_len - offset);
+		if (frame_length == 0 || frame_length > conn->rx_len - offset) {
+			break;
+		}
+
+		char *out = (char *)conn->tx_buf + conn->tx_len;
+		const char *reply = NULL;
+		size_t reply_length = 0;
+		const int frame_result = process_request_frame(frame, frame_length, conn->client_addr, out, &reply, &reply_length);
+		if (reply != out) {
+			// Error template: the output buffer must stay contiguous for a single send.
+			memcpy(out, reply, reply_length);
+		}
+		if (frame_result < 0) {
+			conn->closing = 1;
+		}
+		conn->tx_len += reply_length;
+		offset += frame_length;
+		++processed;
+
+		if (!ur->config->keep_alive) {
+			conn->closing = 1;
+		}
+	}
+
+	if (offset > 0) {
+		memmove(conn->rx_buf, conn->rx_buf + offset, conn->rx_len - offset);
+		conn->rx_len -= offset;
+	}
+	return processed;
+}
+
+// Queues whatever the connection needs next: responses, the final close, more input.
+// Returns the number of frames answered.
+static int connection_queue(uring_t *ur, uring_connection_t *conn) {
+	if (conn->close_pending) {
+		// A linked close is in flight; its completion decides what happens next.
+		return 0;
+	}
+
+	if (conn->expired && !conn->send_pending) {
+		conn->tx_len = 0;
+		conn->tx_sent = 0;
+	}
+	const int processed = connection_process(ur, conn);
+
+	if (!conn->send_pending && conn->tx_sent < conn->tx_len) {
+		arm_send(ur, conn, conn->closing && !conn->recv_pending);
+	} else if (conn->closing && !conn->send_pending && !conn->recv_pending) {
+		arm_close(ur, conn);
+	}
+
+	if (conn->closing) {
+		if (conn->recv_pending && !conn->cancel_pending) {
+			arm_cancel_recv(ur, conn);
+		}
+		return processed;
+	}
+
+	// Stop reading while the output is backed up, exactly like EPOLLOUT parking.
+	if (!conn->recv_pending
+			&& CONNECTION_RX_SIZE - conn->rx_len >= URING_BUFFER_SIZE
+			&& CONNECTION_TX_SIZE - conn->tx_len >= MAX_RESPONSE_FRAME_SIZE) {
+		arm_recv(ur, conn);
+	}
+	return processed;
+}
+
+// Queues the connection's next operations and moves it to the deadline list of what it now waits for.
+static void connection_advance(uring_t *ur, uring_connection_t *conn) {
+	const int processed = connection_queue(ur, conn);
+
+	if (conn->expired) {
+		deadline_cancel(conn);
+	} else if (conn->send_pending) {
+		// Partial progress does not extend the write deadline.
+		if (conn->deadline_list != &ur->write_deadlines) {
+			deadline_arm(&ur->write_deadlines, conn);
+		}
+	} else if (conn->recv_pending && !conn->closing) {
+		// The read deadline restarts with each answered request, not with each fragment.
+		if (processed > 0 || conn->deadline_list != &ur->read_deadlines) {
+			deadline_arm(&ur->read_deadlines, conn);
+		}
+	} else {
+		deadline_cancel(conn);
+	}
+}
+
+// Cancels the I/O of every connection whose deadline has passed; the
+// cancellations complete as errors and the usual close path follows.
+static void expire_connections(uring_t *ur) {
+	deadline_list_t *lists[2] = { &ur->read_deadlines, &ur->write_deadlines };
+	if (lists[0]->head == NULL && lists[1]->head == NULL) {
+		return;
+	}
+
+	const uint64_t now = metrics_now_ns();
+	for (int i = 0; i < 2; ++i) {
+		while (lists[i]->head != NULL && lists[i]->head->deadline_ns <= now) {
+			uring_connection_t *conn = lists[i]->head;
+			admission_count_timeout(lists[i]->kind);
+			deadline_cancel(conn);
+			conn->closing = 1;
+			conn->expired = 1;
+			if (conn->send_pending && !conn->send_cancel_pending) {
+				arm_cancel_send(ur, conn);
+			}
+			connection_advance(ur, conn);
+		}
+	}
+}
+
+static void on_accept(uring_t *ur, int result, unsigned flags) {
+	if (!(flags & IORING_CQE_F_MORE) && ur->drain_deadline_ns == 0) {
+		// The multishot accept ended (error or overflow): re-arm it.
+		arm_accept(ur);
+	}
+
+	if (result < 0) {
+		if (result == -EINVAL) {
+			fprintf(stderr, "accept multishot non supportata dal kernel\n");
+			ur->failed = 1;
+		} else if (result != -EINTR && result != -EAGAIN && result != -ECONNABORTED && result != -ECANCELED) {
+			fprintf(stderr, "accept() fallita: %s\n", strerror(-result));
+		}
+		return;
+	}
+
+	metrics_count_accept();
+	struct sockaddr_in client_addr;
+	memset(&client_addr, 0, sizeof(client_addr));
+	if (ur->config->log_level != LOG_LEVEL_OFF || ur->config->ip_rate > 0) {
+		// Multishot accept reports no peer address; only the request log and the rate limit need it.
+		socklen_t client_addr_len = sizeof(client_addr);
+		getpeername(result, (struct sockaddr *)&client_addr, &client_addr_len);
+	}
+	if (admission_open(client_addr.sin_addr.s_addr) != ADMISSION_ACCEPTED) {
+		reject_connection(result);
+		return;
+	}
+
+	uring_connection_t *conn = connection_alloc(ur);
+	if (conn == NULL) {
+		fprintf(stderr, "Memoria insufficiente per una nuova connessione\n");
+		close(result);
+		admission_close();
+		return;
+	}
+
+	conn->fd = result;
+	++ur->connection_count;
+	conn->live_next = ur->live;
+	if (ur->live != NULL) {
+		ur->live->live_prev = conn;
+	}
+	ur->live = conn;
+	conn->started_ns = metrics_now_ns();
+	conn->client_addr = client_addr.sin_addr.s_addr;
+	connection_advance(ur, conn);
+}
+
+static void on_recv(uring_t *ur, uring_connection_t *conn, int result, unsigned flags) {
+	conn->recv_pending = 0;
+
+	if (flags & IORING_CQE_F_BUFFER) {
+		const unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+		if (result > 0) {
+			metrics_count_recv((size_t)result, conn->rx_len > 0);
+			if (conn->started_ns == 0) {
+				conn->started_ns = metrics_now_ns();
+			}
+			// Armed only with at least URING_BUFFER_SIZE bytes free, so the data always fits.
+			memcpy(conn->rx_buf + conn->rx_len, ur->buffers + (size_t)bid * URING_BUFFER_SIZE, (size_t)result);
+			conn->rx_len += (size_t)result;
+		}
+		buffer_recycle(ur, bid);
+	}
+
+	if (result == 0 || (result < 0 && result != -ENOBUFS && result != -EINTR && result != -EAGAIN)) {
+		if (result < 0 && result != -ECANCELED && result != -ECONNRESET) {
+			fprintf(stderr, "recv() fallita: %s\n", strerror(-result));
+		}
+		// EOF or error: answer whatever complete requests are still buffered, then close.
+		connection_process(ur, conn);
+		conn->closing = 1;
+	}
+
+	connection_advance(ur, conn);
+}
+
+static void on_send(uring_t *ur, uring_connection_t *conn, int result) {
+	conn->send_pending = 0;
+
+	if (result < 0) {
+		if (result != -EINTR && result != -EAGAIN) {
+			if (result != -EPIPE && result != -ECONNRESET && result != -ECANCELED) {
+				fprintf(stderr, "send() fallita: %s\n", strerror(-result));
+			}
+			conn->closing = 1;
+			conn->tx_len = 0;
+			conn->tx_sent = 0;
+		}
+	} else {
+		metrics_count_send((size_t)result, conn->send_len);
+		conn->tx_sent += (size_t)result;
+		if (conn->tx_sent == conn->tx_len) {
+			if (conn->started_ns != 0) {
+				metrics_observe_latency(metrics_now_ns() - conn->started_ns);
+				conn->started_ns = 0;
+			}
+			conn->tx_len = 0;
+			conn->tx_sent = 0;
+		}
+	}
+
+	connection_advance(ur, conn);
+}
+
+static void on_close(uring_t *ur, uring_connection_t *conn, int result) {
+	conn->close_pending = 0;
+	if (result == -ECANCELED) {
+		// The linked MSG_WAITALL send failed or came up short: send the rest, if any, then close again.
+		connection_advance(ur, conn);
+		return;
+	}
+	connection_release(ur, conn);
+}
+
+// The listening socket now belongs to a new server: connections already
+// accepted are served, no new ones are taken.
+static void on_handoff(uring_t *ur) {
+	if (arm_cancel(ur, NULL, OP_ACCEPT) < 0) {
+		ur->failed = 1;
+	}
+	ur->drain_deadline_ns = metrics_now_ns() + (uint64_t)DRAIN_TIMEOUT_MS * 1000000;
+}
+
+static int drained(const uring_t *ur) {
+	return ur->drain_deadline_ns != 0
+			&& (ur->connection_count == 0 || metrics_now_ns() >= ur->drain_deadline_ns);
+}
+
+static void uring_teardown(uring_t *ur) {
+	if (ur->ring_fd >= 0) {
+		// Closing the ring cancels whatever is still in flight.
+		close(ur->ring_fd);
+	}
+	while (ur->live != NULL) {
+		uring_connection_t *conn = ur->live;
+		ur->live = conn->live_next;
+		// A queued close may already have run and the descriptor been reused:
+		// leaking it is safer than closing someone else's.
+		if (!conn->close_pending) {
+			close(conn->fd);
+		}
+		admission_close();
+		free(conn);
+	}
+	ur->connection_count = 0;
+	while (ur->free_list != NULL) {
+		uring_connection_t *conn = ur->free_list;
+		ur->free_list = conn->next_free;
+		free(conn);
+	}
+
+	if (ur->buf_ring != NULL) {
+		munmap(ur->buf_ring, ur->buf_ring_size);
+	}
+	free(ur->buffers);
+	if (ur->sqes != NULL) {
+		munmap(ur->sqes, ur->sqes_size);
+	}
+	if (ur->cq_ring != NULL && ur->cq_ring != ur->sq_ring) {
+		munmap(ur->cq_ring, ur->cq_ring_size);
+	}
+	if (ur->sq_ring != NULL) {
+		munmap(ur->sq_ring, ur->sq_ring_size);
+	}
+}
+
+static int uring_setup(uring_t *ur) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ur->ring_fd = sys_io_uring_setup(URING_ENTRIES, &params);
+	if (ur->ring_fd < 0) {
+		perror("io_uring_setup() fallita");
+		return -1;
+	}
+
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		// Needed for deadline-bounded waits; every kernel with buffer rings has it.
+		fprintf(stderr, "io_uring senza IORING_FEAT_EXT_ARG\n");
+		return -1;
+	}
+
+	ur->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ur->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_size > ur->sq_ring_size) {
+			ur->sq_ring_size = ur->cq_ring_size;
+		}
+		ur->cq_ring_size = ur->sq_ring_size;
+	}
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED) {
+		ur->sq_ring = NULL;
+		perror("mmap() dell'anello io_uring fallita");
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED) {
+			ur->cq_ring = NULL;
+			perror("mmap() dell'anello io_uring fallita");
+			return -1;
+		}
+	}
+
+	ur->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) {
+		ur->sqes = NULL;
+		perror("mmap() dell'anello io_uring fallita");
+		return -1;
+	}
+
+	unsigned char *sq = ur->sq_ring;
+	ur->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ur->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ur->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ur->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	ur->sq_entries = params.sq_entries;
+	ur->sq_local_tail = *ur->sq_tail;
+
+	unsigned char *cq = ur->cq_ring;
+	ur->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ur->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ur->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	// Provided buffer ring (kernel 5.19+, which also brings multishot accept).
+	ur->buf_ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+	ur->buf_ring = mmap(NULL, ur->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ur->buf_ring == MAP_FAILED) {
+		ur->buf_ring = NULL;
+		perror("mmap() del buffer ring fallita");
+		return -1;
+	}
+	ur->buffers = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+	if (ur->buffers == NULL) {
+		fprintf(stderr, "Memoria insufficiente per i buffer di ricezione\n");
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ur->buf_ring;
+	reg.ring_entries = URING_BUFFER_COUNT;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (sys_io_uring_register(ur->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		perror("Registrazione del buffer ring io_uring fallita");
+		return -1;
+	}
+
+	ur->buf_tail = 0;
+	for (unsigned int bid = 0; bid < URING_BUFFER_COUNT; ++bid) {
+		buffer_recycle(ur, (unsigned short)bid);
+	}
+	return 0;
+}
+
+int uring_available(void) {
+	return 1;
+}
+
+int uring_run(int listen_socket, const server_config_t *config) {
+	uring_t ur;
+	memset(&ur, 0, sizeof(ur));
+	ur.ring_fd = -1;
+	ur.listen_socket = listen_socket;
+	ur.config = config;
+	ur.read_deadlines.timeout_ns = (uint64_t)config->read_timeout_ms * 1000000;
+	ur.read_deadlines.kind = DEADLINE_READ;
+	ur.write_deadlines.timeout_ns = (uint64_t)config->write_timeout_ms * 1000000;
+	ur.write_deadlines.kind = DEADLINE_WRITE;
+
+	if (uring_setup(&ur) < 0) {
+		uring_teardown(&ur);
+		return -1;
+	}
+
+	arm_accept(&ur);
+	if (handoff_wake_fd() >= 0) {
+		arm_handoff_poll(&ur);
+	}
+	while (!ur.failed && !drained(&ur)) {
+		// Submit everything queued by the previous batch and wait in the same call.
+		if (uring_submit(&ur, 1, deadline_wait_ns(&ur)) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN && errno != ETIME) {
+			perror("io_uring_enter() fallita");
+			break;
+		}
+		catalog_poll_reload();
+		weather_cache_poll_report();
+
+		unsigned head = *ur.cq_head;
+		const unsigned tail = __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			const struct io_uring_cqe *cqe = &ur.cqes[head & ur.cq_mask];
+			const uint64_t user_data = cqe->user_data;
+			const int result = cqe->res;
+			const unsigned flags = cqe->flags;
+			++head;
+			// Release the slot before handling it: handlers may need to submit.
+			__atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+
+			uring_connection_t *conn = (uring_connection_t *)(uintptr_t)(user_data & ~(uint64_t)OP_MASK);
+			switch ((unsigned)(user_data & OP_MASK)) {
+				case OP_ACCEPT:
+					on_accept(&ur, result, flags);
+					break;
+				case OP_RECV:
+					on_recv(&ur, conn, result, flags);
+					break;
+				case OP_SEND:
+					on_send(&ur, conn, result);
+					break;
+				case OP_CLOSE:
+					on_close(&ur, conn, result);
+					break;
+				case OP_HANDOFF:
+					// The result is the ready poll mask.
+					if (result > 0) {
+						on_handoff(&ur);
+					}
+					break;
+				default:
+					break;
+			}
+		}
+		expire_connections(&ur);
+	}
+
+	// Only reached on a fatal error or at the end of a drain; the connections
+	// still open are closed so a fallback to epoll starts from a clean slate.
+	uring_teardown(&ur);
+	return ur.drain_deadline_ns != 0 ? 0 : -1;
+}
+
+#else
+
+int uring_available(void) {
+	return 0;
+}
+
+int uring_run(int listen_socket, const server_config_t *config) {
+	(void)listen_socket;
+	(void)config;
+	return -1;
+}
+
+#endif
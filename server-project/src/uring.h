@@ -0,0 +1,23 @@
+/*
+ * uring.h
+ *
+ * io_uring server loop
+ * Completion-based backend: multishot accept, receives into a provided
+ * buffer ring and linked send + close, with the I/O of every connection
+ * submitted in one io_uring_enter() per loop iteration (Linux only).
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include "protocol.h"
+
+// Returns 1 when the io_uring backend is compiled in for this platform.
+int uring_available(void);
+
+// Serves clients from listen_socket until a fatal error; returns -1 if the
+// ring could not be set up (e.g. an old kernel), so the caller can fall back,
+// and 0 once a hot restart drained it.
+int uring_run(int listen_socket, const server_config_t *config);
+
+#endif /* URING_H_ */
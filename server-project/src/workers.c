@@ -0,0 +1,118 @@
+/*
+ * workers.c
+ *
+ * Multi-core worker pool
+ *
+ * Workers share nothing but the read-only configuration: each one has its
+ * own listening socket (SO_REUSEPORT) and runs serve_listener() on it, so
+ * there is no shared accept queue or lock between cores.
+ */
+
+#define _GNU_SOURCE
+
+#include "workers.h"
+#include "handoff.h"
+#include "rng.h"
+
+#if !defined WIN32
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	int index;
+	int listen_socket;
+	const server_config_t *config;
+	pthread_t thread;
+} worker_t;
+
+static void pin_to_cpu(int index) {
+#if defined(__linux__)
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 1) {
+		return;
+	}
+	// Best effort: keep each worker on one core so its caches stay warm.
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET((int)(index % cpus), &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)index;
+#endif
+}
+
+static void *worker_main(void *arg) {
+	worker_t *worker = arg;
+	pin_to_cpu(worker->index);
+	// Stream per worker index: with -S every worker replays the same sequence each run.
+	rng_thread_init((unsigned int)worker->index);
+	serve_listener(worker->listen_socket, worker->config);
+	return NULL;
+}
+
+int workers_available(void) {
+	return 1;
+}
+
+int workers_run(const server_config_t *config) {
+	const int count = config->workers;
+	worker_t *workers = calloc((size_t)count, sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Memoria insufficiente per %d worker\n", count);
+		return -1;
+	}
+
+	// Bind every listener before starting threads so a bind error aborts cleanly.
+	for (int i = 0; i < count; ++i) {
+		workers[i].index = i;
+		workers[i].config = config;
+		workers[i].listen_socket = create_listening_socket(config);
+	}
+	handoff_start(config->handoff_path);
+
+	int started = 0;
+	for (int i = 1; i < count; ++i) {
+		int result = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+		if (result != 0) {
+			fprintf(stderr, "pthread_create() fallita: %s\n", strerror(result));
+			break;
+		}
+		++started;
+	}
+	// The kernel would keep hashing connections onto listeners nobody accepts on.
+	for (int i = started + 1; i < count; ++i) {
+		handoff_unregister(workers[i].listen_socket);
+		close(workers[i].listen_socket);
+		workers[i].listen_socket = -1;
+	}
+
+	// The calling thread becomes worker 0.
+	worker_main(&workers[0]);
+
+	for (int i = 1; i <= started; ++i) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	for (int i = 0; i <= started; ++i) {
+		close(workers[i].listen_socket);
+	}
+	free(workers);
+	return handoff_draining() ? 0 : -1;
+}
+
+#else
+
+int workers_available(void) {
+	return 0;
+}
+
+int workers_run(const server_config_t *config) {
+	(void)config;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * workers.h
+ *
+ * Multi-core worker pool
+ * Starts one thread per worker, each owning an SO_REUSEPORT listener and
+ * its own event loop, so connections are spread across cores by the kernel.
+ */
+
+#ifndef WORKERS_H_
+#define WORKERS_H_
+
+#include "protocol.h"
+
+// Returns 1 when worker threads are supported on this platform.
+int workers_available(void);
+
+// Binds config->workers listeners and serves them in parallel; returns 0
+// once a hot restart drained every worker, -1 on failure.
+int workers_run(const server_config_t *config);
+
+#endif /* WORKERS_H_ */
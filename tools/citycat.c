@@ -0,0 +1,135 @@
+/*
+ * citycat.c
+ *
+ * City catalog converter
+ *
+ * Builds the binary catalog loaded by the server with -c from a CSV file:
+ * the first column of every line is a city name, empty lines and lines
+ * starting with '#' are skipped, and the first occurrence of a name wins.
+ *
+ * Usage: citycat cities.csv catalog.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "city_index.h"
+#include "weatherproto.h"
+
+#define LINE_LEN 512
+
+// Extracts the first CSV field of line in place, dropping quotes and surrounding blanks.
+static char *first_field(char *line) {
+	char *start = line;
+	while (*start == ' ' || *start == '\t') {
+		++start;
+	}
+
+	char *end = NULL;
+	if (*start == '"') {
+		++start;
+		end = strchr(start, '"');
+	} else {
+		end = start + strcspn(start, ",;\r\n");
+	}
+	if (end == NULL) {
+		return NULL;
+	}
+	*end = '\0';
+
+	size_t len = strlen(start);
+	while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) {
+		start[--len] = '\0';
+	}
+	return start;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Uso: %s cities.csv catalog.bin\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *in = fopen(argv[1], "r");
+	if (in == NULL) {
+		perror("fopen() fallita");
+		return EXIT_FAILURE;
+	}
+
+	char **names = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	size_t skipped = 0;
+	char line[LINE_LEN];
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (line[0] == '#') {
+			continue;
+		}
+		char *name = first_field(line);
+		if (name == NULL || name[0] == '\0') {
+			continue;
+		}
+		if (strlen(name) >= MAX_CITY_LEN) {
+			// Longer names could never match a weather_request_t city field.
+			++skipped;
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity = capacity == 0 ? 1024 : capacity * 2;
+			char **grown = realloc(names, capacity * sizeof(*names));
+			if (grown == NULL) {
+				fprintf(stderr, "Memoria insufficiente\n");
+				fclose(in);
+				return EXIT_FAILURE;
+			}
+			names = grown;
+		}
+		names[count] = malloc(strlen(name) + 1);
+		if (names[count] == NULL) {
+			fprintf(stderr, "Memoria insufficiente\n");
+			fclose(in);
+			return EXIT_FAILURE;
+		}
+		strcpy(names[count], name);
+		++count;
+	}
+	fclose(in);
+
+	if (count == 0) {
+		fprintf(stderr, "Nessuna città trovata in %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	// Drop case-insensitive duplicates using an index over what was read.
+	city_index_t index;
+	if (city_index_build(&index, (const char *const *)names, count) < 0) {
+		fprintf(stderr, "Impossibile costruire l'indice\n");
+		return EXIT_FAILURE;
+	}
+	size_t unique = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if ((size_t)city_index_find(&index, names[i]) == i) {
+			names[unique++] = names[i];
+		} else {
+			free(names[i]);
+			++skipped;
+		}
+	}
+	city_index_free(&index);
+
+	if (city_index_build(&index, (const char *const *)names, unique) < 0
+			|| city_index_save(&index, argv[2]) < 0) {
+		fprintf(stderr, "Scrittura del catalogo %s non riuscita\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	city_index_free(&index);
+
+	printf("Catalogo %s: %zu città (%zu righe scartate)\n", argv[2], unique, skipped);
+	for (size_t i = 0; i < unique; ++i) {
+		free(names[i]);
+	}
+	free(names);
+	return EXIT_SUCCESS;
+}